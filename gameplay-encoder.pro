@@ -15,7 +15,9 @@ SOURCES += src/Mesh.cpp \
     src/AnimationChannel.cpp \
     src/Animation.cpp \
     src/Animations.cpp \
+    src/AtlasPacker.cpp \
     src/Base.cpp \
+    src/BatchEncoder.cpp \
     src/BoundingVolume.cpp \
     src/Camera.cpp \
     src/Constants.cpp \
@@ -23,6 +25,7 @@ SOURCES += src/Mesh.cpp \
     src/edtaa3func.c \
     src/Effect.cpp \
     src/EncoderArguments.cpp \
+    src/EncoderServer.cpp \
     src/FBXSceneEncoder.cpp \
     src/FBXUtil.cpp \
     src/FileIO.cpp \
@@ -32,6 +35,8 @@ SOURCES += src/Mesh.cpp \
     src/GPBFile.cpp \
     src/Heightmap.cpp \
     src/Image.cpp \
+    src/ImageCache.cpp \
+    src/JobContext.cpp \
     src/Light.cpp \
     src/main.cpp \
     src/Material.cpp \
@@ -41,15 +46,19 @@ SOURCES += src/Mesh.cpp \
     src/MeshSkin.cpp \
     src/MeshSubSet.cpp \
     src/Model.cpp \
+    src/MSDFGenerator.cpp \
     src/Node.cpp \
     src/NormalMapGenerator.cpp \
     src/Object.cpp \
+    src/OutputCache.cpp \
+    src/PngWriter.cpp \
     src/Quaternion.cpp \
     src/Reference.cpp \
     src/ReferenceTable.cpp \
     src/Sampler.cpp \
     src/Scene.cpp \
     src/StringUtil.cpp \
+    src/TaskScheduler.cpp \
     src/Transform.cpp \
     src/TTFFontEncoder.cpp \
     src/TMXSceneEncoder.cpp \
@@ -64,7 +73,9 @@ HEADERS += src/AnimationChannel.h \
     src/AnimationChannel.h \
     src/Animation.h \
     src/Animations.h \
+    src/AtlasPacker.h \
     src/Base.h \
+    src/BatchEncoder.h \
     src/BoundingVolume.h \
     src/Camera.h \
     src/Constants.h \
@@ -73,6 +84,7 @@ HEADERS += src/AnimationChannel.h \
     src/edtaa3func.h \
     src/Effect.h \
     src/EncoderArguments.h \
+    src/EncoderServer.h \
     src/FBXSceneEncoder.h \
     src/FBXUtil.h \
     src/FileIO.h \
@@ -82,6 +94,8 @@ HEADERS += src/AnimationChannel.h \
     src/GPBFile.h \
     src/Heightmap.h \
     src/Image.h \
+    src/ImageCache.h \
+    src/JobContext.h \
     src/Light.h \
     src/Material.h \
     src/MaterialParameter.h \
@@ -91,9 +105,12 @@ HEADERS += src/AnimationChannel.h \
     src/MeshSkin.h \
     src/MeshSubSet.h \
     src/Model.h \
+    src/MSDFGenerator.h \
     src/Node.h \
     src/NormalMapGenerator.h \
     src/Object.h \
+    src/OutputCache.h \
+    src/PngWriter.h \
     src/Quaternion.h \
     src/Quaternion.inl \
     src/Reference.h \
@@ -101,7 +118,7 @@ HEADERS += src/AnimationChannel.h \
     src/Sampler.h \
     src/Scene.h \
     src/StringUtil.h \
-    src/Thread.h \
+    src/TaskScheduler.h \
     src/Transform.h \
     src/TTFFontEncoder.h \
     src/TMXSceneEncoder.h \
@@ -0,0 +1,198 @@
+#include "Base.h"
+#include "AtlasPacker.h"
+
+namespace gameplay
+{
+
+static unsigned int nextPowerOfTwo(unsigned int value)
+{
+    unsigned int result = 1;
+    while (result < value)
+        result <<= 1;
+    return result;
+}
+
+AtlasPacker::AtlasPacker(unsigned int width, unsigned int height) :
+    _width(width), _height(height)
+{
+    Segment segment = { 0, 0, width };
+    _skyline.push_back(segment);
+}
+
+bool AtlasPacker::insert(Rect* rect)
+{
+    // Find the position that leaves the bottom of the rectangle lowest, preferring
+    // the narrowest segment on a tie so wide gaps are kept for wide rectangles.
+    size_t bestIndex = _skyline.size();
+    unsigned int bestY = 0;
+    unsigned int bestBottom = UINT_MAX;
+    unsigned int bestWidth = UINT_MAX;
+    for (size_t i = 0, count = _skyline.size(); i < count; ++i)
+    {
+        unsigned int y;
+        if (!fit(i, rect->width, rect->height, &y))
+            continue;
+
+        unsigned int bottom = y + rect->height;
+        if (bottom < bestBottom || (bottom == bestBottom && _skyline[i].width < bestWidth))
+        {
+            bestIndex = i;
+            bestY = y;
+            bestBottom = bottom;
+            bestWidth = _skyline[i].width;
+        }
+    }
+
+    if (bestIndex == _skyline.size())
+        return false;
+
+    rect->x = _skyline[bestIndex].x;
+    rect->y = bestY;
+    if (rect->width == 0)
+        return true;
+
+    // Raise the skyline under the rectangle, trimming the segments it covers
+    Segment segment = { rect->x, bestBottom, rect->width };
+    _skyline.insert(_skyline.begin() + bestIndex, segment);
+    for (size_t i = bestIndex + 1; i < _skyline.size(); )
+    {
+        const Segment& previous = _skyline[i - 1];
+        Segment& current = _skyline[i];
+        unsigned int right = previous.x + previous.width;
+        if (current.x >= right)
+            break;
+
+        unsigned int overlap = right - current.x;
+        if (current.width <= overlap)
+        {
+            _skyline.erase(_skyline.begin() + i);
+            continue;
+        }
+        current.x += overlap;
+        current.width -= overlap;
+        break;
+    }
+
+    // Merge neighbouring segments at the same height
+    for (size_t i = 0; i + 1 < _skyline.size(); )
+    {
+        if (_skyline[i].y == _skyline[i + 1].y)
+        {
+            _skyline[i].width += _skyline[i + 1].width;
+            _skyline.erase(_skyline.begin() + i + 1);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    return true;
+}
+
+unsigned int AtlasPacker::getUsedHeight() const
+{
+    unsigned int height = 0;
+    for (size_t i = 0, count = _skyline.size(); i < count; ++i)
+        height = max(height, _skyline[i].y);
+    return height;
+}
+
+bool AtlasPacker::fit(size_t index, unsigned int width, unsigned int height, unsigned int* y) const
+{
+    unsigned int x = _skyline[index].x;
+    if (x + width > _width)
+        return false;
+
+    // The rectangle rests on the highest segment it spans
+    unsigned int top = _skyline[index].y;
+    for (size_t i = index + 1, count = _skyline.size(); i < count && _skyline[i].x < x + width; ++i)
+        top = max(top, _skyline[i].y);
+
+    if (top + height > _height)
+        return false;
+
+    *y = top;
+    return true;
+}
+
+static bool compareRectHeights(const AtlasPacker::Rect* a, const AtlasPacker::Rect* b)
+{
+    if (a->height != b->height)
+        return a->height > b->height;
+    return a->width > b->width;
+}
+
+static void sortRects(std::vector<AtlasPacker::Rect>& rects, std::vector<AtlasPacker::Rect*>* order)
+{
+    order->resize(rects.size());
+    for (size_t i = 0, count = rects.size(); i < count; ++i)
+        (*order)[i] = &rects[i];
+    std::stable_sort(order->begin(), order->end(), compareRectHeights);
+}
+
+bool AtlasPacker::pack(std::vector<Rect>& rects, bool powerOfTwo, unsigned int* width, unsigned int* height, unsigned int maxSize)
+{
+    // Place the tallest rectangles first
+    std::vector<Rect*> order;
+    sortRects(rects, &order);
+
+    unsigned long long area = 0;
+    unsigned int maxWidth = 1;
+    for (size_t i = 0, count = rects.size(); i < count; ++i)
+    {
+        area += (unsigned long long)rects[i].width * rects[i].height;
+        maxWidth = max(maxWidth, rects[i].width);
+    }
+
+    // Aim for a roughly square atlas, the height is whatever the layout ends up needing
+    unsigned int atlasWidth = max(maxWidth, (unsigned int)ceil(sqrt((double)area)));
+    atlasWidth = powerOfTwo ? nextPowerOfTwo(atlasWidth) : (atlasWidth + 3) & ~3u;
+    if (atlasWidth > maxSize)
+        return false;
+
+    AtlasPacker packer(atlasWidth, maxSize);
+    for (size_t i = 0, count = order.size(); i < count; ++i)
+    {
+        if (!packer.insert(order[i]))
+            return false;
+        order[i]->page = 0;
+    }
+
+    unsigned int atlasHeight = max(1u, packer.getUsedHeight());
+    if (powerOfTwo)
+        atlasHeight = nextPowerOfTwo(atlasHeight);
+
+    *width = atlasWidth;
+    *height = atlasHeight;
+    return true;
+}
+
+bool AtlasPacker::packPages(std::vector<Rect>& rects, unsigned int pageSize, unsigned int* pageCount)
+{
+    std::vector<Rect*> order;
+    sortRects(rects, &order);
+
+    std::vector<AtlasPacker> pages;
+    for (size_t i = 0, count = order.size(); i < count; ++i)
+    {
+        Rect* rect = order[i];
+        if (rect->width > pageSize || rect->height > pageSize)
+            return false;
+
+        size_t page = 0;
+        while (page < pages.size() && !pages[page].insert(rect))
+            ++page;
+        if (page == pages.size())
+        {
+            pages.push_back(AtlasPacker(pageSize, pageSize));
+            pages.back().insert(rect);
+        }
+        rect->page = (unsigned int)page;
+    }
+
+    *pageCount = max((unsigned int)pages.size(), 1u);
+    return true;
+}
+
+}
@@ -0,0 +1,106 @@
+#ifndef ATLASPACKER_H_
+#define ATLASPACKER_H_
+
+#include <vector>
+
+namespace gameplay
+{
+
+/**
+ * Packs rectangles into a texture atlas using the skyline bottom-left heuristic.
+ *
+ * The skyline is the top edge of everything placed so far, stored as a list of
+ * horizontal segments. Each rectangle goes where its bottom edge ends up lowest,
+ * on top of the skyline, which leaves far less unused space than fixed height
+ * shelves when rectangle heights vary.
+ */
+class AtlasPacker
+{
+public:
+
+    /**
+     * A rectangle to pack.
+     */
+    struct Rect
+    {
+        unsigned int width;
+        unsigned int height;
+        unsigned int x;
+        unsigned int y;
+        unsigned int page;
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param width Width of the atlas.
+     * @param height Height of the atlas.
+     */
+    AtlasPacker(unsigned int width, unsigned int height);
+
+    /**
+     * Places a rectangle in the atlas.
+     *
+     * @param rect The rectangle to place. Its x and y are set if it fits.
+     *
+     * @return True if the rectangle fits, false if there is no room left for it.
+     */
+    bool insert(Rect* rect);
+
+    /**
+     * Returns the height of the highest point of the skyline.
+     */
+    unsigned int getUsedHeight() const;
+
+    /**
+     * Packs rectangles into the smallest atlas that will fit them, with a single
+     * layout pass.
+     *
+     * Rectangles are placed tallest first. The atlas width is picked from the total area
+     * of the rectangles, and the height is then whatever the layout needed. The atlas does
+     * not have to be square.
+     *
+     * @param rects The rectangles to pack. Their x and y are set on return, and their page to 0.
+     * @param powerOfTwo True to round the atlas width and height up to powers of two,
+     *        false to only round the width up to a multiple of 4 (for row alignment).
+     * @param width Receives the atlas width.
+     * @param height Receives the atlas height.
+     * @param maxSize Maximum atlas width and height.
+     *
+     * @return True if the rectangles were packed, false if they don't fit within maxSize.
+     */
+    static bool pack(std::vector<Rect>& rects, bool powerOfTwo, unsigned int* width, unsigned int* height, unsigned int maxSize = 16384);
+
+    /**
+     * Packs rectangles into as many square pages of a fixed size as they need.
+     *
+     * Rectangles are placed tallest first, each on the first page with room for it.
+     *
+     * @param rects The rectangles to pack. Their x, y and page are set on return.
+     * @param pageSize Width and height of every page.
+     * @param pageCount Receives the number of pages used.
+     *
+     * @return True if the rectangles were packed, false if one is larger than a page.
+     */
+    static bool packPages(std::vector<Rect>& rects, unsigned int pageSize, unsigned int* pageCount);
+
+private:
+
+    // A horizontal segment of the skyline
+    struct Segment
+    {
+        unsigned int x;
+        unsigned int y;
+        unsigned int width;
+    };
+
+    bool fit(size_t index, unsigned int width, unsigned int height, unsigned int* y) const;
+
+    unsigned int _width;
+    unsigned int _height;
+    std::vector<Segment> _skyline;
+};
+
+}
+
+#endif
@@ -1,8 +1,45 @@
 #include "Base.h"
+#include "JobContext.h"
 
 namespace gameplay
 {
 
+void logMessage(int level, const char* format, ...)
+{
+    JobContext* context = JobContext::getCurrent();
+    if (level > (context ? context->getLogVerbosity() : __logVerbosity))
+    {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    if (!context)
+    {
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
+
+    // Format into the job's log, growing the buffer for long messages
+    char buffer[1024];
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(buffer, sizeof(buffer), format, copy);
+    va_end(copy);
+    if (length >= (int)sizeof(buffer))
+    {
+        std::vector<char> message(length + 1);
+        vsnprintf(&message[0], message.size(), format, args);
+        context->appendLog(&message[0]);
+    }
+    else if (length > 0)
+    {
+        context->appendLog(buffer);
+    }
+    va_end(args);
+}
+
 void fillArray(float values[], float value, size_t length)
 {
     for (size_t i = 0; i < length; ++i)
@@ -120,11 +120,19 @@ std::string base64_decode(std::string const& s);
 
 extern int __logVerbosity;
 
+/**
+ * Writes a log message if the verbosity allows it. Messages of a batch job go to the
+ * job's log, everything else to stdout.
+ *
+ * @param level Verbosity level of the message, 1-4.
+ * @param format printf style format of the message.
+ */
+void logMessage(int level, const char* format, ...);
+
 // Logging macro (level is verbosity level, 1-4).
 #define LOG(level, ...) \
     { \
-        if (level <= __logVerbosity) \
-            printf(__VA_ARGS__); \
+        logMessage(level, __VA_ARGS__); \
     }
 
 }
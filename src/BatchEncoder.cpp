@@ -0,0 +1,297 @@
+#include "Base.h"
+#include "BatchEncoder.h"
+#include "EncoderArguments.h"
+#include "JobContext.h"
+#include "TaskScheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <glob.h>
+#endif
+
+namespace gameplay
+{
+
+// Splits a manifest line into tokens separated by whitespace. Double quotes group a
+// token with spaces in it.
+static void tokenizeLine(const std::string& line, std::vector<std::string>* tokens)
+{
+    size_t i = 0, length = line.length();
+    while (i < length)
+    {
+        while (i < length && isspace((unsigned char)line[i]))
+            ++i;
+        if (i == length)
+            break;
+
+        std::string token;
+        bool quoted = false;
+        for (; i < length && (quoted || !isspace((unsigned char)line[i])); ++i)
+        {
+            if (line[i] == '"')
+                quoted = !quoted;
+            else
+                token += line[i];
+        }
+        tokens->push_back(token);
+    }
+}
+
+// Adds the files matching a wildcard pattern, in sorted order.
+static void expandPattern(const std::string& pattern, std::vector<std::string>* paths)
+{
+    size_t first = paths->size();
+#ifdef WIN32
+    size_t slash = pattern.find_last_of("/\\");
+    std::string directory = slash == std::string::npos ? std::string() : pattern.substr(0, slash + 1);
+    struct _finddata_t data;
+    intptr_t handle = _findfirst(pattern.c_str(), &data);
+    if (handle != -1)
+    {
+        do
+        {
+            if (!(data.attrib & _A_SUBDIR))
+                paths->push_back(directory + data.name);
+        } while (_findnext(handle, &data) == 0);
+        _findclose(handle);
+    }
+#else
+    glob_t matches;
+    if (glob(pattern.c_str(), 0, NULL, &matches) == 0)
+    {
+        for (size_t i = 0; i < matches.gl_pathc; ++i)
+        {
+            struct stat status;
+            if (stat(matches.gl_pathv[i], &status) == 0 && !S_ISDIR(status.st_mode))
+                paths->push_back(matches.gl_pathv[i]);
+        }
+    }
+    globfree(&matches);
+#endif
+    std::sort(paths->begin() + first, paths->end());
+}
+
+// Writes a string as a JSON string literal
+static void writeJsonString(FILE* fp, const std::string& value)
+{
+    fputc('"', fp);
+    for (size_t i = 0, length = value.length(); i < length; ++i)
+    {
+        unsigned char c = (unsigned char)value[i];
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", fp);
+        else if (c == '\t')
+            fputs("\\t", fp);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+static long long getFileSize(const std::string& path)
+{
+    struct stat status;
+    return stat(path.c_str(), &status) == 0 ? (long long)status.st_size : 0;
+}
+
+BatchEncoder::BatchEncoder() :
+    _jobsFinished(0), _seconds(0)
+{
+}
+
+BatchEncoder::~BatchEncoder()
+{
+}
+
+bool BatchEncoder::readManifest(const std::string& path, const std::vector<std::string>& options)
+{
+    std::ifstream manifest(path.c_str());
+    if (!manifest)
+    {
+        LOG(1, "Error: Failed to open batch manifest: %s\n", path.c_str());
+        return false;
+    }
+
+    std::string line;
+    unsigned int lineNumber = 0;
+    while (std::getline(manifest, line))
+    {
+        ++lineNumber;
+        std::vector<std::string> tokens;
+        tokenizeLine(line, &tokens);
+        if (tokens.empty() || tokens[0][0] == '#')
+            continue;
+
+        // <input> [<output>] [options]
+        size_t optionIndex = tokens.size() > 1 && tokens[1][0] != '-' ? 2 : 1;
+
+        std::vector<std::string> inputs;
+        if (tokens[0].find_first_of("*?[") == std::string::npos)
+        {
+            inputs.push_back(tokens[0]);
+        }
+        else
+        {
+            expandPattern(tokens[0], &inputs);
+            if (inputs.empty())
+                LOG(1, "Warning: No files match %s (line %u of %s).\n", tokens[0].c_str(), lineNumber, path.c_str());
+        }
+
+        for (size_t i = 0, count = inputs.size(); i < count; ++i)
+        {
+            Job job;
+            job.arguments.push_back("gameplay-encoder");
+            job.arguments.insert(job.arguments.end(), options.begin(), options.end());
+            job.arguments.insert(job.arguments.end(), tokens.begin() + optionIndex, tokens.end());
+            job.arguments.push_back(inputs[i]);
+            if (optionIndex == 2)
+                job.arguments.push_back(tokens[1]);
+            job.input = inputs[i];
+            job.exitCode = 0;
+            job.succeeded = false;
+            job.seconds = 0;
+            _jobs.push_back(job);
+        }
+    }
+    return true;
+}
+
+void BatchEncoder::run(EncodeFunction encode)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Start the largest inputs first, they are likely to take the longest
+    std::vector<std::pair<long long, size_t> > order;
+    for (size_t i = 0, count = _jobs.size(); i < count; ++i)
+        order.push_back(std::make_pair(-getFileSize(_jobs[i].input), i));
+    std::stable_sort(order.begin(), order.end());
+
+    // Jobs run on threads of their own, as many at once as the scheduler has threads. They
+    // aren't scheduler tasks, since a job waiting on its own tasks would pick up and run
+    // other jobs inside it. The parallel stages of the jobs share the scheduler.
+    _jobsFinished = 0;
+    std::atomic<size_t> next(0);
+    unsigned int runnerCount = (unsigned int)min((size_t)TaskScheduler::getInstance()->getThreadCount(), order.size());
+    std::vector<std::thread> runners;
+    for (unsigned int i = 0; i < runnerCount; ++i)
+    {
+        runners.push_back(std::thread([this, &order, &next, encode]()
+        {
+            for (size_t index = next++; index < order.size(); index = next++)
+                runJob(&_jobs[order[index].second], encode);
+        }));
+    }
+    for (size_t i = 0, count = runners.size(); i < count; ++i)
+        runners[i].join();
+
+    _seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BatchEncoder::runJob(Job* job, EncodeFunction encode)
+{
+    encodeJob(job, encode);
+
+    // Report the job as a whole, with the log of failed jobs, so the output of jobs
+    // running at the same time isn't mixed up
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_jobsFinished;
+    LOG(1, "[%u/%u] %s %s (%.2f s)\n", _jobsFinished, (unsigned int)_jobs.size(), job->succeeded ? "Encoded" : "Failed", job->input.c_str(), job->seconds);
+    if (!job->succeeded && !job->log.empty())
+        LOG(1, "%s", job->log.c_str());
+}
+
+void BatchEncoder::encodeJob(Job* job, EncodeFunction encode)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Everything the job does, including the tasks it queues, uses its own context
+    JobContext context(__logVerbosity);
+    {
+        JobContext::Scope scope(&context);
+
+        std::vector<const char*> argv;
+        for (size_t i = 0, count = job->arguments.size(); i < count; ++i)
+            argv.push_back(job->arguments[i].c_str());
+
+        EncoderArguments arguments(argv.size(), &argv[0]);
+        if (arguments.parseErrorOccured() || !arguments.getBatchManifest().empty() || !arguments.getServerSocketPath().empty())
+        {
+            LOG(1, "Error: Invalid options for %s.\n", job->input.c_str());
+            job->exitCode = -1;
+            job->succeeded = false;
+        }
+        else
+        {
+            // A job only succeeds if its output was written
+            time_t startTime = time(NULL);
+            job->output = arguments.getOutputFilePath();
+            job->exitCode = encode(arguments);
+
+            bool outputWritten = arguments.outputWrittenSince(startTime);
+            job->succeeded = job->exitCode == 0 && outputWritten;
+            if (job->exitCode == 0 && !outputWritten)
+                LOG(1, "Error: No output was written for %s.\n", job->input.c_str());
+        }
+    }
+    job->log = context.getLog();
+    job->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool BatchEncoder::writeReport(const std::string& path) const
+{
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == NULL)
+    {
+        LOG(1, "Error: Failed to open file for writing: %s\n", path.c_str());
+        return false;
+    }
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "    \"jobs\": %u,\n", getJobCount());
+    fprintf(fp, "    \"succeeded\": %u,\n", getJobCount() - getFailedCount());
+    fprintf(fp, "    \"failed\": %u,\n", getFailedCount());
+    fprintf(fp, "    \"seconds\": %.3f,\n", _seconds);
+    fprintf(fp, "    \"results\": [\n");
+    for (size_t i = 0, count = _jobs.size(); i < count; ++i)
+    {
+        const Job& job = _jobs[i];
+        fprintf(fp, "        { \"input\": ");
+        writeJsonString(fp, job.input);
+        fprintf(fp, ", \"output\": ");
+        writeJsonString(fp, job.output);
+        fprintf(fp, ", \"status\": \"%s\", \"exitCode\": %d, \"seconds\": %.3f, \"log\": ", job.succeeded ? "succeeded" : "failed", job.exitCode, job.seconds);
+        writeJsonString(fp, job.log);
+        fprintf(fp, " }%s\n", i + 1 == count ? "" : ",");
+    }
+    fprintf(fp, "    ]\n");
+    fprintf(fp, "}\n");
+    fclose(fp);
+    return true;
+}
+
+unsigned int BatchEncoder::getJobCount() const
+{
+    return (unsigned int)_jobs.size();
+}
+
+unsigned int BatchEncoder::getFailedCount() const
+{
+    unsigned int failed = 0;
+    for (size_t i = 0, count = _jobs.size(); i < count; ++i)
+    {
+        if (!_jobs[i].succeeded)
+            ++failed;
+    }
+    return failed;
+}
+
+}
@@ -0,0 +1,121 @@
+#ifndef BATCHENCODER_H_
+#define BATCHENCODER_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gameplay
+{
+
+class EncoderArguments;
+
+/**
+ * Encodes the files listed in a manifest within a single process.
+ *
+ * Each file is a job with its own arguments and JobContext. As many files are encoded at
+ * once as the shared TaskScheduler has threads, each on a thread of its own, and the
+ * parallel stages of each encode share the scheduler's threads. The largest inputs are
+ * started first so a long job doesn't hold up the end of the batch.
+ *
+ * Each line of the manifest is:
+ *
+ *   <input> [<output>] [options]
+ *
+ * The input can be a wildcard pattern, in which case each file it matches is a job with
+ * the same output and options. The options are added after the options the batch itself
+ * was given, so they take precedence. Paths with spaces can be put in double quotes.
+ * Blank lines and lines starting with # are skipped.
+ */
+class BatchEncoder
+{
+public:
+
+    /**
+     * Encodes a single file, returning the exit code the encoder would have.
+     */
+    typedef int (*EncodeFunction)(const EncoderArguments& arguments);
+
+    /**
+     * A file to encode and, once encoded, its result.
+     */
+    struct Job
+    {
+        std::vector<std::string> arguments;
+        std::string input;
+        std::string output;
+        int exitCode;
+        bool succeeded;
+        double seconds;
+        std::string log;
+    };
+
+    /**
+     * Constructor.
+     */
+    BatchEncoder();
+
+    /**
+     * Destructor.
+     */
+    ~BatchEncoder();
+
+    /**
+     * Reads the jobs of a manifest.
+     *
+     * @param path The manifest file.
+     * @param options Options passed to every job, ahead of the options of each line.
+     *
+     * @return True if successful, false if the manifest could not be read.
+     */
+    bool readManifest(const std::string& path, const std::vector<std::string>& options);
+
+    /**
+     * Runs all of the jobs and waits for them to finish.
+     *
+     * @param encode The function that encodes each file.
+     */
+    void run(EncodeFunction encode);
+
+    /**
+     * Writes a JSON report with the status, time taken and log of each job.
+     *
+     * @return True if successful, false if the file could not be written.
+     */
+    bool writeReport(const std::string& path) const;
+
+    /**
+     * Returns the number of jobs.
+     */
+    unsigned int getJobCount() const;
+
+    /**
+     * Returns the number of jobs that failed.
+     */
+    unsigned int getFailedCount() const;
+
+    /**
+     * Encodes a single job in a JobContext of its own on the calling thread, filling in
+     * its output, exit code, status, time taken and log.
+     *
+     * @param job The job, with the command line arguments to encode it with.
+     * @param encode The function that encodes the file.
+     */
+    static void encodeJob(Job* job, EncodeFunction encode);
+
+private:
+
+    BatchEncoder(const BatchEncoder&);
+    BatchEncoder& operator=(const BatchEncoder&);
+
+    void runJob(Job* job, EncodeFunction encode);
+
+    std::vector<Job> _jobs;
+    std::mutex _mutex;
+    unsigned int _jobsFinished;
+    double _seconds;
+};
+
+}
+
+#endif
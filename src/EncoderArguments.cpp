@@ -1,6 +1,7 @@
 #include "Base.h"
 
 #include "EncoderArguments.h"
+#include "JobContext.h"
 #include "StringUtil.h"
 
 #ifdef WIN32
@@ -11,7 +12,9 @@
 // The encoder version number should be incremented when a feature is added to the encoder.
 // The encoder version is not the same as the GPB version.
 #define ENCODER_VERSION "3.0.0"
-#define HEIGHTMAP_SIZE_MAX 2049
+#define HEIGHTMAP_SIZE_MAX 8193
+#define HEIGHTMAP_TILED_SIZE_MAX 65537
+#define HEIGHTMAP_TILE_SIZE 1024
 
 namespace gameplay
 {
@@ -22,16 +25,35 @@ extern int __logVerbosity = 1;
 
 EncoderArguments::EncoderArguments(size_t argc, const char** argv) :
     _normalMap(false),
+    _normalMapStreaming(false),
     _parseError(false),
     _fontPreview(false),
     _fontFormat(Font::BITMAP),
+    _fontNonPowerOfTwo(false),
+    _fontLinearDistanceField(false),
+    _fontSupersample(1),
+    _fontPageSize(0),
     _textOutput(false),
     _optimizeAnimations(false),
     _animationGrouping(ANIMATIONGROUP_PROMPT),
     _outputMaterial(false),
-    _generateTextureGutter(false)
+    _generateTextureGutter(false),
+    _tileChunkSize(0),
+    _tileRegionSize(0),
+    _tileEncoding(TILEENCODING_TILES),
+    _generateTileAtlas(false),
+    _threadCount(0),
+    _pngCompressionLevel(-1),
+    _heightmapBenchmark(false)
 {
-    __instance = this;
+    if (JobContext* context = JobContext::getCurrent())
+    {
+        context->setArguments(this);
+    }
+    else
+    {
+        __instance = this;
+    }
 
     memset(_heightmapResolution, 0, sizeof(int) * 2);
 
@@ -48,8 +70,10 @@ EncoderArguments::EncoderArguments(size_t argc, const char** argv) :
         {
             if (arguments[i][0] == '-')
             {
+                size_t first = i;
                 readOption(arguments, &i);
                 index = i + 1;
+                _options.insert(_options.end(), arguments.begin() + first, index < arguments.size() ? arguments.begin() + index : arguments.end());
             }
         }
         if (arguments.size() - index == 2)
@@ -70,11 +94,17 @@ EncoderArguments::EncoderArguments(size_t argc, const char** argv) :
 
 EncoderArguments::~EncoderArguments(void)
 {
+    JobContext* context = JobContext::getCurrent();
+    if (context && context->getArguments() == this)
+    {
+        context->setArguments(NULL);
+    }
 }
 
 EncoderArguments* EncoderArguments::getInstance()
 {
-    return __instance;
+    JobContext* context = JobContext::getCurrent();
+    return context ? context->getArguments() : __instance;
 }
 
 const std::string& EncoderArguments::getFilePath() const
@@ -205,6 +235,11 @@ bool EncoderArguments::normalMapGeneration() const
     return _normalMap;
 }
 
+bool EncoderArguments::normalMapStreamingEnabled() const
+{
+    return _normalMapStreaming;
+}
+
 void EncoderArguments::getHeightmapResolution(int* x, int* y) const
 {
     *x = _heightmapResolution[0];
@@ -234,17 +269,27 @@ bool EncoderArguments::fileExists() const
     return false;
 }
 
-void splitString(const char* str, std::vector<std::string>* tokens)
+bool EncoderArguments::outputWrittenSince(time_t startTime) const
+{
+    if (getFileFormat() == FILEFORMAT_GPB)
+    {
+        return true;
+    }
+    struct stat buf;
+    return stat(getOutputFilePath().c_str(), &buf) == 0 && buf.st_mtime >= startTime;
+}
+
+void splitString(const char* str, std::vector<std::string>* tokens, const char* delimiters = ",")
 {
     // Split node id list into tokens
     unsigned int length = strlen(str);
     char* temp = new char[length + 1];
     strcpy(temp, str);
-    char* tok = strtok(temp, ",");
+    char* tok = strtok(temp, delimiters);
     while (tok)
     {
         tokens->push_back(tok);
-        tok = strtok(NULL, ",");
+        tok = strtok(NULL, delimiters);
     }
     delete[] temp;
 }
@@ -260,6 +305,37 @@ void EncoderArguments::printUsage() const
     "\n" \
     "General options:\n" \
     "  -v <verbosity>\tVerbosity level (0-4).\n" \
+    "  -threads <count>\n" \
+        "\t\tNumber of threads to use for parallel work. Defaults to the\n" \
+        "\t\tnumber of hardware threads.\n" \
+    "  -pngLevel <level>, -pl <level>\n" \
+        "\t\tCompression level (0-9) of PNG images written by the encoder.\n" \
+        "\t\t0 stores image data uncompressed, 9 compresses the most. \n" \
+        "\t\tDefaults to 6.\n" \
+    "  -batch <manifest>, -bt <manifest>\n" \
+        "\t\tEncode every file listed in a manifest, several at a time.\n" \
+        "\t\tEach line of the manifest is <input> [<output>] [options],\n" \
+        "\t\twhere the input can be a wildcard pattern, the output a\n" \
+        "\t\tdirectory ending in / and the options add to those given\n" \
+        "\t\ton the command line. Blank lines and lines starting with #\n" \
+        "\t\tare skipped. Use -threads to limit the work done at once.\n" \
+    "  -batchReport <file>, -br <file>\n" \
+        "\t\tFile to write the JSON status report of a batch to. Defaults\n" \
+        "\t\tto the manifest path with .report.json appended.\n" \
+    "  -server <socket>, -sv <socket>\n" \
+        "\t\tKeep running and encode the files requested over a local\n" \
+        "\t\tsocket. Each request is a line of JSON such as\n" \
+        "\t\t{\"id\": 1, \"input\": \"a.tmx\", \"output\": \"a.scene\", \"options\": [\"-tg\"]}\n" \
+        "\t\tand a line of JSON with the status, time taken and log is sent\n" \
+        "\t\tback as each request finishes. {\"command\": \"shutdown\"} stops\n" \
+        "\t\tthe server. Options given on the command line apply to every\n" \
+        "\t\trequest.\n" \
+    "  -cache <dir>, -ca <dir>\n" \
+        "\t\tKeep the outputs of each encode in a cache directory and\n" \
+        "\t\tcopy them from there instead of encoding again when the\n" \
+        "\t\tinput, the files it references, the options and the encoder\n" \
+        "\t\tare all unchanged. The directory is created if needed and\n" \
+        "\t\tcan be deleted at any time to clear the cache.\n" \
     "\n" \
     "FBX file options:\n" \
     "  -i <id>\tFilter by node ID.\n" \
@@ -286,6 +362,32 @@ void EncoderArguments::printUsage() const
         "\t\tFilename is the name of the image (PNG) to be saved.\n" \
         "\t\tMultiple -h arguments can be supplied to generate more than one \n" \
         "\t\theightmap. For 24-bit packed height data use -hp instead of -h.\n" \
+    "  -h:raster <size> \"<node ids>\" <filename>\n" \
+        "\t\tGenerates the heightmap by rasterizing the mesh triangles from\n" \
+        "\t\tabove instead of casting a ray per pixel. This is much faster\n" \
+        "\t\tfor large meshes and produces the same heights. Also applies\n" \
+        "\t\tto -hp (-hp:raster).\n" \
+    "  -h:scalar, -h:sse, -h:avx2\n" \
+        "\t\tSelects the ray/triangle intersection kernel used when ray\n" \
+        "\t\tcasting. By default the widest kernel supported by the CPU\n" \
+        "\t\tis used. Modifiers can be combined, e.g. -hp:sse.\n" \
+    "  -h:png16, -h:raw16, -h:raw32\n" \
+        "\t\tWrites the heightmap as a 16-bit grayscale PNG, a headerless\n" \
+        "\t\t16-bit little-endian RAW file or a headerless 32-bit float\n" \
+        "\t\t(0-1) RAW file instead of an 8-bit or 24-bit packed PNG.\n" \
+        "\t\tRAW files use a .raw extension and are written with a\n" \
+        "\t\t<filename>.json manifest holding their size and the world\n" \
+        "\t\tspace minHeight and maxHeight that 0 and 1 map to, so\n" \
+        "\t\theight = minHeight + value * (maxHeight - minHeight).\n" \
+    "  -h:tiled, -h:tiles\n" \
+        "\t\tGenerates the heightmap in bands of rows to bound memory use,\n" \
+        "\t\tallowing sizes up to 65537. -h:tiled streams the bands into a\n" \
+        "\t\tsingle image, -h:tiles writes each tile to its own image\n" \
+        "\t\t(<filename>_<column>_<row>.png) along with a <filename>.json\n" \
+        "\t\tmanifest. Add :tilesize=<size> to change the default tile\n" \
+        "\t\tsize of 1024. Tiles are made shorter when a band of them\n" \
+        "\t\twould hold more than 128M heights (512 MB).\n" \
+    "  -h:bench\tBenchmarks the heightmap intersection kernels and exits.\n" \
     "\n" \
     "GLTF file options:\n" \
     "  -nop\t\tnop.\n"\
@@ -293,9 +395,29 @@ void EncoderArguments::printUsage() const
     "  -tg\tEnable texture gutter's around tiles. This will modify any referenced\n" \
     "  \ttile sets to add a 1px border around it to prevent seams.\n"
     "  -tg:none\tDo not priduce a texture gutter.\n"
+    "  -tileChunk <size>, -tc <size>\n" \
+    "  \tSplit each tile layer into nodes of up to size x size tiles, each with\n" \
+    "  \tits own tileset, so whole chunks are drawn and culled together.\n"
+    "  -tileRegion <size>, -tr <size>\n" \
+    "  \tWrite the tile layers to a scene file per region of size x size tiles\n" \
+    "  \t(<scene>_<column>_<row>.scene), along with a <scene>.regions index of\n" \
+    "  \tthe regions, so the runtime can stream the regions around the camera.\n" \
+    "  \tEmpty regions are not written.\n"
+    "  -tileEncoding <tiles|rle>, -te <tiles|rle>\n" \
+    "  \tHow tiles are written to the scene. tiles (the default) writes a\n" \
+    "  \ttile block per tile. rle writes each tileset's tiles as runs of\n" \
+    "  \tglobal tile IDs, with the flip flags in their high bits, indexed by\n" \
+    "  \trow and with the empty rows and columns around them left out.\n"
+    "  -tileAtlas, -ta\n" \
+    "  \tPack the tileset images into atlas pages, so layers that use several\n" \
+    "  \ttilesets are drawn in as few batches as possible.\n"
     "\n" \
     "Normal map options:\n" \
         "  -n\t\tGenerate normal map (requires input file of type PNG or RAW)\n" \
+        "  -n:stream\tGenerate normal map a band of rows at a time, reading the \n" \
+        "\t\theightmap and writing the normal map incrementally so memory use \n" \
+        "\t\tonly depends on the heightmap width. Heightmaps larger than \n" \
+        "\t\t16384x16384 are always streamed.\n" \
         "  -s\t\tSize/resolution of the input heightmap image (required for RAW files)\n" \
         "  -w <size>\tSpecifies the size of an input terrain heightmap file in world\n" \
         "\t\tunits, along the X, Y and Z axes. <size> should be three \n" \
@@ -305,14 +427,32 @@ void EncoderArguments::printUsage() const
         "\n" \
         "  \t\tNormal map generation can be used to create object-space normal maps from \n" \
         "  \t\theightmap images. Heightmaps must be in either PNG format (where the \n" \
-        "  \t\tintensity of each pixel represents a height value), or in RAW format \n" \
-        "  \t\t(8 or 16-bit), which is a common headerless format supported by most \n" \
+        "  \t\tintensity of each pixel represents a height value, 8 or 16-bit), or in \n" \
+        "  \t\tRAW format (8 or 16-bit integers, or 32-bit floats from 0-1), which is \n" \
+        "  \t\ta common headerless format supported by most \n" \
         "  \t\tterrain generation tools.\n" \
     "\n" \
     "TTF file options:\n" \
     "  -s <sizes>\tComma-separated list of font sizes (in pixels).\n" \
     "  -p\t\tOutput font preview.\n" \
-    "  -f\t\tFormat of font. -f:b (BITMAP), -f:d (DISTANCE_FIELD).\n" \
+    "  -f\t\tFormat of font. -f:b (BITMAP), -f:d (DISTANCE_FIELD),\n" \
+        "\t\t-f:e (DISTANCE_FIELD using a faster, linear-time exact\n" \
+        "\t\tEuclidean distance transform), -f:m (MULTI_CHANNEL_DISTANCE_FIELD,\n" \
+        "\t\tan RGB distance field that keeps sharp corners).\n" \
+    "  -supersample <factor>, -ss <factor>\n" \
+        "\t\tRender glyphs at factor (1-8) times their size and downsample\n" \
+        "\t\tthe distance field, for -f:e fonts. Defaults to 1.\n" \
+    "  -npot\t\tAllow a font texture whose sides are not powers of two.\n" \
+    "  -charset <ranges>, -cs <ranges>\n" \
+        "\t\tComma-separated list of Unicode characters and ranges to include,\n" \
+        "\t\tin decimal, 0x or U+ notation (e.g. 32-126,0x4E00-0x9FFF).\n" \
+        "\t\tDefaults to the printable ASCII characters. Fonts with a\n" \
+        "\t\tcharacter set are written in the paged (GPB 1.6) layout.\n" \
+    "  -charsetFile <file>, -cf <file>\n" \
+        "\t\tInclude every character used in a UTF-8 text file.\n" \
+    "  -pageSize <size>, -ps <size>\n" \
+        "\t\tSplit glyphs across as many texture pages of size x size as\n" \
+        "\t\tneeded, instead of a single texture.\n" \
     "\n");
     exit(8);
 }
@@ -322,6 +462,36 @@ bool EncoderArguments::fontPreviewEnabled() const
     return _fontPreview;
 }
 
+bool EncoderArguments::fontNonPowerOfTwoEnabled() const
+{
+    return _fontNonPowerOfTwo;
+}
+
+bool EncoderArguments::fontLinearDistanceFieldEnabled() const
+{
+    return _fontLinearDistanceField;
+}
+
+unsigned int EncoderArguments::getFontSupersample() const
+{
+    return _fontSupersample;
+}
+
+const std::string& EncoderArguments::getFontCharset() const
+{
+    return _fontCharset;
+}
+
+const std::string& EncoderArguments::getFontCharsetFile() const
+{
+    return _fontCharsetFile;
+}
+
+unsigned int EncoderArguments::getFontPageSize() const
+{
+    return _fontPageSize;
+}
+
 Font::FontFormat EncoderArguments::getFontFormat() const
 {
     return _fontFormat;
@@ -347,6 +517,66 @@ bool EncoderArguments::generateTextureGutter() const
     return _generateTextureGutter;
 }
 
+unsigned int EncoderArguments::getTileChunkSize() const
+{
+    return _tileChunkSize;
+}
+
+unsigned int EncoderArguments::getTileRegionSize() const
+{
+    return _tileRegionSize;
+}
+
+EncoderArguments::TileEncoding EncoderArguments::getTileEncoding() const
+{
+    return _tileEncoding;
+}
+
+bool EncoderArguments::generateTileAtlas() const
+{
+    return _generateTileAtlas;
+}
+
+unsigned int EncoderArguments::getThreadCount() const
+{
+    return _threadCount;
+}
+
+int EncoderArguments::getPngCompressionLevel() const
+{
+    return _pngCompressionLevel;
+}
+
+bool EncoderArguments::heightmapBenchmarkEnabled() const
+{
+    return _heightmapBenchmark;
+}
+
+const std::string& EncoderArguments::getBatchManifest() const
+{
+    return _batchManifest;
+}
+
+std::string EncoderArguments::getBatchReportPath() const
+{
+    return _batchReportPath.empty() ? _batchManifest + ".report.json" : _batchReportPath;
+}
+
+const std::string& EncoderArguments::getServerSocketPath() const
+{
+    return _serverSocketPath;
+}
+
+const std::string& EncoderArguments::getCacheDirectory() const
+{
+    return _cacheDirectory;
+}
+
+const std::vector<std::string>& EncoderArguments::getOptions() const
+{
+    return _options;
+}
+
 const char* EncoderArguments::getNodeId() const
 {
     if (_nodeId.length() == 0)
@@ -427,6 +657,65 @@ void EncoderArguments::readOption(const std::vector<std::string>& options, size_
     }
     switch (str[1])
     {
+    case 'b':
+        if (str.compare("-batch") == 0 || str.compare("-bt") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size())
+            {
+                LOG(1, "Error: %s requires a manifest file.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+            _batchManifest = options[*index];
+        }
+        else if (str.compare("-batchReport") == 0 || str.compare("-br") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size())
+            {
+                LOG(1, "Error: %s requires a report file.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+            _batchReportPath = options[*index];
+        }
+        break;
+    case 'c':
+        if (str.compare("-cache") == 0 || str.compare("-ca") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size())
+            {
+                LOG(1, "Error: %s requires a cache directory.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+            _cacheDirectory = options[*index];
+        }
+        else if (str.compare("-charset") == 0 || str.compare("-cs") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size())
+            {
+                LOG(1, "Error: missing character set argument for %s.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+            _fontCharset = options[*index];
+        }
+        else if (str.compare("-charsetFile") == 0 || str.compare("-cf") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size())
+            {
+                LOG(1, "Error: missing file argument for %s.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+            _fontCharsetFile = options[*index];
+        }
+        break;
     case 'f':
         if (str.compare("-f:b") == 0)
         {
@@ -435,6 +724,16 @@ void EncoderArguments::readOption(const std::vector<std::string>& options, size_
        else  if (str.compare("-f:d") == 0)
         {
             _fontFormat = Font::DISTANCE_FIELD;
+            _fontLinearDistanceField = false;
+        }
+        else if (str.compare("-f:e") == 0)
+        {
+            _fontFormat = Font::DISTANCE_FIELD;
+            _fontLinearDistanceField = true;
+        }
+        else if (str.compare("-f:m") == 0)
+        {
+            _fontFormat = Font::MULTI_CHANNEL_DISTANCE_FIELD;
         }
         break;
     case 'g':
@@ -485,8 +784,22 @@ void EncoderArguments::readOption(const std::vector<std::string>& options, size_
         break;
     case 'h':
         {
-            bool isHighPrecision = str.compare("-hp") == 0;
-            if (str.compare("-heightmap") == 0 || str.compare("-h") == 0 || isHighPrecision)
+            // Heightmap options may be followed by colon separated modifiers (e.g. -h:raster)
+            std::vector<std::string> modifiers;
+            std::string name = str;
+            size_t colon = str.find(':');
+            if (colon != std::string::npos)
+            {
+                name = str.substr(0, colon);
+                splitString(str.c_str() + colon + 1, &modifiers, ":");
+            }
+
+            bool isHighPrecision = name.compare("-hp") == 0;
+            if (str.compare("-heightmap:bench") == 0 || str.compare("-h:bench") == 0)
+            {
+                _heightmapBenchmark = true;
+            }
+            else if (name.compare("-heightmap") == 0 || name.compare("-h") == 0 || isHighPrecision)
             {
                 (*index)++;
                 if (*index < (options.size() + 2))
@@ -494,7 +807,66 @@ void EncoderArguments::readOption(const std::vector<std::string>& options, size_
                     _heightmaps.resize(_heightmaps.size() + 1);
                     HeightmapOption& heightmap = _heightmaps.back();
                     
-                    heightmap.isHighPrecision = isHighPrecision;
+                    heightmap.format = isHighPrecision ? Heightmap::FORMAT_PNG24 : Heightmap::FORMAT_PNG8;
+                    heightmap.engine = Heightmap::RAYCAST;
+                    heightmap.kernel = Heightmap::KERNEL_AUTO;
+                    heightmap.tiling = Heightmap::TILING_NONE;
+                    heightmap.tileSize = HEIGHTMAP_TILE_SIZE;
+
+                    for (size_t i = 0, count = modifiers.size(); i < count; ++i)
+                    {
+                        const std::string& modifier = modifiers[i];
+                        if (modifier == "raster" || modifier == "r")
+                        {
+                            heightmap.engine = Heightmap::RASTERIZE;
+                        }
+                        else if (modifier == "ray")
+                        {
+                            heightmap.engine = Heightmap::RAYCAST;
+                        }
+                        else if (modifier == "scalar")
+                        {
+                            heightmap.kernel = Heightmap::KERNEL_SCALAR;
+                        }
+                        else if (modifier == "sse")
+                        {
+                            heightmap.kernel = Heightmap::KERNEL_SSE;
+                        }
+                        else if (modifier == "avx2")
+                        {
+                            heightmap.kernel = Heightmap::KERNEL_AVX2;
+                        }
+                        else if (modifier == "png16")
+                        {
+                            heightmap.format = Heightmap::FORMAT_PNG16;
+                        }
+                        else if (modifier == "raw16")
+                        {
+                            heightmap.format = Heightmap::FORMAT_RAW16;
+                        }
+                        else if (modifier == "raw32")
+                        {
+                            heightmap.format = Heightmap::FORMAT_RAW32;
+                        }
+                        else if (modifier == "tiled")
+                        {
+                            heightmap.tiling = Heightmap::TILING_BANDS;
+                        }
+                        else if (modifier == "tiles")
+                        {
+                            heightmap.tiling = Heightmap::TILING_FILES;
+                        }
+                        else if (modifier.compare(0, 9, "tilesize=") == 0 && atoi(modifier.c_str() + 9) > 0)
+                        {
+                            heightmap.tileSize = atoi(modifier.c_str() + 9);
+                        }
+                        else
+                        {
+                            LOG(1, "Error: unknown modifier '%s' for -h|-heightmap.\n", modifier.c_str());
+                            _parseError = true;
+                            return;
+                        }
+                    }
 
                     // Read heightmap size
                     std::vector<std::string> parts;
@@ -508,10 +880,12 @@ void EncoderArguments::readOption(const std::vector<std::string>& options, size_
                     heightmap.width = atoi(parts[0].c_str());
                     heightmap.height = atoi(parts[1].c_str());
 
-                    // Put some artificial bounds on heightmap dimensions
-                    if (heightmap.width <= 0 || heightmap.height <= 0 || heightmap.width > HEIGHTMAP_SIZE_MAX || heightmap.height > HEIGHTMAP_SIZE_MAX)
+                    // Put some artificial bounds on heightmap dimensions (tiled heightmaps only keep
+                    // a band of rows in memory, so they can be much larger)
+                    int sizeMax = heightmap.tiling == Heightmap::TILING_NONE ? HEIGHTMAP_SIZE_MAX : HEIGHTMAP_TILED_SIZE_MAX;
+                    if (heightmap.width <= 0 || heightmap.height <= 0 || heightmap.width > sizeMax || heightmap.height > sizeMax)
                     {
-                        LOG(1, "Error: size argument for -h|-heightmap must be between (1,1) and (%d,%d).\n", (int)HEIGHTMAP_SIZE_MAX, (int)HEIGHTMAP_SIZE_MAX);
+                        LOG(1, "Error: size argument for -h|-heightmap must be between (1,1) and (%d,%d).\n", sizeMax, sizeMax);
                         _parseError = true;
                         return;
                     }
@@ -530,15 +904,17 @@ void EncoderArguments::readOption(const std::vector<std::string>& options, size_
                         return;
                     }
                     
-                    // Ensure the output filename has a .png extention
+                    // Ensure the output filename has a .png (or .raw) extention
+                    bool isRaw = heightmap.format == Heightmap::FORMAT_RAW16 || heightmap.format == Heightmap::FORMAT_RAW32;
+                    const char* expected = isRaw ? "raw" : "png";
                     if (heightmap.filename.length() > 5)
                     {
                         const char* ext = heightmap.filename.c_str() + (heightmap.filename.length() - 4);
-                        if (ext[0] != '.' || tolower(ext[1]) != 'p' || tolower(ext[2]) != 'n' || tolower(ext[3]) != 'g')
-                            heightmap.filename += ".png";
+                        if (ext[0] != '.' || tolower(ext[1]) != expected[0] || tolower(ext[2]) != expected[1] || tolower(ext[3]) != expected[2])
+                            heightmap.filename += isRaw ? ".raw" : ".png";
                     }
                     else
-                        heightmap.filename += ".png";
+                        heightmap.filename += isRaw ? ".raw" : ".png";
                 }
                 else
                 {
@@ -557,7 +933,18 @@ void EncoderArguments::readOption(const std::vector<std::string>& options, size_
         }
         break;
     case 'n':
+        if (str.compare("-npot") == 0)
+        {
+            // allow font textures that are not a power of two in size
+            _fontNonPowerOfTwo = true;
+            break;
+        }
         _normalMap = true;
+        if (str.compare("-n:stream") == 0)
+        {
+            // stream the heightmap and normal map a band of rows at a time
+            _normalMapStreaming = true;
+        }
         break;
     case 'w':
         {
@@ -589,10 +976,57 @@ void EncoderArguments::readOption(const std::vector<std::string>& options, size_
         }
         break;
     case 'p':
-        _fontPreview = true;
+        if (str.compare("-pngLevel") == 0 || str.compare("-pl") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size() || options[*index].length() != 1 || options[*index][0] < '0' || options[*index][0] > '9')
+            {
+                LOG(1, "Error: %s requires a compression level from 0 to 9.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+            _pngCompressionLevel = options[*index][0] - '0';
+        }
+        else if (str.compare("-pageSize") == 0 || str.compare("-ps") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size() || atoi(options[*index].c_str()) < 16 || atoi(options[*index].c_str()) > 16384)
+            {
+                LOG(1, "Error: %s requires a page size from 16 to 16384.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+            _fontPageSize = (unsigned int)atoi(options[*index].c_str());
+        }
+        else
+        {
+            _fontPreview = true;
+        }
         break;
     case 's':
-        if (_normalMap)
+        if (str.compare("-server") == 0 || str.compare("-sv") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size())
+            {
+                LOG(1, "Error: %s requires a socket path.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+            _serverSocketPath = options[*index];
+        }
+        else if (str.compare("-supersample") == 0 || str.compare("-ss") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size() || atoi(options[*index].c_str()) < 1 || atoi(options[*index].c_str()) > 8)
+            {
+                LOG(1, "Error: %s requires a supersampling factor from 1 to 8.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+            _fontSupersample = (unsigned int)atoi(options[*index].c_str());
+        }
+        else if (_normalMap)
         {
             (*index)++;
             if (*index >= options.size())
@@ -692,6 +1126,17 @@ void EncoderArguments::readOption(const std::vector<std::string>& options, size_
                 _tangentBinormalId.insert(nodeId);
             }
         }
+        else if (str.compare("-threads") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size() || atoi(options[*index].c_str()) <= 0)
+            {
+                LOG(1, "Error: -threads requires a positive thread count.\n");
+                _parseError = true;
+                return;
+            }
+            _threadCount = (unsigned int)atoi(options[*index].c_str());
+        }
         else if (str.compare("-textureGutter:none") == 0 || str.compare("-tg:none") == 0)
         {
             _generateTextureGutter = false;
@@ -700,16 +1145,60 @@ void EncoderArguments::readOption(const std::vector<std::string>& options, size_
         {
             _generateTextureGutter = true;
         }
+        else if (str.compare("-tileAtlas") == 0 || str.compare("-ta") == 0)
+        {
+            _generateTileAtlas = true;
+        }
+        else if (str.compare("-tileChunk") == 0 || str.compare("-tc") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size() || atoi(options[*index].c_str()) <= 0)
+            {
+                LOG(1, "Error: %s requires a positive chunk size in tiles.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+            _tileChunkSize = (unsigned int)atoi(options[*index].c_str());
+        }
+        else if (str.compare("-tileRegion") == 0 || str.compare("-tr") == 0)
+        {
+            (*index)++;
+            if (*index >= options.size() || atoi(options[*index].c_str()) <= 0)
+            {
+                LOG(1, "Error: %s requires a positive region size in tiles.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+            _tileRegionSize = (unsigned int)atoi(options[*index].c_str());
+        }
+        else if (str.compare("-tileEncoding") == 0 || str.compare("-te") == 0)
+        {
+            (*index)++;
+            if (*index < options.size() && options[*index].compare("tiles") == 0)
+            {
+                _tileEncoding = TILEENCODING_TILES;
+            }
+            else if (*index < options.size() && options[*index].compare("rle") == 0)
+            {
+                _tileEncoding = TILEENCODING_RLE;
+            }
+            else
+            {
+                LOG(1, "Error: %s requires an encoding of tiles or rle.\n", str.c_str());
+                _parseError = true;
+                return;
+            }
+        }
         break;
     case 'v':
         (*index)++;
         if (*index < options.size())
         {
-            __logVerbosity = atoi(options[*index].c_str());
-            if (__logVerbosity < 0)
-                __logVerbosity = 0;
-            else if (__logVerbosity > 4)
-                __logVerbosity = 4;
+            int verbosity = min(max(atoi(options[*index].c_str()), 0), 4);
+            if (JobContext* context = JobContext::getCurrent())
+                context->setLogVerbosity(verbosity);
+            else
+                __logVerbosity = verbosity;
         }
         break;
     default:
@@ -4,6 +4,7 @@
 #include <set>
 #include "Vector3.h"
 #include "Font.h"
+#include "Heightmap.h"
 
 namespace gameplay
 {
@@ -33,7 +34,11 @@ public:
     {
         std::vector<std::string> nodeIds;
         std::string filename;
-        bool isHighPrecision;
+        Heightmap::Format format;
+        Heightmap::Engine engine;
+        Heightmap::Kernel kernel;
+        Heightmap::Tiling tiling;
+        int tileSize;
         int width;
         int height;
     };
@@ -51,6 +56,12 @@ public:
         ANIMATIONGROUP_AUTO,
         ANIMATIONGROUP_OFF
     };
+
+    enum TileEncoding
+    {
+        TILEENCODING_TILES, // a tile block per tile
+        TILEENCODING_RLE    // run-length encoded global tile IDs
+    };
     
     /**
      * Constructor.
@@ -134,6 +145,11 @@ public:
      * Returns true if normal map generation is turned on.
      */
     bool normalMapGeneration() const;
+
+    /**
+     * Returns true if normal maps should be generated a band of rows at a time (-n:stream).
+     */
+    bool normalMapStreamingEnabled() const;
     
     /**
      * Returns the supplied intput heightmap resolution.
@@ -161,6 +177,17 @@ public:
      */
     bool fileExists() const;
 
+    /**
+     * Tests if the encode wrote its output file. Encoders report most errors by logging
+     * them and not writing their output, so an encode has only succeeded if this is true.
+     * Decoding a GPB file writes no output file, so it is always considered written.
+     *
+     * @param startTime The time the encode started.
+     *
+     * @return True if the output file was written at or after the start time.
+     */
+    bool outputWrittenSince(time_t startTime) const;
+
     /**
      * Prints the usage information.
      */
@@ -172,6 +199,36 @@ public:
 
     Font::FontFormat getFontFormat() const;
 
+    /**
+     * Returns true if font textures don't have to be a power of two in size.
+     */
+    bool fontNonPowerOfTwoEnabled() const;
+
+    /**
+     * Returns true if distance field fonts use the linear-time exact Euclidean distance transform.
+     */
+    bool fontLinearDistanceFieldEnabled() const;
+
+    /**
+     * Returns the factor to supersample glyphs by when generating distance fields.
+     */
+    unsigned int getFontSupersample() const;
+
+    /**
+     * Returns the list of Unicode characters and ranges to include in fonts, or an empty string.
+     */
+    const std::string& getFontCharset() const;
+
+    /**
+     * Returns the path of a text file whose characters are included in fonts, or an empty string.
+     */
+    const std::string& getFontCharsetFile() const;
+
+    /**
+     * Returns the size of font texture pages, or 0 for a single texture per font size.
+     */
+    unsigned int getFontPageSize() const;
+
     bool textOutputEnabled() const;
 
     bool optimizeAnimationsEnabled() const;
@@ -180,6 +237,71 @@ public:
 
     bool generateTextureGutter() const;
 
+    /**
+     * Returns the size in tiles of the chunks TMX tile layers are split into, or 0 to not split them.
+     */
+    unsigned int getTileChunkSize() const;
+
+    /**
+     * Returns the size in tiles of the regions TMX tile layers are written to separate scene
+     * files for, or 0 to write them to the main scene.
+     */
+    unsigned int getTileRegionSize() const;
+
+    /**
+     * Returns how the tiles of TMX tile layers are written to scenes.
+     */
+    TileEncoding getTileEncoding() const;
+
+    /**
+     * Returns true if the tileset images of TMX maps should be packed into atlas pages.
+     */
+    bool generateTileAtlas() const;
+
+    /**
+     * Returns the number of threads to use for parallel work (0 uses the hardware concurrency).
+     */
+    unsigned int getThreadCount() const;
+
+    /**
+     * Returns the zlib compression level (0-9) for PNG output, or -1 for the zlib default.
+     */
+    int getPngCompressionLevel() const;
+
+    /**
+     * Returns true if the heightmap kernel benchmark should be run instead of encoding.
+     */
+    bool heightmapBenchmarkEnabled() const;
+
+    /**
+     * Returns the manifest of files to encode in batch mode, or an empty string when
+     * encoding a single file.
+     */
+    const std::string& getBatchManifest() const;
+
+    /**
+     * Returns the file to write the status report of a batch to.
+     */
+    std::string getBatchReportPath() const;
+
+    /**
+     * Returns the socket to listen on for encode requests in server mode, or an empty
+     * string when not running as a server.
+     */
+    const std::string& getServerSocketPath() const;
+
+    /**
+     * Returns the directory of the output cache, or an empty string when outputs are not
+     * cached.
+     */
+    const std::string& getCacheDirectory() const;
+
+    /**
+     * Returns the options given on the command line, with their values, in the order
+     * they were given.
+     */
+    const std::vector<std::string>& getOptions() const;
+
     const char* getNodeId() const;
 
     static std::string getRealPath(const std::string& filepath);
@@ -215,6 +337,7 @@ private:
     std::string _nodeId;
 
     bool _normalMap;
+    bool _normalMapStreaming;
     Vector3 _heightmapWorldSize;
     int _heightmapResolution[2];
 
@@ -222,11 +345,29 @@ private:
     std::vector<unsigned int> _fontSizes;
     bool _fontPreview;
     Font::FontFormat _fontFormat;
+    bool _fontNonPowerOfTwo;
+    bool _fontLinearDistanceField;
+    unsigned int _fontSupersample;
+    std::string _fontCharset;
+    std::string _fontCharsetFile;
+    unsigned int _fontPageSize;
     bool _textOutput;
     bool _optimizeAnimations;
     AnimationGroupOption _animationGrouping;
     bool _outputMaterial;
     bool _generateTextureGutter;
+    unsigned int _tileChunkSize;
+    unsigned int _tileRegionSize;
+    TileEncoding _tileEncoding;
+    bool _generateTileAtlas;
+    unsigned int _threadCount;
+    int _pngCompressionLevel;
+    bool _heightmapBenchmark;
+    std::string _batchManifest;
+    std::string _batchReportPath;
+    std::string _serverSocketPath;
+    std::string _cacheDirectory;
+    std::vector<std::string> _options;
 
     std::vector<std::string> _groupAnimationNodeId;
     std::vector<std::string> _groupAnimationAnimationId;
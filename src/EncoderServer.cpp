@@ -0,0 +1,358 @@
+#include "Base.h"
+#include "EncoderServer.h"
+#include "ImageCache.h"
+#include "TaskScheduler.h"
+#include "json.hpp"
+
+#include <chrono>
+#include <thread>
+
+#ifndef WIN32
+#include <csignal>
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Bytes of decoded images kept between requests
+#define IMAGE_CACHE_CAPACITY (256 * 1024 * 1024)
+
+// Milliseconds between checks for a shutdown while waiting for connections
+#define POLL_INTERVAL 200
+
+using nlohmann::json;
+
+namespace gameplay
+{
+
+struct EncoderServer::Connection
+{
+    Connection(int socket) : socket(socket)
+    {
+    }
+
+    ~Connection()
+    {
+#ifndef WIN32
+        close(socket);
+#endif
+    }
+
+    int socket;
+    std::mutex mutex;
+};
+
+struct EncoderServer::Request
+{
+    std::shared_ptr<Connection> connection;
+    json id;
+    BatchEncoder::Job job;
+    std::chrono::steady_clock::time_point received;
+};
+
+#ifndef WIN32
+
+static volatile sig_atomic_t __signalled = 0;
+
+static void onSignal(int)
+{
+    __signalled = 1;
+}
+
+// Sends a line of JSON. Lines from different jobs finishing at once are kept whole, and
+// errors are ignored since they only mean the client has gone.
+static void sendLine(int socket, std::mutex& mutex, const json& value)
+{
+    std::string line = value.dump(-1, ' ', false, json::error_handler_t::replace);
+    line += '\n';
+
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t sent = 0;
+    while (sent < line.length())
+    {
+        ssize_t count = send(socket, line.data() + sent, line.length() - sent, 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return;
+        sent += (size_t)count;
+    }
+}
+
+static json createError(const json& id, const std::string& message)
+{
+    json error;
+    error["id"] = id;
+    error["status"] = "error";
+    error["error"] = message;
+    return error;
+}
+
+#endif
+
+EncoderServer::EncoderServer(const std::string& socketPath, const std::vector<std::string>& options) :
+    _socketPath(socketPath), _options(options), _socket(-1), _shutdown(false), _readerCount(0), _stopping(false)
+{
+}
+
+EncoderServer::~EncoderServer()
+{
+    for (size_t i = 0, count = _requests.size(); i < count; ++i)
+        SAFE_DELETE(_requests[i]);
+}
+
+#ifdef WIN32
+
+int EncoderServer::run(BatchEncoder::EncodeFunction encode)
+{
+    LOG(1, "Error: Server mode is not supported on this platform.\n");
+    return -1;
+}
+
+#else
+
+int EncoderServer::run(BatchEncoder::EncodeFunction encode)
+{
+    if (!listen())
+        return -1;
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    ImageCache::getInstance()->setCapacity(IMAGE_CACHE_CAPACITY);
+
+    // Run as many jobs at once as the scheduler has threads. The parallel stages of the
+    // jobs share the scheduler, which is created here so it is sized from the server's
+    // own options rather than those of the first request.
+    unsigned int runnerCount = TaskScheduler::getInstance()->getThreadCount();
+    std::vector<std::thread> runners;
+    for (unsigned int i = 0; i < runnerCount; ++i)
+        runners.push_back(std::thread(&EncoderServer::runRequests, this, encode));
+
+    LOG(1, "Listening for encode requests on %s\n", _socketPath.c_str());
+    while (!_shutdown && !__signalled)
+    {
+        struct pollfd listener;
+        listener.fd = _socket;
+        listener.events = POLLIN;
+        listener.revents = 0;
+        if (poll(&listener, 1, POLL_INTERVAL) <= 0)
+            continue;
+
+        int socket = accept(_socket, NULL, NULL);
+        if (socket < 0)
+            continue;
+
+        std::shared_ptr<Connection> connection = std::make_shared<Connection>(socket);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _connections.erase(std::remove_if(_connections.begin(), _connections.end(),
+            [](const std::weak_ptr<Connection>& closed) { return closed.expired(); }), _connections.end());
+        _connections.push_back(connection);
+        ++_readerCount;
+        std::thread(&EncoderServer::readRequests, this, connection).detach();
+    }
+
+    LOG(1, "Shutting down, finishing the requests already received.\n");
+    close(_socket);
+    unlink(_socketPath.c_str());
+
+    // Stop reading from the open connections, then let the runners finish the queue
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (size_t i = 0, count = _connections.size(); i < count; ++i)
+        {
+            std::shared_ptr<Connection> connection = _connections[i].lock();
+            if (connection)
+                shutdown(connection->socket, SHUT_RD);
+        }
+        _condition.wait(lock, [this]() { return _readerCount == 0; });
+        _stopping = true;
+    }
+    _condition.notify_all();
+    for (size_t i = 0, count = runners.size(); i < count; ++i)
+        runners[i].join();
+
+    ImageCache::getInstance()->clear();
+    return 0;
+}
+
+bool EncoderServer::listen()
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (_socketPath.length() >= sizeof(address.sun_path))
+    {
+        LOG(1, "Error: Socket path is too long: %s\n", _socketPath.c_str());
+        return false;
+    }
+    strcpy(address.sun_path, _socketPath.c_str());
+
+    _socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_socket < 0)
+    {
+        LOG(1, "Error: Failed to create socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    bool bound = bind(_socket, (struct sockaddr*)&address, sizeof(address)) == 0;
+    if (!bound && errno == EADDRINUSE)
+    {
+        // A socket left behind by a server that didn't shut down can be replaced, but not
+        // one that another server is still listening on
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool inUse = probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+        if (probe >= 0)
+            close(probe);
+        if (inUse)
+        {
+            LOG(1, "Error: Another server is already listening on %s\n", _socketPath.c_str());
+            close(_socket);
+            return false;
+        }
+        bound = unlink(_socketPath.c_str()) == 0 && bind(_socket, (struct sockaddr*)&address, sizeof(address)) == 0;
+    }
+
+    if (!bound || ::listen(_socket, SOMAXCONN) != 0)
+    {
+        LOG(1, "Error: Failed to listen on %s: %s\n", _socketPath.c_str(), strerror(errno));
+        close(_socket);
+        return false;
+    }
+    return true;
+}
+
+void EncoderServer::readRequests(std::shared_ptr<Connection> connection)
+{
+    std::string buffer;
+    char data[4096];
+    for (;;)
+    {
+        ssize_t count = recv(connection->socket, data, sizeof(data), 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+
+        buffer.append(data, (size_t)count);
+        size_t start = 0, end;
+        while ((end = buffer.find('\n', start)) != std::string::npos)
+        {
+            handleRequest(connection, buffer.substr(start, end - start));
+            start = end + 1;
+        }
+        buffer.erase(0, start);
+    }
+
+    // The last request doesn't need a line break if the client closes its end after it
+    handleRequest(connection, buffer);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    --_readerCount;
+    _condition.notify_all();
+}
+
+void EncoderServer::handleRequest(const std::shared_ptr<Connection>& connection, const std::string& line)
+{
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+        return;
+
+    json value = json::parse(line, NULL, false);
+    if (value.is_discarded() || !value.is_object())
+    {
+        sendLine(connection->socket, connection->mutex, createError(json(), "The request is not a JSON object."));
+        return;
+    }
+
+    json id = value.contains("id") ? value["id"] : json();
+    if (value.contains("command"))
+    {
+        if (value["command"] != "shutdown")
+        {
+            sendLine(connection->socket, connection->mutex, createError(id, "Unknown command."));
+            return;
+        }
+
+        json result;
+        result["id"] = id;
+        result["status"] = "shuttingDown";
+        sendLine(connection->socket, connection->mutex, result);
+        _shutdown = true;
+        return;
+    }
+
+    const json& input = value.contains("input") ? value["input"] : json();
+    const json& output = value.contains("output") ? value["output"] : json();
+    const json& options = value.contains("options") ? value["options"] : json::array();
+    bool validOptions = options.is_array();
+    for (size_t i = 0, count = options.size(); validOptions && i < count; ++i)
+        validOptions = options[i].is_string();
+    if (!input.is_string() || input.get<std::string>().empty() || !(output.is_null() || output.is_string()) || !validOptions)
+    {
+        sendLine(connection->socket, connection->mutex, createError(id, "A request needs an input path and can have an output path and an array of options."));
+        return;
+    }
+
+    Request* request = new Request();
+    request->connection = connection;
+    request->id = id;
+    request->received = std::chrono::steady_clock::now();
+
+    BatchEncoder::Job& job = request->job;
+    job.arguments.push_back("gameplay-encoder");
+    job.arguments.insert(job.arguments.end(), _options.begin(), _options.end());
+    for (size_t i = 0, count = options.size(); i < count; ++i)
+        job.arguments.push_back(options[i].get<std::string>());
+    job.arguments.push_back(input.get<std::string>());
+    if (output.is_string())
+        job.arguments.push_back(output.get<std::string>());
+    job.input = input.get<std::string>();
+    job.exitCode = 0;
+    job.succeeded = false;
+    job.seconds = 0;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _requests.push_back(request);
+    _condition.notify_one();
+}
+
+void EncoderServer::runRequests(BatchEncoder::EncodeFunction encode)
+{
+    for (;;)
+    {
+        Request* request;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _condition.wait(lock, [this]() { return !_requests.empty() || _stopping; });
+            if (_requests.empty())
+                return;
+            request = _requests.front();
+            _requests.pop_front();
+        }
+
+        double queueSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - request->received).count();
+        BatchEncoder::Job& job = request->job;
+        BatchEncoder::encodeJob(&job, encode);
+        LOG(1, "%s %s (%.2f s)\n", job.succeeded ? "Encoded" : "Failed", job.input.c_str(), job.seconds);
+
+        json result;
+        result["id"] = request->id;
+        result["input"] = job.input;
+        result["output"] = job.output;
+        result["status"] = job.succeeded ? "succeeded" : "failed";
+        result["exitCode"] = job.exitCode;
+        result["seconds"] = floor(job.seconds * 1000.0 + 0.5) / 1000.0;
+        result["queueSeconds"] = floor(queueSeconds * 1000.0 + 0.5) / 1000.0;
+        result["log"] = job.log;
+        sendLine(request->connection->socket, request->connection->mutex, result);
+
+        SAFE_DELETE(request);
+    }
+}
+
+#endif
+
+}
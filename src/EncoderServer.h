@@ -0,0 +1,99 @@
+#ifndef ENCODERSERVER_H_
+#define ENCODERSERVER_H_
+
+#include "BatchEncoder.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gameplay
+{
+
+/**
+ * Keeps the encoder running and encodes the files requested over a local socket.
+ *
+ * Tools that re-encode assets often, such as an editor exporting on every save, would
+ * otherwise pay for starting a process and for cold caches on every encode. The server
+ * keeps the task scheduler's threads, the FreeType libraries and the decoded images
+ * (see ImageCache) between requests.
+ *
+ * Each request is a line of JSON sent over a Unix domain socket:
+ *
+ *   { "id": 1, "input": "map.tmx", "output": "map.scene", "options": [ "-tg" ] }
+ *
+ * Only the input is required. The id, which can be any JSON value, is sent back with
+ * the result so a client can send several requests without waiting for each one. The
+ * options are added after the options the server was started with, so they take
+ * precedence, and relative paths are relative to the server's working directory.
+ *
+ * Requests are encoded as jobs in JobContexts of their own, several at a time. When a
+ * job finishes a line of JSON with its result is sent back on the connection it came
+ * from:
+ *
+ *   { "id": 1, "input": "map.tmx", "output": "map.scene", "status": "succeeded",
+ *     "exitCode": 0, "seconds": 0.25, "queueSeconds": 0.0, "log": "" }
+ *
+ * A connection is closed once the client has closed its end and all of its requests
+ * have been answered. The request { "command": "shutdown" } stops the server once the
+ * requests already received are done.
+ */
+class EncoderServer
+{
+public:
+
+    /**
+     * Constructor.
+     *
+     * @param socketPath The path of the socket to listen on.
+     * @param options Options passed to every job, ahead of the options of each request.
+     */
+    EncoderServer(const std::string& socketPath, const std::vector<std::string>& options);
+
+    /**
+     * Destructor.
+     */
+    ~EncoderServer();
+
+    /**
+     * Listens for requests and encodes them until the server is shut down.
+     *
+     * @param encode The function that encodes each file.
+     *
+     * @return 0 once the server has been shut down, or -1 if it could not be started.
+     */
+    int run(BatchEncoder::EncodeFunction encode);
+
+private:
+
+    struct Connection;
+    struct Request;
+
+    EncoderServer(const EncoderServer&);
+    EncoderServer& operator=(const EncoderServer&);
+
+    bool listen();
+    void readRequests(std::shared_ptr<Connection> connection);
+    void handleRequest(const std::shared_ptr<Connection>& connection, const std::string& line);
+    void runRequests(BatchEncoder::EncodeFunction encode);
+
+    std::string _socketPath;
+    std::vector<std::string> _options;
+    int _socket;
+    std::atomic<bool> _shutdown;
+
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::deque<Request*> _requests;
+    std::vector<std::weak_ptr<Connection> > _connections;
+    unsigned int _readerCount;
+    bool _stopping;
+};
+
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include "FBXSceneEncoder.h"
 #include "FBXUtil.h"
 #include "Sampler.h"
+#include "JobContext.h"
+#include "OutputCache.h"
 
 using namespace gameplay;
 using std::string;
@@ -12,11 +14,11 @@ using std::vector;
 using std::map;
 using std::ostringstream;
 
-// Fix bad material names
-static void fixMaterialName(string& name);
+// Fix bad material names, numbering unnamed materials with unnamedCount
+static void fixMaterialName(string& name, int* unnamedCount);
 
 FBXSceneEncoder::FBXSceneEncoder()
-    : _groupAnimation(NULL), _autoGroupAnimations(false)
+    : _groupAnimation(NULL), _autoGroupAnimations(false), _unnamedMaterialCount(0)
 {
 }
 
@@ -35,7 +37,14 @@ void FBXSceneEncoder::write(const string& filepath, const EncoderArguments& argu
     {
         LOG(1, "Call to FbxImporter::Initialize() failed.\n");
         LOG(1, "Error returned: %s\n\n", importer->GetStatus().GetErrorString());
-        exit(-1);
+        if (!JobContext::getCurrent())
+        {
+            exit(-1);
+        }
+
+        // A batch job fails on its own rather than ending the batch
+        sdkManager->Destroy();
+        return;
     }
     
     FbxScene* fbxScene = FbxScene::Create(sdkManager,"__FBX_SCENE__");
@@ -119,6 +128,7 @@ bool FBXSceneEncoder::writeMaterial(const string& filepath)
     {
         return false;
     }
+    OutputCache::recordOutput(filepath);
     // Finds the base materials that are used.
     std::set<Material*> baseMaterialsToWrite;
     for (map<string, Material*>::iterator it = _materials.begin(); it != _materials.end(); ++it)
@@ -902,7 +912,7 @@ void FBXSceneEncoder::loadMaterial(FbxNode* fbxNode)
     {
         FbxSurfaceMaterial* fbxMaterial = fbxNode->GetMaterial(index);
         string materialName(fbxMaterial->GetName());
-        fixMaterialName(materialName);
+        fixMaterialName(materialName, &_unnamedMaterialCount);
         Material* material = NULL;
         map<string, Material*>::iterator it = _materials.find(materialName);
         if (it != _materials.end())
@@ -1335,10 +1345,8 @@ void FBXSceneEncoder::triangulateRecursive(FbxNode* fbxNode)
 
 // Functions
 
-void fixMaterialName(string& name)
+void fixMaterialName(string& name, int* unnamedCount)
 {
-    static int unnamedCount = 0;
-
     for (string::size_type i = 0, len = name.length(); i < len; ++i)
     {
         if (!isalnum(name[i]))
@@ -1348,7 +1356,7 @@ void fixMaterialName(string& name)
     if (name.length() == 0)
     {
         ostringstream stream;
-        stream << "unnamed_" << (++unnamedCount);
+        stream << "unnamed_" << (++(*unnamedCount));
         name = stream.str();
     }
 }
@@ -290,6 +290,11 @@ private:
      * Indicates if the animations for mesh skins should be grouped before writing out the GPB file.
      */
     bool _autoGroupAnimations;
+
+    /**
+     * The number of unnamed materials so far, to give each a name of its own.
+     */
+    int _unnamedMaterialCount;
 };
 
 #endif
@@ -1,5 +1,6 @@
 #include "Base.h"
 #include "FileIO.h"
+#include "JobContext.h"
 
 namespace gameplay
 {
@@ -188,6 +189,12 @@ void writeIndent(unsigned int indentLevel, FILE* file)
 
 bool promptUserGroupAnimations()
 {
+    // Batch jobs can't ask, they take the default answer
+    if (JobContext::getCurrent())
+    {
+        return true;
+    }
+
     char buffer[80];
     for (;;)
     {
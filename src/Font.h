@@ -47,7 +47,8 @@ public:
     enum FontFormat
     {
         BITMAP = 0,
-        DISTANCE_FIELD = 1
+        DISTANCE_FIELD = 1,
+        MULTI_CHANNEL_DISTANCE_FIELD = 2
     };
 };
 
@@ -1,4 +1,5 @@
 #include "GLTFSceneEncoder.h"
+#include "OutputCache.h"
 
 GLTFSceneEncoder::GLTFSceneEncoder()
 {
@@ -152,6 +153,7 @@ bool GLTFSceneEncoder::writeMaterial(const std::string & filepath)
 	{
 		return false;
 	}
+	OutputCache::recordOutput(filepath);
 
 	// Finds the base materials that are used.
 	std::set<Material*> baseMaterialsToWrite;
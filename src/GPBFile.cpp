@@ -4,6 +4,8 @@
 #include "StringUtil.h"
 #include "EncoderArguments.h"
 #include "Heightmap.h"
+#include "JobContext.h"
+#include "OutputCache.h"
 
 #define EPSILON 1.2e-7f;
 
@@ -45,16 +47,29 @@ static void getNodeAncestors(Node* node, std::list<Node*>& ancestors);
 GPBFile::GPBFile(void)
     : _file(NULL), _animationsAdded(false)
 {
-    __instance = this;
+    if (JobContext* context = JobContext::getCurrent())
+    {
+        context->setGPBFile(this);
+    }
+    else
+    {
+        __instance = this;
+    }
 }
 
 GPBFile::~GPBFile(void)
 {
+    JobContext* context = JobContext::getCurrent();
+    if (context && context->getGPBFile() == this)
+    {
+        context->setGPBFile(NULL);
+    }
 }
 
 GPBFile* GPBFile::getInstance()
 {
-    return __instance;
+    JobContext* context = JobContext::getCurrent();
+    return context ? context->getGPBFile() : __instance;
 }
 
 bool GPBFile::saveBinary(const std::string& filepath)
@@ -64,6 +79,7 @@ bool GPBFile::saveBinary(const std::string& filepath)
     {
         return false;
     }
+    OutputCache::recordOutput(filepath);
     size_t n = 0;
 
     // identifier
@@ -115,6 +131,7 @@ bool GPBFile::saveText(const std::string& filepath)
     {
         return false;
     }
+    OutputCache::recordOutput(filepath);
 
     if (fprintf(_file, "<root>\n") <= 0)
     {
@@ -347,7 +364,8 @@ void GPBFile::adjust()
     const std::vector<EncoderArguments::HeightmapOption>& heightmaps = EncoderArguments::getInstance()->getHeightmapOptions();
     for (unsigned int i = 0, count = heightmaps.size(); i < count; ++i)
     {
-        Heightmap::generate(heightmaps[i].nodeIds, heightmaps[i].width, heightmaps[i].height, heightmaps[i].filename.c_str(), heightmaps[i].isHighPrecision);
+        Heightmap::generate(heightmaps[i].nodeIds, heightmaps[i].width, heightmaps[i].height, heightmaps[i].filename.c_str(), heightmaps[i].format,
+                            heightmaps[i].engine, heightmaps[i].kernel, heightmaps[i].tiling, heightmaps[i].tileSize);
     }
 }
 
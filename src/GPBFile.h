@@ -23,6 +23,12 @@ namespace gameplay
  */
 const unsigned char GPB_VERSION[2] = {1, 5};
 
+/**
+ * Version of fonts whose glyphs are split across several texture pages. Each glyph
+ * records its page, and each font size is followed by all of its pages.
+ */
+const unsigned char GPB_FONT_PAGES_VERSION[2] = {1, 6};
+
 /**
  * The GamePlay Binary file class handles writing the GamePlay Binary file.
  */
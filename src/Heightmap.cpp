@@ -1,54 +1,186 @@
 #include "Base.h"
 #include "Heightmap.h"
 #include "GPBFile.h"
-#include "Thread.h"
+#include "TaskScheduler.h"
+#include "PngWriter.h"
+#include "OutputCache.h"
+#include <chrono>
+
+// SSE is always available on x64 (and with /arch:SSE2 or -msse2 on x86). AVX2 kernels are
+// compiled for the AVX2 target individually and only called after a runtime CPU check.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define HEIGHTMAP_SIMD
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define HEIGHTMAP_TARGET_AVX2
+    #else
+        #define HEIGHTMAP_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
 
 namespace gameplay
 {
 
-// Number of threads to spawn for the heightmap generator
-#define THREAD_COUNT 8
-
-// Thread data structure
-struct HeightmapThreadData
-{
-    float rayHeight;                    // [in]
-    const Vector3* rayDirection;        // [in]
-    const std::vector<Mesh*>* meshes;   // [in]
-    const BoundingVolume* bounds;       // [in]
-    float minX;                         // [in]
-    float maxX;                         // [in]
-    float minZ;                         // [in]
-    float maxZ;                         // [in]
-    float stepX;                        // [in]
-    float stepZ;                        // [in]
-    float minHeight;                    // [out]
-    float maxHeight;                    // [out]
-    float* heights;                     // [in][out]
-    int width;                          // [in]
-    int height;                         // [in]
-    int heightIndex;                    // [in]
+// Number of heightmap rows rasterized by a single task
+#define RASTER_BAND_ROWS 16
+
+// Maximum number of heights kept in memory at once by a tiled heightmap (512 MB of floats)
+#define TILED_BAND_MAX_HEIGHTS (128 * 1024 * 1024)
+
+// Average number of triangles to place in each heightmap grid cell
+#define GRID_TRIANGLES_PER_CELL 2
+
+// Maximum number of heightmap grid cells along either axis
+#define GRID_MAX_CELLS 4096
+
+// Maximum number of adjacent heightmap rays tested together by the SIMD kernels
+#define RAY_PACKET_SIZE 8
+
+// A single mesh triangle along with its bounds in the XZ plane
+struct HeightmapTriangle
+{
+    float v0[3];
+    float v1[3];
+    float v2[3];
+    float xmin, xmax, zmin, zmax;
+};
+
+/**
+ * Uniform 2D grid over the XZ bounds of the triangles of a single mesh.
+ *
+ * Heightmap rays are always cast straight down, so a ray only ever passes through a
+ * single grid cell and only needs to be tested against the triangles overlapping it.
+ * The grid is built once per mesh and is read-only while the rays are being cast.
+ */
+class HeightmapMeshGrid
+{
+public:
+
+    HeightmapMeshGrid(const Mesh* mesh);
+
+    /**
+     * Returns the bounds of the mesh the grid was built from.
+     */
+    const BoundingVolume& getBounds() const;
+
+    /**
+     * Computes the nearest intersection point of a downward (0,-1,0) ray with the mesh.
+     *
+     * @return True if the ray hit a triangle of the mesh.
+     */
+    bool intersect(const Vector3& rayOrigin, const Vector3& rayDirection, Vector3* point) const;
+
+    /**
+     * Computes the nearest intersection of a packet of adjacent rays with the mesh, using
+     * one of the SIMD kernels. All rays share the same direction and origin Y and Z, and
+     * are sorted by increasing origin X.
+     *
+     * @param kernel The SIMD kernel to use.
+     * @param rayOrigin Origin of the first ray.
+     * @param rayDirection Direction of all rays.
+     * @param x Origin X of each ray (RAY_PACKET_SIZE entries, count of which are used).
+     * @param count Number of rays in the packet.
+     * @param t Updated with the smaller of its current value and the nearest hit distance of each ray.
+     */
+    void intersect(Heightmap::Kernel kernel, const Vector3& rayOrigin, const Vector3& rayDirection, const float* x, int count, float* t) const;
+
+private:
+
+    int cellX(float x) const;
+    int cellZ(float z) const;
+
+    BoundingVolume _bounds;
+    float _minX;
+    float _minZ;
+    float _invCellWidth;
+    float _invCellDepth;
+    int _cellCountX;
+    int _cellCountZ;
+    std::vector<HeightmapTriangle> _triangles;
+    std::vector<unsigned int> _cellStart;      // Offset of each cell's run in _cellTriangles (cell count + 1 entries)
+    std::vector<unsigned int> _cellTriangles;  // Triangle indices, grouped by cell
 };
 
-// Globals used by thread
-int __processedHeightmapScanLines = 0;
-int __totalHeightmapScanlines = 0;
-int __failedRayCasts = 0;
+/**
+ * Writes heightmap rows to a PNG or RAW file as they are generated.
+ */
+class HeightmapWriter
+{
+public:
+
+    HeightmapWriter();
+    ~HeightmapWriter();
+
+    bool open(const char* filename, int width, int height, Heightmap::Format format);
+
+    /**
+     * Writes rows of heights (rowStride floats apart), normalized to the given height range.
+     */
+    void writeRows(const float* heights, int rowStride, int rowCount, float minHeight, float maxHeight);
+
+    bool close();
+
+private:
+
+    FILE* _fp;
+    PngWriter _png;
+    std::vector<unsigned char> _rows;
+    int _width;
+    Heightmap::Format _format;
+};
+
+// State shared by all heightmap generation tasks
+struct HeightmapContext
+{
+    float rayHeight;
+    const Vector3* rayDirection;
+    const std::vector<HeightmapMeshGrid*>* grids;       // (ray casting)
+    Heightmap::Kernel kernel;                           // (ray casting)
+    const std::vector<HeightmapTriangle>* triangles;    // (rasterization)
+    std::vector<unsigned int> bandStart;                // (rasterization) Offset of each band's run in bandTriangles (band count + 1 entries)
+    std::vector<unsigned int> bandTriangles;            // (rasterization) Triangle indices, grouped by row band
+    float minX;
+    float minZ;
+    float stepX;
+    float stepZ;
+    float* heights;                                     // Heights of the rows in the current band
+    int bandRow;                                        // First row of the current band
+    std::vector<float> rowMinHeights;
+    std::vector<float> rowMaxHeights;
+    int width;
+    int height;
+    int totalRows;                                      // Rows to process over all passes
+    std::atomic<int> processedRows;
+    std::atomic<int> failedRayCasts;
+};
 
 // Forward declarations
-int generateHeightmapChunk(void* threadData);
+void gatherTriangles(const Mesh* mesh, std::vector<HeightmapTriangle>* triangles);
+void generateHeightmapRows(HeightmapContext* context, Heightmap::Engine engine, int firstRow, int rowCount);
+void generateHeightmapRow(HeightmapContext* context, int row);
+void rasterizeHeightmapBand(HeightmapContext* context, int band, int rowStart, int rowEnd);
+int getRasterTexel(float offset, float step, bool roundUp, int low, int high);
+void getHeightmapTileFilename(const char* filename, int column, int row, char* tileFilename, size_t size);
+std::string writeHeightmapManifest(const char* filename, int width, int height, int tileSize, Heightmap::Format format, float minHeight, float maxHeight);
+void finishHeightmapRows(HeightmapContext* context, int firstRow, int rowCount);
 bool intersect(const Vector3& rayOrigin, const Vector3& rayDirection, const Vector3& boxMin, const Vector3& boxMax, float* distance = NULL);
 int intersect_triangle(const float orig[3], const float dir[3], const float vert0[3], const float vert1[3], const float vert2[3], float *t, float *u, float *v);
-bool intersect(const Vector3& rayOrigin, const Vector3& rayDirection, const std::vector<Vertex>& vertices, const std::vector<MeshPart*>& parts, Vector3* point);
+Heightmap::Kernel resolveKernel(Heightmap::Kernel kernel);
+#ifdef HEIGHTMAP_SIMD
+void intersectRaysSSE(const float orig[3], const float dir[3], const float* x, const HeightmapTriangle* triangles, const unsigned int* indices, unsigned int count, float* t);
+HEIGHTMAP_TARGET_AVX2 void intersectRaysAVX2(const float orig[3], const float dir[3], const float* x, const HeightmapTriangle* triangles, const unsigned int* indices, unsigned int count, float* t);
+#endif
 
-void Heightmap::generate(const std::vector<std::string>& nodeIds, int width, int height, const char* filename, bool highP)
+void Heightmap::generate(const std::vector<std::string>& nodeIds, int width, int height, const char* filename, Format format, Engine engine, Kernel kernel, Tiling tiling, int tileSize)
 {
     LOG(1, "Generating heightmap: %s...\n", filename);
 
-    // Initialize state variables
-    __processedHeightmapScanLines = 0;
-    __totalHeightmapScanlines = 0;
-    __failedRayCasts = 0;
+    if (engine == RAYCAST)
+    {
+        kernel = resolveKernel(kernel);
+        LOG(2, "\tUsing %s ray/triangle kernel.\n", kernel == KERNEL_AVX2 ? "AVX2" : (kernel == KERNEL_SSE ? "SSE" : "scalar"));
+    }
 
     GPBFile* gpbFile = GPBFile::getInstance();
 
@@ -101,232 +233,620 @@ void Heightmap::generate(const std::vector<std::string>& nodeIds, int width, int
     float maxX = bounds.max.x;
     float minZ = bounds.min.z;
     float maxZ = bounds.max.z;
-    int size = width * height;
-    float* heights = new float[size];
     float minHeight = FLT_MAX;
     float maxHeight = -FLT_MAX;
 
-    __totalHeightmapScanlines = height;
-
-    // Determine # of threads to spawn
-    int threadCount = min(THREAD_COUNT, height);
-
-    // Split the work into separate threads to make max use of available cpu cores and speed up computation.
-    HeightmapThreadData* threadData = new HeightmapThreadData[threadCount];
-    THREAD_HANDLE* threads = new THREAD_HANDLE[threadCount];
-    int stepSize = height / threadCount;
-    for (int i = 0, remaining = height; i < threadCount; ++i, remaining -= stepSize)
-    {
-        HeightmapThreadData& data = threadData[i];
-        data.rayHeight = rayOrigin.y;
-        data.rayDirection = &rayDirection;
-        data.bounds = &bounds;
-        data.meshes = &meshes;
-        data.minX = minX;
-        data.maxX = maxX;
-        data.minZ = minZ + (stepSize * i);
-        data.maxZ = data.minZ + stepSize - 1;
-        if (i == threadCount - 1)
-            data.maxZ = maxZ;
-        data.stepX = (maxX - minX) / width;
-        data.stepZ = (maxZ - minZ) / height;
-        data.heights = heights;
-        data.width = width;
-        data.height = remaining > stepSize ? stepSize : remaining;
-        data.heightIndex = width * (stepSize * i);
-
-        // Start the processing thread
-        if (!createThread(&threads[i], &generateHeightmapChunk, &data))
+    // Build an acceleration grid for each mesh up front so every ray only visits the
+    // triangles below it. The rasterizer instead walks a flat list of all triangles.
+    std::vector<HeightmapMeshGrid*> grids;
+    std::vector<HeightmapTriangle> triangles;
+    for (unsigned int i = 0, count = meshes.size(); i < count; ++i)
+    {
+        if (engine == RASTERIZE)
+            gatherTriangles(meshes[i], &triangles);
+        else
+            grids.push_back(new HeightmapMeshGrid(meshes[i]));
+    }
+
+    // Without tiling the whole heightmap is generated in one go. When tiled, only a band of
+    // tileSize rows is kept in memory at a time: a first pass over all bands finds the height
+    // range, and a second pass regenerates each band and writes it out.
+    if (tiling == TILING_NONE || tileSize <= 0 || tileSize > height)
+        tileSize = height;
+    if (tiling != TILING_NONE && (size_t)width * tileSize > TILED_BAND_MAX_HEIGHTS)
+    {
+        tileSize = max(1, TILED_BAND_MAX_HEIGHTS / width);
+        LOG(2, "\tReduced the tile size to %d rows to bound memory use.\n", tileSize);
+    }
+    int bandRows = tiling == TILING_NONE ? height : tileSize;
+    int passCount = bandRows < height ? 2 : 1;
+
+    HeightmapContext context;
+    context.rayHeight = rayOrigin.y;
+    context.rayDirection = &rayDirection;
+    context.grids = &grids;
+    context.kernel = kernel;
+    context.triangles = &triangles;
+    context.minX = minX;
+    context.minZ = minZ;
+    context.stepX = (maxX - minX) / width;
+    context.stepZ = (maxZ - minZ) / height;
+    context.heights = new float[(size_t)width * bandRows];
+    context.bandRow = 0;
+    context.rowMinHeights.resize(height);
+    context.rowMaxHeights.resize(height);
+    context.width = width;
+    context.height = height;
+    context.totalRows = height * passCount;
+    context.processedRows = 0;
+    context.failedRayCasts = 0;
+
+    if (engine == RASTERIZE)
+    {
+        // Bin the triangles into every band of rows their XZ bounds overlap. Counting first
+        // lets all bands share a single contiguous index array.
+        int bandCount = (height + RASTER_BAND_ROWS - 1) / RASTER_BAND_ROWS;
+        std::vector<unsigned int>& bandStart = context.bandStart;
+        bandStart.assign(bandCount + 1, 0);
+        for (int pass = 0; pass < 2; ++pass)
         {
-            LOG(1, "ERROR: Failed to spawn worker thread for generation of heightmap: %s\n", filename);
-            return;
+            std::vector<unsigned int> bandFill;
+            if (pass == 1)
+            {
+                for (int i = 0; i < bandCount; ++i)
+                    bandStart[i + 1] += bandStart[i];
+                context.bandTriangles.resize(bandStart[bandCount]);
+                bandFill.assign(bandStart.begin(), bandStart.end() - 1);
+            }
+            for (unsigned int i = 0, count = triangles.size(); i < count; ++i)
+            {
+                const HeightmapTriangle& triangle = triangles[i];
+                int b0 = getRasterTexel(triangle.zmin - minZ, context.stepZ, false, 0, height - 1) / RASTER_BAND_ROWS;
+                int b1 = getRasterTexel(triangle.zmax - minZ, context.stepZ, true, 0, height - 1) / RASTER_BAND_ROWS;
+                for (int b = b0; b <= b1; ++b)
+                {
+                    if (pass == 0)
+                        ++bandStart[b + 1];
+                    else
+                        context.bandTriangles[bandFill[b]++] = i;
+                }
+            }
         }
     }
 
-    // Wait for all threads to terminate
-    waitForThreads(threadCount, threads);
+    // Find the height range, keeping the last band generated
+    for (int row = 0; row < height; row += bandRows)
+        generateHeightmapRows(&context, engine, row, min(bandRows, height - row));
+    for (int i = 0; i < height; ++i)
+    {
+        if (context.rowMinHeights[i] < minHeight)
+            minHeight = context.rowMinHeights[i];
+        if (context.rowMaxHeights[i] > maxHeight)
+            maxHeight = context.rowMaxHeights[i];
+    }
+    int failedRayCasts = context.failedRayCasts.load();
 
-    // Close all thread handles and free memory allocations.
-    for (int i = 0; i < threadCount; ++i)
-        closeThread(threads[i]);
+    HeightmapWriter writer;
+    std::string manifest;
+    int tileColumns = (width + tileSize - 1) / tileSize;
+    TaskScheduler* scheduler = TaskScheduler::getInstance();
 
-    // Update min/max height from all completed threads
-    for (int i = 0; i < threadCount; ++i)
+    if (tiling == TILING_FILES)
     {
-        if (threadData[i].minHeight < minHeight)
-            minHeight = threadData[i].minHeight;
-        if (threadData[i].maxHeight > maxHeight)
-            maxHeight = threadData[i].maxHeight;
+        manifest = writeHeightmapManifest(filename, width, height, tileSize, format, minHeight, maxHeight);
+        if (manifest.empty())
+            goto error;
+    }
+    else if (!writer.open(filename, width, height, format))
+    {
+        goto error;
+    }
+    else if (format == FORMAT_RAW16 || format == FORMAT_RAW32)
+    {
+        // RAW heights are normalized and have no header, so the height range they map to
+        // is written alongside them
+        manifest = writeHeightmapManifest(filename, width, height, 0, format, minHeight, maxHeight);
+        if (manifest.empty())
+            goto error;
     }
 
-    LOG(1, "\r\tDone.\n");
-
-    if (__failedRayCasts)
+    // Write out each band, regenerating it first when there is more than one
+    for (int row = 0; row < height; row += bandRows)
     {
-        LOG(2, "Warning: %d triangle intersections failed for heightmap: %s\n", __failedRayCasts, filename);
+        int rowCount = min(bandRows, height - row);
+        if (passCount == 2)
+            generateHeightmapRows(&context, engine, row, rowCount);
 
-        // Go through and clamp any height values that are set to -FLT_MAX to the min recorded height value
+        // Any rays that missed every mesh are clamped to the min recorded height value
         // (otherwise the range of height values will be far too large).
-        for (int i = 0; i < size; ++i)
+        if (failedRayCasts)
+        {
+            float* heights = context.heights;
+            for (int i = 0, count = width * rowCount; i < count; ++i)
+            {
+                if (heights[i] == -FLT_MAX)
+                    heights[i] = minHeight;
+            }
+        }
+
+        if (tiling == TILING_FILES)
+        {
+            // Encode this band's tiles in parallel, each to its own file
+            std::atomic<bool> failed(false);
+            int tileRow = row / tileSize;
+            scheduler->parallelFor(0, tileColumns, [&](int column)
+            {
+                int x = column * tileSize;
+                int tileWidth = min(tileSize, width - x);
+                char tileFilename[1024];
+                getHeightmapTileFilename(filename, column, tileRow, tileFilename, sizeof(tileFilename));
+
+                HeightmapWriter tileWriter;
+                if (!tileWriter.open(tileFilename, tileWidth, rowCount, format))
+                {
+                    failed = true;
+                    return;
+                }
+                tileWriter.writeRows(context.heights + x, width, rowCount, minHeight, maxHeight);
+                if (!tileWriter.close())
+                    failed = true;
+            });
+            if (failed)
+                goto error;
+        }
+        else
         {
-            if (heights[i] == -FLT_MAX)
-                heights[i] = minHeight;
+            writer.writeRows(context.heights, width, rowCount, minHeight, maxHeight);
         }
     }
-    
-    // Normalize the max height value
-    maxHeight = maxHeight - minHeight;
 
-    png_structp png_ptr = NULL;
-    png_infop info_ptr = NULL;
-    png_bytep row = NULL;
+    LOG(1, "\r\tDone.\n");
+    LOG(3, "\tHeightmap tasks executed: %u, stolen: %u (%u threads)\n", scheduler->getStatistics().tasksExecuted, scheduler->getStatistics().tasksStolen, scheduler->getThreadCount());
+
+    if (failedRayCasts)
+        LOG(2, "Warning: %d triangle intersections failed for heightmap: %s\n", failedRayCasts, filename);
+
+    if (tiling == TILING_FILES)
+    {
+        LOG(1, "Saved heightmap tiles: %s\n", manifest.c_str());
+    }
+    else if (writer.close())
+    {
+        LOG(1, "Saved heightmap: %s\n", filename);
+        if (!manifest.empty())
+            LOG(2, "Saved heightmap manifest: %s\n", manifest.c_str());
+    }
+
+error:
+    for (unsigned int i = 0, count = grids.size(); i < count; ++i)
+        delete grids[i];
+    delete[] context.heights;
+}
+
+void generateHeightmapRows(HeightmapContext* context, Heightmap::Engine engine, int firstRow, int rowCount)
+{
+    // Rows are processed as independent tasks on the shared scheduler so that idle threads
+    // can pick up work from rows crossing dense geometry. The rasterizer works on bands of
+    // rows, clipped to the rows requested.
+    context->bandRow = firstRow;
+    TaskScheduler* scheduler = TaskScheduler::getInstance();
+    if (engine == Heightmap::RASTERIZE)
+    {
+        int firstBand = firstRow / RASTER_BAND_ROWS;
+        int lastBand = (firstRow + rowCount - 1) / RASTER_BAND_ROWS;
+        scheduler->parallelFor(firstBand, lastBand + 1, [context, firstRow, rowCount](int band)
+        {
+            int rowStart = max(band * RASTER_BAND_ROWS, firstRow);
+            int rowEnd = min(band * RASTER_BAND_ROWS + RASTER_BAND_ROWS, firstRow + rowCount);
+            rasterizeHeightmapBand(context, band, rowStart, rowEnd);
+        });
+    }
+    else
+    {
+        scheduler->parallelFor(firstRow, firstRow + rowCount, [context](int row) { generateHeightmapRow(context, row); });
+    }
+}
 
-    FILE* fp = fopen(filename, "wb");
+void getHeightmapTileFilename(const char* filename, int column, int row, char* tileFilename, size_t size)
+{
+    // <name>.png -> <name>_<column>_<row>.png
+    std::string base(filename);
+    size_t dot = base.find_last_of('.');
+    std::string ext;
+    if (dot != std::string::npos && base.find_first_of("/\\", dot) == std::string::npos)
+    {
+        ext = base.substr(dot);
+        base = base.substr(0, dot);
+    }
+    snprintf(tileFilename, size, "%s_%d_%d%s", base.c_str(), column, row, ext.c_str());
+}
+
+std::string writeHeightmapManifest(const char* filename, int width, int height, int tileSize, Heightmap::Format format, float minHeight, float maxHeight)
+{
+    // <name>.png -> <name>.json, listing each tile by its file name relative to the manifest
+    // (or just the heightmap file itself when tileSize is 0)
+    std::string path(filename);
+    size_t dot = path.find_last_of('.');
+    if (dot != std::string::npos && path.find_first_of("/\\", dot) == std::string::npos)
+        path = path.substr(0, dot);
+    path += ".json";
+
+    FILE* fp = fopen(path.c_str(), "w");
     if (fp == NULL)
     {
-        LOG(1, "Error: Failed to open file for writing: %s\n", filename);
-        goto error;
+        LOG(1, "Error: Failed to open file for writing: %s\n", path.c_str());
+        return std::string();
     }
+    OutputCache::recordOutput(path);
 
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (png_ptr == NULL)
+    const char* formats[] = { "png8", "png24", "png16", "raw16", "raw32" };
+    fprintf(fp, "{\n");
+    fprintf(fp, "    \"width\": %d,\n", width);
+    fprintf(fp, "    \"height\": %d,\n", height);
+    if (tileSize <= 0)
     {
-        LOG(1, "Error: Write struct creation failed: %s\n", filename);
-        goto error;
+        // A single heightmap file
+        const char* name = filename + strlen(filename);
+        while (name > filename && name[-1] != '/' && name[-1] != '\\')
+            --name;
+        fprintf(fp, "    \"file\": \"%s\",\n", name);
+        fprintf(fp, "    \"format\": \"%s\",\n", formats[format]);
+        fprintf(fp, "    \"minHeight\": %.9g,\n", minHeight);
+        fprintf(fp, "    \"maxHeight\": %.9g\n", maxHeight);
+        fprintf(fp, "}\n");
+        fclose(fp);
+        return path;
     }
 
-    info_ptr = png_create_info_struct(png_ptr);
-    if (info_ptr == NULL)
+    int columns = (width + tileSize - 1) / tileSize;
+    int rows = (height + tileSize - 1) / tileSize;
+    fprintf(fp, "    \"tileSize\": %d,\n", tileSize);
+    fprintf(fp, "    \"columns\": %d,\n", columns);
+    fprintf(fp, "    \"rows\": %d,\n", rows);
+    fprintf(fp, "    \"format\": \"%s\",\n", formats[format]);
+    fprintf(fp, "    \"minHeight\": %.9g,\n", minHeight);
+    fprintf(fp, "    \"maxHeight\": %.9g,\n", maxHeight);
+    fprintf(fp, "    \"tiles\": [\n");
+    for (int row = 0; row < rows; ++row)
     {
-        LOG(1, "Error: Info struct creation failed: %s\n", filename);
-        goto error;
+        for (int column = 0; column < columns; ++column)
+        {
+            char tileFilename[1024];
+            getHeightmapTileFilename(filename, column, row, tileFilename, sizeof(tileFilename));
+            const char* name = tileFilename + strlen(tileFilename);
+            while (name > tileFilename && name[-1] != '/' && name[-1] != '\\')
+                --name;
+            fprintf(fp, "        { \"file\": \"%s\", \"column\": %d, \"row\": %d, \"x\": %d, \"y\": %d, \"width\": %d, \"height\": %d }%s\n",
+                name, column, row, column * tileSize, row * tileSize, min(tileSize, width - column * tileSize), min(tileSize, height - row * tileSize),
+                (row == rows - 1 && column == columns - 1) ? "" : ",");
+        }
     }
+    fprintf(fp, "    ]\n");
+    fprintf(fp, "}\n");
+    fclose(fp);
+
+    return path;
+}
 
-    png_init_io(png_ptr, fp);
+HeightmapWriter::HeightmapWriter()
+    : _fp(NULL), _width(0), _format(Heightmap::FORMAT_PNG8)
+{
+}
 
-    png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+HeightmapWriter::~HeightmapWriter()
+{
+    if (_fp)
+        fclose(_fp);
+}
 
-    png_write_info(png_ptr, info_ptr);
+bool HeightmapWriter::open(const char* filename, int width, int height, Heightmap::Format format)
+{
+    _width = width;
+    _format = format;
 
-    // Allocate memory for a single row of image data
-    row = (png_bytep)malloc(3 * width * sizeof(png_byte));
+    if (format == Heightmap::FORMAT_PNG16)
+        return _png.open(filename, width, height, 1, 16);
+    if (format != Heightmap::FORMAT_RAW16 && format != Heightmap::FORMAT_RAW32)
+        return _png.open(filename, width, height, 3);
 
-    for (int y = 0; y < height; y++)
+    // RAW files are just the rows of samples, with no header
+    _fp = fopen(filename, "wb");
+    if (_fp == NULL)
     {
-        for (int x = 0; x < width; x++)
+        LOG(1, "Error: Failed to open file for writing: %s\n", filename);
+        return false;
+    }
+    OutputCache::recordOutput(filename);
+
+    return true;
+}
+
+void HeightmapWriter::writeRows(const float* heights, int rowStride, int rowCount, float minHeight, float maxHeight)
+{
+    // Normalize the max height value
+    float range = maxHeight - minHeight;
+
+    // Convert all rows up front so they can be handed over in a single call
+    int bytesPerPixel = (_format == Heightmap::FORMAT_PNG8 || _format == Heightmap::FORMAT_PNG24) ? 3 : (_format == Heightmap::FORMAT_RAW32 ? 4 : 2);
+    size_t rowBytes = (size_t)_width * bytesPerPixel;
+    _rows.resize(rowBytes * rowCount);
+
+    for (int y = 0; y < rowCount; ++y)
+    {
+        const float* rowHeights = heights + (size_t)y * rowStride;
+        png_bytep row = &_rows[rowBytes * y];
+        for (int x = 0; x < _width; x++)
         {
-            // Write height value normalized between 0-255 (between min and max height)
-            float h = heights[y*width + x];
-            float nh = (h - minHeight) / maxHeight;
-            int pos = x*3;
-            if (highP)
-            {
-                // high precision packed 24-bit (RGB)
-                int bits = (int)(nh * 16777215.0f); // 2^24-1
-                
-                row[pos+2] = (png_byte)(bits & 0xff);
-                bits >>= 8;
-                row[pos+1] = (png_byte)(bits & 0xff);
-                bits >>= 8;
-                row[pos] = (png_byte)(bits & 0xff);
-            }
-            else
+            // Height value normalized between 0-1 (between min and max height)
+            float h = rowHeights[x];
+            float nh = (h - minHeight) / range;
+            switch (_format)
             {
-                // standard precision 8-bit (grayscale)
-                png_byte b = (png_byte)(nh * 255.0f);
-                row[pos] = row[pos+1] = row[pos+2] = b;
+            case Heightmap::FORMAT_PNG24:
+                {
+                    // high precision packed 24-bit (RGB)
+                    int bits = (int)(nh * 16777215.0f); // 2^24-1
+                    int pos = x*3;
+                    row[pos+2] = (png_byte)(bits & 0xff);
+                    bits >>= 8;
+                    row[pos+1] = (png_byte)(bits & 0xff);
+                    bits >>= 8;
+                    row[pos] = (png_byte)(bits & 0xff);
+                }
+                break;
+            case Heightmap::FORMAT_PNG16:
+                {
+                    // 16-bit grayscale (PNG samples are big-endian)
+                    unsigned int bits = (unsigned int)(nh * 65535.0f);
+                    row[x*2] = (png_byte)(bits >> 8);
+                    row[x*2+1] = (png_byte)(bits & 0xff);
+                }
+                break;
+            case Heightmap::FORMAT_RAW16:
+                {
+                    // 16-bit little-endian
+                    unsigned int bits = (unsigned int)(nh * 65535.0f);
+                    row[x*2] = (png_byte)(bits & 0xff);
+                    row[x*2+1] = (png_byte)(bits >> 8);
+                }
+                break;
+            case Heightmap::FORMAT_RAW32:
+                {
+                    // 32-bit little-endian float
+                    unsigned int bits;
+                    memcpy(&bits, &nh, sizeof(float));
+                    row[x*4] = (png_byte)(bits & 0xff);
+                    row[x*4+1] = (png_byte)((bits >> 8) & 0xff);
+                    row[x*4+2] = (png_byte)((bits >> 16) & 0xff);
+                    row[x*4+3] = (png_byte)(bits >> 24);
+                }
+                break;
+            default:
+                {
+                    // standard precision 8-bit (grayscale)
+                    png_byte b = (png_byte)(nh * 255.0f);
+                    row[x*3] = row[x*3+1] = row[x*3+2] = b;
+                }
+                break;
             }
         }
-        png_write_row(png_ptr, row);
     }
 
-    png_write_end(png_ptr, NULL);
-    LOG(1, "Saved heightmap: %s\n", filename);
-
-error:
-    if (threadData)
-        delete[] threadData;
-    if (threads)
-        delete[] threads;
-    if (heights)
-        delete[] heights;
-    if (fp)
-        fclose(fp);
-    if (row)
-        free(row);
-    if (info_ptr)
-        png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
-    if (png_ptr)
-        png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
+    if (_fp)
+        fwrite(&_rows[0], 1, _rows.size(), _fp);
+    else
+        _png.writeRows(&_rows[0], rowCount);
 }
 
-int generateHeightmapChunk(void* threadData)
+bool HeightmapWriter::close()
 {
-    HeightmapThreadData* data = (HeightmapThreadData*)threadData;
+    if (!_fp)
+        return _png.close();
+    if (fflush(_fp) != 0)
+    {
+        LOG(1, "Error: Failed to write heightmap data.\n");
+        return false;
+    }
+    return true;
+}
 
-    Vector3 rayOrigin(0, data->rayHeight, 0);
-    const Vector3& rayDirection = *data->rayDirection;
-    const std::vector<Mesh*>& meshes = *data->meshes;
-    float* heights = data->heights;
+void generateHeightmapRow(HeightmapContext* context, int row)
+{
+    Vector3 rayOrigin(0, context->rayHeight, 0);
+    const Vector3& rayDirection = *context->rayDirection;
+    const std::vector<HeightmapMeshGrid*>& grids = *context->grids;
+    float* heights = context->heights + (row - context->bandRow) * context->width;
 
     Vector3 intersectionPoint;
-    float minHeight = FLT_MAX;
-    float maxHeight = -FLT_MAX;
-    int index = data->heightIndex;
+    rayOrigin.z = context->minZ + row * context->stepZ;
 
-    int zi = 0;
-    for (float z = data->minZ; zi < data->height; z += data->stepZ, ++zi)
+    if (context->kernel != Heightmap::KERNEL_SCALAR)
     {
-        LOG(1, "\r\t%d%%", (int)(((float)__processedHeightmapScanLines / __totalHeightmapScanlines) * 100.0f));
-
-        rayOrigin.z = z;
-
-        int xi = 0;
-        for (float x = data->minX; xi < data->width; x += data->stepX, ++xi)
+        // Cast packets of adjacent rays at once. The last packet of the row is padded by
+        // repeating its last ray.
+        int lanes = context->kernel == Heightmap::KERNEL_AVX2 ? 8 : 4;
+        float x[RAY_PACKET_SIZE];
+        float t[RAY_PACKET_SIZE];
+        for (int xi = 0; xi < context->width; xi += lanes)
         {
-            float h = -FLT_MAX;
-            rayOrigin.x = x;
-
-            for (unsigned int i = 0, count = meshes.size(); i < count; ++i)
+            int rayCount = min(lanes, context->width - xi);
+            for (int i = 0; i < lanes; ++i)
+                x[i] = context->minX + min(xi + i, context->width - 1) * context->stepX;
+            for (int i = 0; i < rayCount; ++i)
+                heights[xi + i] = -FLT_MAX;
+            rayOrigin.x = x[0];
+
+            for (unsigned int i = 0, count = grids.size(); i < count; ++i)
             {
                 // Pick the highest intersecting Y value of all meshes
-                Mesh* mesh = meshes[i];
+                const HeightmapMeshGrid* grid = grids[i];
 
-                // Perform a quick ray/bounding box test to quick-out
-                if (!intersect(rayOrigin, rayDirection, mesh->bounds.min, mesh->bounds.max))
+                // Quick-out if the packet misses the mesh bounds
+                const BoundingVolume& bounds = grid->getBounds();
+                if (x[rayCount - 1] < bounds.min.x || x[0] > bounds.max.x || rayOrigin.z < bounds.min.z || rayOrigin.z > bounds.max.z)
                     continue;
 
-                // Compute the intersection point of ray with mesh
-                if (intersect(rayOrigin, rayDirection, mesh->vertices, mesh->parts, &intersectionPoint))
-                {
-                    if (intersectionPoint.y > h)
-                    {
-                        h = intersectionPoint.y;
+                for (int j = 0; j < lanes; ++j)
+                    t[j] = FLT_MAX;
+                grid->intersect(context->kernel, rayOrigin, rayDirection, x, rayCount, t);
 
-                        // Update min/max height values
-                        if (h < minHeight)
-                            minHeight = h;
-                        if (h > maxHeight)
-                            maxHeight = h;
-                    }
+                for (int j = 0; j < rayCount; ++j)
+                {
+                    // Same intersection point as the single ray case: origin + direction * t
+                    if (t[j] != FLT_MAX && rayOrigin.y + rayDirection.y * t[j] > heights[xi + j])
+                        heights[xi + j] = rayOrigin.y + rayDirection.y * t[j];
                 }
             }
+        }
 
-            // Update the glboal height array
-            heights[index++] = h;
+        finishHeightmapRows(context, row, 1);
+        return;
+    }
 
-            if (h == -FLT_MAX)
-                ++__failedRayCasts;
+    for (int xi = 0; xi < context->width; ++xi)
+    {
+        float h = -FLT_MAX;
+        rayOrigin.x = context->minX + xi * context->stepX;
+
+        for (unsigned int i = 0, count = grids.size(); i < count; ++i)
+        {
+            // Pick the highest intersecting Y value of all meshes
+            const HeightmapMeshGrid* grid = grids[i];
+
+            // Perform a quick ray/bounding box test to quick-out
+            const BoundingVolume& bounds = grid->getBounds();
+            if (!intersect(rayOrigin, rayDirection, bounds.min, bounds.max))
+                continue;
+
+            // Compute the intersection point of ray with mesh
+            if (grid->intersect(rayOrigin, rayDirection, &intersectionPoint))
+            {
+                if (intersectionPoint.y > h)
+                    h = intersectionPoint.y;
+            }
         }
 
-        ++__processedHeightmapScanLines;
+        // Update the glboal height array
+        heights[xi] = h;
+    }
+
+    finishHeightmapRows(context, row, 1);
+}
+
+int getRasterTexel(float offset, float step, bool roundUp, int low, int high)
+{
+    // A mesh with no extent along an axis has a zero step, so every texel on that axis samples
+    // the same position and the first one stands for all of them. The index is clamped while
+    // it is still a float, since converting an out of range float to int is undefined.
+    if (!(step > 0.0f))
+        return low;
+    float texel = roundUp ? ceil(offset / step) : floor(offset / step);
+    if (!(texel > low))
+        return low;
+    if (texel >= high)
+        return high;
+    return (int)texel;
+}
+
+void rasterizeHeightmapBand(HeightmapContext* context, int band, int rowStart, int rowEnd)
+{
+    const std::vector<HeightmapTriangle>& triangles = *context->triangles;
+    int width = context->width;
+    float* heights = context->heights + (rowStart - context->bandRow) * width;
+
+    for (int i = 0, count = width * (rowEnd - rowStart); i < count; ++i)
+        heights[i] = -FLT_MAX;
+
+    // Since every heightmap ray points straight down, casting a ray at each texel is the
+    // same as scan converting each triangle in the XZ plane and keeping the highest Y.
+    for (unsigned int i = context->bandStart[band], end = context->bandStart[band + 1]; i < end; ++i)
+    {
+        const HeightmapTriangle& triangle = triangles[context->bandTriangles[i]];
+        const float* v0 = triangle.v0;
+        const float* v1 = triangle.v1;
+        const float* v2 = triangle.v2;
+
+        // Skip triangles that are edge-on when viewed from above (the ray would lie in their plane)
+        float e1x = v1[0] - v0[0], e1y = v1[1] - v0[1], e1z = v1[2] - v0[2];
+        float e2x = v2[0] - v0[0], e2y = v2[1] - v0[1], e2z = v2[2] - v0[2];
+        float det = e1x * e2z - e1z * e2x;
+        if (det > -MATH_EPSILON && det < MATH_EPSILON)
+            continue;
+        float invDet = 1.0f / det;
+
+        // Texels whose sample point may fall within the triangle's XZ bounds
+        int x0 = getRasterTexel(triangle.xmin - context->minX, context->stepX, false, 0, width - 1);
+        int x1 = getRasterTexel(triangle.xmax - context->minX, context->stepX, true, 0, width - 1);
+        int z0 = getRasterTexel(triangle.zmin - context->minZ, context->stepZ, false, rowStart, rowEnd - 1);
+        int z1 = getRasterTexel(triangle.zmax - context->minZ, context->stepZ, true, rowStart, rowEnd - 1);
+
+        for (int zi = z0; zi <= z1; ++zi)
+        {
+            float z = context->minZ + zi * context->stepZ;
+            if (z < triangle.zmin || z > triangle.zmax)
+                continue;
+            float pz = z - v0[2];
+            float* row = heights + (zi - rowStart) * width;
+
+            for (int xi = x0; xi <= x1; ++xi)
+            {
+                float x = context->minX + xi * context->stepX;
+                if (x < triangle.xmin || x > triangle.xmax)
+                    continue;
+                float px = x - v0[0];
+
+                // Barycentric coordinates of the sample point, with the same inclusive
+                // edge tests as the ray/triangle intersection.
+                float u = (px * e2z - pz * e2x) * invDet;
+                if (u < 0.0f || u > 1.0f)
+                    continue;
+                float v = (e1x * pz - e1z * px) * invDet;
+                if (v < 0.0f || u + v > 1.0f)
+                    continue;
+
+                float h = v0[1] + u * e1y + v * e2y;
+                if (h > row[xi])
+                    row[xi] = h;
+            }
+        }
     }
 
-    // Update min/max height for this thread data
-    data->minHeight = minHeight;
-    data->maxHeight = maxHeight;
+    finishHeightmapRows(context, rowStart, rowEnd - rowStart);
+}
 
-    return 0;
+void finishHeightmapRows(HeightmapContext* context, int firstRow, int rowCount)
+{
+    // Record min/max height and failed rays for the rows
+    int failed = 0;
+    for (int row = firstRow; row < firstRow + rowCount; ++row)
+    {
+        const float* heights = context->heights + (row - context->bandRow) * context->width;
+        float minHeight = FLT_MAX;
+        float maxHeight = -FLT_MAX;
+        for (int i = 0; i < context->width; ++i)
+        {
+            float h = heights[i];
+            if (h == -FLT_MAX)
+            {
+                ++failed;
+                continue;
+            }
+            if (h < minHeight)
+                minHeight = h;
+            if (h > maxHeight)
+                maxHeight = h;
+        }
+        context->rowMinHeights[row] = minHeight;
+        context->rowMaxHeights[row] = maxHeight;
+    }
+    if (failed)
+        context->failedRayCasts += failed;
+
+    // Only report progress when the percentage changes
+    int processed = context->processedRows += rowCount;
+    int percent = (int)(((float)processed / context->totalRows) * 100.0f);
+    if (percent != (int)(((float)(processed - rowCount) / context->totalRows) * 100.0f))
+        LOG(1, "\r\t%d%%", percent);
 }
 
 /////////////////////////////////////////////////////////////
@@ -393,55 +913,436 @@ int intersect_triangle(const float orig[3], const float dir[3], const float vert
    return 1;
 }
 
-// Performs an intersection test between a ray and the given mesh part and stores the result in "point".
-bool intersect(const Vector3& rayOrigin, const Vector3& rayDirection, const std::vector<Vertex>& vertices, const std::vector<MeshPart*>& parts, Vector3* point)
+// Returns true if the CPU and OS support AVX2.
+static bool cpuSupportsAVX2()
 {
-    const float* orig = &rayOrigin.x;
-    const float* dir = &rayDirection.x;
+#if !defined(HEIGHTMAP_SIMD)
+    return false;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
 
-    float minT = FLT_MAX;
+// Maps the requested kernel to one the CPU can run.
+Heightmap::Kernel resolveKernel(Heightmap::Kernel kernel)
+{
+#ifdef HEIGHTMAP_SIMD
+    bool avx2 = cpuSupportsAVX2();
+    if (kernel == Heightmap::KERNEL_AUTO)
+        return avx2 ? Heightmap::KERNEL_AVX2 : Heightmap::KERNEL_SSE;
+    if (kernel == Heightmap::KERNEL_AVX2 && !avx2)
+    {
+        LOG(1, "Warning: AVX2 is not supported by this CPU; using the SSE heightmap kernel instead.\n");
+        return Heightmap::KERNEL_SSE;
+    }
+    return kernel;
+#else
+    if (kernel == Heightmap::KERNEL_SSE || kernel == Heightmap::KERNEL_AVX2)
+        LOG(1, "Warning: SIMD heightmap kernels are not available on this platform; using the scalar kernel instead.\n");
+    return Heightmap::KERNEL_SCALAR;
+#endif
+}
+
+// The ray packet kernels below test rays that share their direction and origin Y and Z,
+// differing only in origin X, against a list of triangles. Only the parts of the
+// intersection that depend on X are computed per ray, but they follow intersect_triangle
+// operation for operation (including the XZ bounds quick-out) so every kernel reports
+// exactly the same hits. Each ray's t is lowered to its nearest hit distance.
+
+#ifdef HEIGHTMAP_SIMD
+
+void intersectRaysSSE(const float orig[3], const float dir[3], const float* x, const HeightmapTriangle* triangles, const unsigned int* indices, unsigned int count, float* t)
+{
+    const __m128 rayX = _mm_loadu_ps(x);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), noHit = _mm_set1_ps(FLT_MAX);
+    __m128 minT = _mm_loadu_ps(t);
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        const HeightmapTriangle& triangle = triangles[indices[i]];
+        if (orig[2] < triangle.zmin || orig[2] > triangle.zmax || x[3] < triangle.xmin || x[0] > triangle.xmax)
+            continue;
+
+        float edge1[3], edge2[3], pvec[3];
+        SUB(edge1, triangle.v1, triangle.v0);
+        SUB(edge2, triangle.v2, triangle.v0);
+        CROSS(pvec, dir, edge2);
+        float det = DOT(edge1, pvec);
+        if (det > -EPSILON && det < EPSILON)
+            continue;
+        __m128 invDet = _mm_set1_ps(1.0f / det);
+
+        // tvec = orig - vert0, u = (tvec . pvec) / det
+        float ty = orig[1] - triangle.v0[1], tz = orig[2] - triangle.v0[2];
+        __m128 tx = _mm_sub_ps(rayX, _mm_set1_ps(triangle.v0[0]));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, _mm_set1_ps(pvec[0])), _mm_set1_ps(ty * pvec[1])), _mm_set1_ps(tz * pvec[2])), invDet);
+
+        // qvec = tvec x edge1, v = (dir . qvec) / det
+        float qx = ty * edge1[2] - tz * edge1[1];
+        __m128 qy = _mm_sub_ps(_mm_set1_ps(tz * edge1[0]), _mm_mul_ps(tx, _mm_set1_ps(edge1[2])));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, _mm_set1_ps(edge1[1])), _mm_set1_ps(ty * edge1[0]));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_set1_ps(dir[0] * qx), _mm_mul_ps(_mm_set1_ps(dir[1]), qy)), _mm_mul_ps(_mm_set1_ps(dir[2]), qz)), invDet);
+
+        // t = (edge2 . qvec) / det
+        __m128 hit = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_set1_ps(edge2[0] * qx), _mm_mul_ps(_mm_set1_ps(edge2[1]), qy)), _mm_mul_ps(_mm_set1_ps(edge2[2]), qz)), invDet);
+
+        __m128 mask = _mm_and_ps(_mm_cmpge_ps(rayX, _mm_set1_ps(triangle.xmin)), _mm_cmple_ps(rayX, _mm_set1_ps(triangle.xmax)));
+        mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+        mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+        minT = _mm_min_ps(minT, _mm_or_ps(_mm_and_ps(mask, hit), _mm_andnot_ps(mask, noHit)));
+    }
+
+    _mm_storeu_ps(t, minT);
+}
+
+HEIGHTMAP_TARGET_AVX2 void intersectRaysAVX2(const float orig[3], const float dir[3], const float* x, const HeightmapTriangle* triangles, const unsigned int* indices, unsigned int count, float* t)
+{
+    const __m256 rayX = _mm256_loadu_ps(x);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), noHit = _mm256_set1_ps(FLT_MAX);
+    __m256 minT = _mm256_loadu_ps(t);
 
-    for (unsigned int i = 0, partCount = parts.size(); i < partCount; ++i)
+    for (unsigned int i = 0; i < count; ++i)
     {
-        MeshPart* part = parts[i];
+        const HeightmapTriangle& triangle = triangles[indices[i]];
+        if (orig[2] < triangle.zmin || orig[2] > triangle.zmax || x[7] < triangle.xmin || x[0] > triangle.xmax)
+            continue;
+
+        float edge1[3], edge2[3], pvec[3];
+        SUB(edge1, triangle.v1, triangle.v0);
+        SUB(edge2, triangle.v2, triangle.v0);
+        CROSS(pvec, dir, edge2);
+        float det = DOT(edge1, pvec);
+        if (det > -EPSILON && det < EPSILON)
+            continue;
+        __m256 invDet = _mm256_set1_ps(1.0f / det);
+
+        // tvec = orig - vert0, u = (tvec . pvec) / det
+        float ty = orig[1] - triangle.v0[1], tz = orig[2] - triangle.v0[2];
+        __m256 tx = _mm256_sub_ps(rayX, _mm256_set1_ps(triangle.v0[0]));
+        __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, _mm256_set1_ps(pvec[0])), _mm256_set1_ps(ty * pvec[1])), _mm256_set1_ps(tz * pvec[2])), invDet);
+
+        // qvec = tvec x edge1, v = (dir . qvec) / det
+        float qx = ty * edge1[2] - tz * edge1[1];
+        __m256 qy = _mm256_sub_ps(_mm256_set1_ps(tz * edge1[0]), _mm256_mul_ps(tx, _mm256_set1_ps(edge1[2])));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, _mm256_set1_ps(edge1[1])), _mm256_set1_ps(ty * edge1[0]));
+        __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(dir[0] * qx), _mm256_mul_ps(_mm256_set1_ps(dir[1]), qy)), _mm256_mul_ps(_mm256_set1_ps(dir[2]), qz)), invDet);
+
+        // t = (edge2 . qvec) / det
+        __m256 hit = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(edge2[0] * qx), _mm256_mul_ps(_mm256_set1_ps(edge2[1]), qy)), _mm256_mul_ps(_mm256_set1_ps(edge2[2]), qz)), invDet);
+
+        __m256 mask = _mm256_and_ps(_mm256_cmp_ps(rayX, _mm256_set1_ps(triangle.xmin), _CMP_GE_OQ), _mm256_cmp_ps(rayX, _mm256_set1_ps(triangle.xmax), _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+        minT = _mm256_min_ps(minT, _mm256_blendv_ps(noHit, hit, mask));
+    }
+
+    _mm256_storeu_ps(t, minT);
+}
+
+#endif
 
-        for (unsigned int j = 0, indexCount = part->getIndicesCount(); j < indexCount; j += 3)
+void Heightmap::benchmarkKernels()
+{
+    // Random triangles of a few units in size within a 100x100 area, tested against rows
+    // of closely spaced downward rays, as when the heightmap is finer than the mesh.
+    const unsigned int triangleCount = 256;
+    const unsigned int packetCount = 20000;
+    const float raySpacing = 0.05f;
+
+    srand(1);
+    std::vector<HeightmapTriangle> triangles(triangleCount);
+    std::vector<unsigned int> indices(triangleCount);
+    for (unsigned int i = 0; i < triangleCount; ++i)
+    {
+        HeightmapTriangle& triangle = triangles[i];
+        float cx = MATH_RANDOM_0_1() * 100.0f, cz = MATH_RANDOM_0_1() * 100.0f;
+        float* vertices[3] = { triangle.v0, triangle.v1, triangle.v2 };
+        for (int j = 0; j < 3; ++j)
+        {
+            vertices[j][0] = cx + MATH_RANDOM_MINUS1_1() * 20.0f;
+            vertices[j][1] = MATH_RANDOM_MINUS1_1() * 10.0f;
+            vertices[j][2] = cz + MATH_RANDOM_MINUS1_1() * 20.0f;
+        }
+        triangle.xmin = min(triangle.v0[0], min(triangle.v1[0], triangle.v2[0]));
+        triangle.xmax = max(triangle.v0[0], max(triangle.v1[0], triangle.v2[0]));
+        triangle.zmin = min(triangle.v0[2], min(triangle.v1[2], triangle.v2[2]));
+        triangle.zmax = max(triangle.v0[2], max(triangle.v1[2], triangle.v2[2]));
+        indices[i] = i;
+    }
+    std::vector<float> origins(packetCount * 2);
+    for (unsigned int i = 0; i < packetCount * 2; ++i)
+        origins[i] = MATH_RANDOM_0_1() * 100.0f;
+
+    const float dir[3] = { 0.0f, -1.0f, 0.0f };
+    const char* names[] = { "scalar", "SSE", "AVX2" };
+    Kernel kernels[] = { KERNEL_SCALAR, KERNEL_SSE, KERNEL_AVX2 };
+    Kernel best = resolveKernel(KERNEL_AUTO);
+    double scalarSeconds = 0.0;
+    std::vector<float> reference(packetCount * RAY_PACKET_SIZE);
+
+    LOG(1, "Heightmap ray/triangle kernels (%u rays x %u triangles):\n", packetCount * RAY_PACKET_SIZE, triangleCount);
+    for (int k = 0; k < 3; ++k)
+    {
+        if (kernels[k] != KERNEL_SCALAR && (best == KERNEL_SCALAR || (kernels[k] == KERNEL_AVX2 && best != KERNEL_AVX2)))
+        {
+            LOG(1, "  %-8s not supported\n", names[k]);
+            continue;
+        }
+
+        unsigned int hits = 0, mismatches = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < packetCount; ++i)
+        {
+            float orig[3] = { origins[i * 2], 20.0f, origins[i * 2 + 1] };
+            float x[RAY_PACKET_SIZE], t[RAY_PACKET_SIZE];
+            for (int lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+            {
+                x[lane] = orig[0] + lane * raySpacing;
+                t[lane] = FLT_MAX;
+            }
+
+            if (kernels[k] == KERNEL_SCALAR)
+            {
+                for (int lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+                {
+                    orig[0] = x[lane];
+                    for (unsigned int j = 0; j < triangleCount; ++j)
+                    {
+                        const HeightmapTriangle& triangle = triangles[j];
+                        if (orig[0] < triangle.xmin || orig[0] > triangle.xmax || orig[2] < triangle.zmin || orig[2] > triangle.zmax)
+                            continue;
+                        float hit, u, v;
+                        if (intersect_triangle(orig, dir, triangle.v0, triangle.v1, triangle.v2, &hit, &u, &v) && hit < t[lane])
+                            t[lane] = hit;
+                    }
+                }
+            }
+#ifdef HEIGHTMAP_SIMD
+            else if (kernels[k] == KERNEL_SSE)
+            {
+                intersectRaysSSE(orig, dir, x, &triangles[0], &indices[0], triangleCount, t);
+                intersectRaysSSE(orig, dir, x + 4, &triangles[0], &indices[0], triangleCount, t + 4);
+            }
+            else
+            {
+                intersectRaysAVX2(orig, dir, x, &triangles[0], &indices[0], triangleCount, t);
+            }
+#endif
+
+            for (int lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+            {
+                if (t[lane] != FLT_MAX)
+                    ++hits;
+                if (k == 0)
+                    reference[i * RAY_PACKET_SIZE + lane] = t[lane];
+                else if (t[lane] != reference[i * RAY_PACKET_SIZE + lane])
+                    ++mismatches;
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (k == 0)
+            scalarSeconds = seconds;
+
+        LOG(1, "  %-8s %8.2f M rays/s  %5.2fx  (%u hits, %u mismatches)\n", names[k],
+            packetCount * RAY_PACKET_SIZE / seconds / 1000000.0, scalarSeconds / seconds, hits, mismatches);
+    }
+}
+
+// Appends all triangles of all parts of the mesh to the list, along with their XZ bounds.
+void gatherTriangles(const Mesh* mesh, std::vector<HeightmapTriangle>* triangles)
+{
+    const std::vector<Vertex>& vertices = mesh->vertices;
+
+    for (unsigned int i = 0, partCount = mesh->parts.size(); i < partCount; ++i)
+    {
+        MeshPart* part = mesh->parts[i];
+        for (unsigned int j = 0, indexCount = part->getIndicesCount(); j + 2 < indexCount; j += 3)
         {
             const float* v0 = &vertices[part->getIndex( j )].position.x;
             const float* v1 = &vertices[part->getIndex(j+1)].position.x;
             const float* v2 = &vertices[part->getIndex(j+2)].position.x;
 
-            // Perform a quick check (in 2D) to determine if the point is definitely NOT in the triangle
-            float xmin, xmax, zmin, zmax;
-            xmin = v0[0] < v1[0] ? v0[0] : v1[0]; xmin = xmin < v2[0] ? xmin : v2[0];
-            xmax = v0[0] > v1[0] ? v0[0] : v1[0]; xmax = xmax > v2[0] ? xmax : v2[0];
-            zmin = v0[2] < v1[2] ? v0[2] : v1[2]; zmin = zmin < v2[2] ? zmin : v2[2];
-            zmax = v0[2] > v1[2] ? v0[2] : v1[2]; zmax = zmax > v2[2] ? zmax : v2[2];
-            if (orig[0] < xmin || orig[0] > xmax || orig[2] < zmin || orig[2] > zmax)
-                continue;
+            HeightmapTriangle triangle;
+            memcpy(triangle.v0, v0, sizeof(float) * 3);
+            memcpy(triangle.v1, v1, sizeof(float) * 3);
+            memcpy(triangle.v2, v2, sizeof(float) * 3);
+            triangle.xmin = v0[0] < v1[0] ? v0[0] : v1[0]; triangle.xmin = triangle.xmin < v2[0] ? triangle.xmin : v2[0];
+            triangle.xmax = v0[0] > v1[0] ? v0[0] : v1[0]; triangle.xmax = triangle.xmax > v2[0] ? triangle.xmax : v2[0];
+            triangle.zmin = v0[2] < v1[2] ? v0[2] : v1[2]; triangle.zmin = triangle.zmin < v2[2] ? triangle.zmin : v2[2];
+            triangle.zmax = v0[2] > v1[2] ? v0[2] : v1[2]; triangle.zmax = triangle.zmax > v2[2] ? triangle.zmax : v2[2];
+            triangles->push_back(triangle);
+        }
+    }
+}
 
-            // Perform a full ray/traingle intersection test in 3D to get the intersection point
-            float t, u, v;
-            if (intersect_triangle(orig, dir, v0, v1, v2, &t, &u, &v))
+HeightmapMeshGrid::HeightmapMeshGrid(const Mesh* mesh)
+    : _bounds(mesh->bounds), _minX(0), _minZ(0), _invCellWidth(0), _invCellDepth(0), _cellCountX(1), _cellCountZ(1)
+{
+    gatherTriangles(mesh, &_triangles);
+
+    // Size the grid so that each cell holds a small number of triangles, keeping the
+    // cells roughly square in world space.
+    _minX = _bounds.min.x;
+    _minZ = _bounds.min.z;
+    float extentX = _bounds.max.x - _bounds.min.x;
+    float extentZ = _bounds.max.z - _bounds.min.z;
+    if (extentX > 0.0f && extentZ > 0.0f)
+    {
+        float cellCount = (float)_triangles.size() / GRID_TRIANGLES_PER_CELL;
+        float cellSize = sqrt((extentX * extentZ) / (cellCount > 1.0f ? cellCount : 1.0f));
+
+        // Clamp before converting, since extreme aspect ratios (or an area that underflows
+        // to zero) give counts that don't fit in an int
+        if (cellSize > 0.0f)
+        {
+            _cellCountX = (int)max(1.0f, min((float)ceil(extentX / cellSize), (float)GRID_MAX_CELLS));
+            _cellCountZ = (int)max(1.0f, min((float)ceil(extentZ / cellSize), (float)GRID_MAX_CELLS));
+        }
+        else
+        {
+            _cellCountX = extentX >= extentZ ? GRID_MAX_CELLS : 1;
+            _cellCountZ = extentX >= extentZ ? 1 : GRID_MAX_CELLS;
+        }
+        _invCellWidth = _cellCountX / extentX;
+        _invCellDepth = _cellCountZ / extentZ;
+    }
+    else if (extentX > 0.0f)
+    {
+        // Degenerate in Z: a single row of cells
+        _cellCountX = min(GRID_MAX_CELLS, max(1, (int)min(_triangles.size() / GRID_TRIANGLES_PER_CELL, (size_t)GRID_MAX_CELLS)));
+        _invCellWidth = _cellCountX / extentX;
+    }
+    else if (extentZ > 0.0f)
+    {
+        // Degenerate in X: a single column of cells
+        _cellCountZ = min(GRID_MAX_CELLS, max(1, (int)min(_triangles.size() / GRID_TRIANGLES_PER_CELL, (size_t)GRID_MAX_CELLS)));
+        _invCellDepth = _cellCountZ / extentZ;
+    }
+
+    // Bin triangles into every cell their XZ bounds overlap. Counting first lets all
+    // cells share a single contiguous index array.
+    unsigned int cellCount = (unsigned int)(_cellCountX * _cellCountZ);
+    _cellStart.assign(cellCount + 1, 0);
+    for (unsigned int i = 0, count = _triangles.size(); i < count; ++i)
+    {
+        const HeightmapTriangle& triangle = _triangles[i];
+        int x0 = cellX(triangle.xmin), x1 = cellX(triangle.xmax);
+        int z0 = cellZ(triangle.zmin), z1 = cellZ(triangle.zmax);
+        for (int z = z0; z <= z1; ++z)
+            for (int x = x0; x <= x1; ++x)
+                ++_cellStart[z * _cellCountX + x + 1];
+    }
+    for (unsigned int i = 0; i < cellCount; ++i)
+    {
+        _cellStart[i + 1] += _cellStart[i];
+    }
+    _cellTriangles.resize(_cellStart[cellCount]);
+    std::vector<unsigned int> cellFill(_cellStart.begin(), _cellStart.end() - 1);
+    for (unsigned int i = 0, count = _triangles.size(); i < count; ++i)
+    {
+        const HeightmapTriangle& triangle = _triangles[i];
+        int x0 = cellX(triangle.xmin), x1 = cellX(triangle.xmax);
+        int z0 = cellZ(triangle.zmin), z1 = cellZ(triangle.zmax);
+        for (int z = z0; z <= z1; ++z)
+            for (int x = x0; x <= x1; ++x)
+                _cellTriangles[cellFill[z * _cellCountX + x]++] = i;
+    }
+}
+
+const BoundingVolume& HeightmapMeshGrid::getBounds() const
+{
+    return _bounds;
+}
+
+int HeightmapMeshGrid::cellX(float x) const
+{
+    int cell = (int)((x - _minX) * _invCellWidth);
+    return cell < 0 ? 0 : (cell >= _cellCountX ? _cellCountX - 1 : cell);
+}
+
+int HeightmapMeshGrid::cellZ(float z) const
+{
+    int cell = (int)((z - _minZ) * _invCellDepth);
+    return cell < 0 ? 0 : (cell >= _cellCountZ ? _cellCountZ - 1 : cell);
+}
+
+// Performs an intersection test between a ray and the triangles in the grid cell below it and stores the result in "point".
+bool HeightmapMeshGrid::intersect(const Vector3& rayOrigin, const Vector3& rayDirection, Vector3* point) const
+{
+    const float* orig = &rayOrigin.x;
+    const float* dir = &rayDirection.x;
+
+    float minT = FLT_MAX;
+
+    // Triangles are binned by the same cell mapping as the ray, so any triangle whose
+    // XZ bounds contain the ray is guaranteed to be in this cell.
+    int cell = cellZ(orig[2]) * _cellCountX + cellX(orig[0]);
+
+    for (unsigned int i = _cellStart[cell], end = _cellStart[cell + 1]; i < end; ++i)
+    {
+        const HeightmapTriangle& triangle = _triangles[_cellTriangles[i]];
+
+        // Perform a quick check (in 2D) to determine if the point is definitely NOT in the triangle
+        if (orig[0] < triangle.xmin || orig[0] > triangle.xmax || orig[2] < triangle.zmin || orig[2] > triangle.zmax)
+            continue;
+
+        // Perform a full ray/traingle intersection test in 3D to get the intersection point
+        float t, u, v;
+        if (intersect_triangle(orig, dir, triangle.v0, triangle.v1, triangle.v2, &t, &u, &v))
+        {
+            // Found an intersection!
+            if (t < minT)
             {
-                // Found an intersection!
-                if (t < minT)
-                {
-                    minT = t;
+                minT = t;
 
-                    if (point)
-                    {
-                        Vector3 rd(rayDirection);
-                        rd.scale(t);
-                        Vector3::add(rayOrigin, rd, point);
-                    }
+                if (point)
+                {
+                    Vector3 rd(rayDirection);
+                    rd.scale(t);
+                    Vector3::add(rayOrigin, rd, point);
                 }
-                //return true;
             }
         }
     }
 
-    return (minT != FLT_MAX);//false;
+    return (minT != FLT_MAX);
+}
+
+// Performs an intersection test between a packet of adjacent rays and the triangles in the grid cells below them.
+void HeightmapMeshGrid::intersect(Heightmap::Kernel kernel, const Vector3& rayOrigin, const Vector3& rayDirection, const float* x, int count, float* t) const
+{
+    const float* orig = &rayOrigin.x;
+    const float* dir = &rayDirection.x;
+
+    // The rays run along a single row of cells. Triangles spanning several of those cells
+    // are tested more than once, which doesn't change the nearest hit.
+    int rowStart = cellZ(orig[2]) * _cellCountX;
+    for (int cell = rowStart + cellX(x[0]), end = rowStart + cellX(x[count - 1]); cell <= end; ++cell)
+    {
+        unsigned int first = _cellStart[cell];
+        unsigned int triangleCount = _cellStart[cell + 1] - first;
+        if (triangleCount == 0)
+            continue;
+
+#ifdef HEIGHTMAP_SIMD
+        if (kernel == Heightmap::KERNEL_AVX2)
+            intersectRaysAVX2(orig, dir, x, &_triangles[0], &_cellTriangles[first], triangleCount, t);
+        else
+            intersectRaysSSE(orig, dir, x, &_triangles[0], &_cellTriangles[first], triangleCount, t);
+#endif
+    }
 }
 
 // Ray/Box intersection test.
@@ -11,15 +11,124 @@ class Heightmap
 public:
 
     /**
-     * Generates heightmap data and saves the result to the specified filename (PNG file).
+     * Defines the heightmap output formats. Heights are normalized to the range of heights
+     * found in the heightmap.
+     */
+    enum Format
+    {
+        /**
+         * 8-bit grayscale PNG (stored as RGB).
+         */
+        FORMAT_PNG8,
+
+        /**
+         * 24-bit height packed into the channels of an RGB PNG.
+         */
+        FORMAT_PNG24,
+
+        /**
+         * 16-bit grayscale PNG.
+         */
+        FORMAT_PNG16,
+
+        /**
+         * Headerless 16-bit little-endian unsigned integers. The world space heights that
+         * 0 and 65535 map to are written to a JSON manifest next to the file.
+         */
+        FORMAT_RAW16,
+
+        /**
+         * Headerless 32-bit little-endian floats in the range 0-1. The world space heights
+         * that 0 and 1 map to are written to a JSON manifest next to the file.
+         */
+        FORMAT_RAW32
+    };
+
+    /**
+     * Defines the methods used to find the mesh height under each heightmap pixel.
+     */
+    enum Engine
+    {
+        /**
+         * Casts a ray straight down through each pixel.
+         */
+        RAYCAST,
+
+        /**
+         * Rasterizes the mesh triangles from above, keeping the highest point per pixel.
+         */
+        RASTERIZE
+    };
+
+    /**
+     * Defines the ray/triangle intersection kernels available to the ray casting engine.
+     */
+    enum Kernel
+    {
+        /**
+         * Picks the widest kernel supported by the CPU.
+         */
+        KERNEL_AUTO,
+
+        /**
+         * Casts one ray at a time.
+         */
+        KERNEL_SCALAR,
+
+        /**
+         * Casts packets of 4 adjacent rays using SSE.
+         */
+        KERNEL_SSE,
+
+        /**
+         * Casts packets of 8 adjacent rays using AVX2.
+         */
+        KERNEL_AVX2
+    };
+
+    /**
+     * Defines how the heightmap is split up to bound memory use for large resolutions.
+     */
+    enum Tiling
+    {
+        /**
+         * Generates the whole heightmap in memory and writes a single PNG.
+         */
+        TILING_NONE,
+
+        /**
+         * Generates and writes the heightmap in bands of rows, streamed to a single PNG.
+         */
+        TILING_BANDS,
+
+        /**
+         * Generates the heightmap in bands of rows and writes each tile to its own PNG,
+         * along with a JSON manifest listing the tiles.
+         */
+        TILING_FILES
+    };
+
+    /**
+     * Generates heightmap data and saves the result to the specified filename (PNG or RAW file).
      *
      * @param nodeIds List of node ids to include in the heightmap generation.
      * @param width Width of the produced heightmap image.
      * @param height Height of the produced  heightmap image.
-     * @param filename Output PNG file to write the heightmap image to.
-     * @param highP Use packed 24-bit (RGB) instead of standard 8-bit grayscale.
+     * @param filename Output PNG or RAW file to write the heightmap image to.
+     * @param format Output format.
+     * @param engine Method used to compute the heights.
+     * @param kernel Ray/triangle intersection kernel used by the RAYCAST engine.
+     * @param tiling How the heightmap is split up.
+     * @param tileSize Width and height of each tile (only used when tiled).
+     */
+    static void generate(const std::vector<std::string>& nodeIds, int width, int height, const char* filename, Format format = FORMAT_PNG8,
+                         Engine engine = RAYCAST, Kernel kernel = KERNEL_AUTO, Tiling tiling = TILING_NONE, int tileSize = 0);
+
+    /**
+     * Times each ray/triangle intersection kernel supported by the CPU against the scalar
+     * kernel and logs the results.
      */
-    static void generate(const std::vector<std::string>& nodeIds, int width, int height, const char* filename, bool highP = false);
+    static void benchmarkKernels();
 
 };
 
@@ -1,5 +1,6 @@
 #include "Image.h"
 #include "Base.h"
+#include "PngWriter.h"
 
 namespace gameplay
 {
@@ -183,82 +184,9 @@ unsigned int Image::getBpp() const
     return _bpp;
 }
 
-int getPNGColorType(Image::Format format)
-{
-    switch (format)
-    {
-    case Image::LUMINANCE:
-        return PNG_COLOR_TYPE_GRAY;
-    case Image::RGB:
-        return PNG_COLOR_TYPE_RGB;
-    case Image::RGBA:
-        return PNG_COLOR_TYPE_RGBA;
-    }
-
-    return PNG_COLOR_TYPE_RGBA;
-}
-
 void Image::save(const char* path)
 {
-    png_structp png_ptr = NULL;
-    png_infop info_ptr = NULL;
-    png_bytep row = NULL;
-    unsigned int stride;
-    int index;
-
-    FILE* fp = fopen(path, "wb");
-    if (fp == NULL)
-    {
-        LOG(1, "Error: Failed to open image for writing: %s\n", path);
-        goto error;
-    }
-
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (png_ptr == NULL)
-    {
-        LOG(1, "Error: Write struct creation failed: %s\n", path);
-        goto error;
-    }
-
-    info_ptr = png_create_info_struct(png_ptr);
-    if (info_ptr == NULL)
-    {
-        LOG(1, "Error: Info struct creation failed: %s\n", path);
-        goto error;
-    }
-
-    png_init_io(png_ptr, fp);
-
-    png_set_IHDR(png_ptr, info_ptr, _width, _height, 8, getPNGColorType(_format), PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
-
-    png_write_info(png_ptr, info_ptr);
-
-    // Allocate memory for a single row of image data
-    stride = _bpp * _width * sizeof(png_byte);
-    row = (png_bytep)malloc(stride);
-
-    index = 0;
-    for (unsigned int y = 0; y < _height; ++y)
-    {
-        for (unsigned int x = 0; x < stride; ++x)
-        {
-            // Write data
-            row[x] = (png_byte)_data[index++];
-        }
-        png_write_row(png_ptr, row);
-    }
-
-    png_write_end(png_ptr, NULL);
-
-error:
-    if (fp)
-        fclose(fp);
-    if (row)
-        free(row);
-    if (info_ptr)
-        png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
-    if (png_ptr)
-        png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
+    PngWriter::write(path, _data, _width, _height, _bpp);
 }
 
 }
@@ -0,0 +1,114 @@
+#include "Base.h"
+#include "ImageCache.h"
+#include "Image.h"
+
+namespace gameplay
+{
+
+static size_t getImageSize(const Image* image)
+{
+    return (size_t)image->getWidth() * image->getHeight() * image->getBpp();
+}
+
+static Image* copyImage(const Image* image)
+{
+    Image* copy = Image::create(image->getFormat(), image->getWidth(), image->getHeight());
+    if (copy)
+        copy->setData(image->getData());
+    return copy;
+}
+
+ImageCache::ImageCache() :
+    _capacity(0), _size(0)
+{
+}
+
+ImageCache::~ImageCache()
+{
+    clear();
+}
+
+ImageCache* ImageCache::getInstance()
+{
+    static ImageCache instance;
+    return &instance;
+}
+
+void ImageCache::setCapacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _capacity = capacity;
+    trim(capacity);
+}
+
+Image* ImageCache::load(const std::string& path)
+{
+    struct stat status;
+    bool cacheable = stat(path.c_str(), &status) == 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_capacity == 0)
+        {
+            cacheable = false;
+        }
+        else if (cacheable)
+        {
+            std::map<std::string, Entry>::iterator it = _entries.find(path);
+            if (it != _entries.end())
+            {
+                Entry& entry = it->second;
+                if (entry.modified == (long long)status.st_mtime && entry.fileSize == (long long)status.st_size)
+                {
+                    _uses.splice(_uses.begin(), _uses, entry.use);
+                    LOG(3, "Using cached image: %s\n", path.c_str());
+                    return copyImage(entry.image);
+                }
+
+                // The file has changed since it was cached
+                _size -= getImageSize(entry.image);
+                _uses.erase(entry.use);
+                SAFE_DELETE(entry.image);
+                _entries.erase(it);
+            }
+        }
+    }
+
+    // Decode outside the lock so different images can be decoded at once
+    Image* image = Image::create(path.c_str());
+    if (image == NULL || !cacheable)
+        return image;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t size = getImageSize(image);
+    if (size > _capacity || _entries.find(path) != _entries.end())
+        return image;
+
+    trim(_capacity - size);
+    Entry& entry = _entries[path];
+    entry.image = copyImage(image);
+    entry.modified = (long long)status.st_mtime;
+    entry.fileSize = (long long)status.st_size;
+    entry.use = _uses.insert(_uses.begin(), path);
+    _size += size;
+    return image;
+}
+
+void ImageCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    trim(0);
+}
+
+void ImageCache::trim(size_t capacity)
+{
+    while (_size > capacity && !_uses.empty())
+    {
+        std::map<std::string, Entry>::iterator it = _entries.find(_uses.back());
+        _size -= getImageSize(it->second.image);
+        SAFE_DELETE(it->second.image);
+        _entries.erase(it);
+        _uses.pop_back();
+    }
+}
+
+}
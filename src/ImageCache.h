@@ -0,0 +1,77 @@
+#ifndef IMAGECACHE_H_
+#define IMAGECACHE_H_
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace gameplay
+{
+
+class Image;
+
+/**
+ * Keeps decoded images in memory so files that are loaded again are not decoded again.
+ *
+ * The cache is empty and disabled by default, so a single encode loads images straight
+ * from disk as before. A long running encoder gives it a capacity, and images are then
+ * kept until the least recently used ones have to make room. An image is decoded again
+ * if its file has been modified since it was cached.
+ */
+class ImageCache
+{
+public:
+
+    /**
+     * Returns the shared cache.
+     */
+    static ImageCache* getInstance();
+
+    /**
+     * Sets the number of bytes of pixel data the cache may keep, dropping the least
+     * recently used images if it holds more. Zero disables the cache.
+     */
+    void setCapacity(size_t capacity);
+
+    /**
+     * Loads the image at the given path, from the cache when it is there and up to date.
+     *
+     * @param path The path to the image file.
+     *
+     * @return A new image the caller owns, or NULL if the image could not be loaded.
+     */
+    Image* load(const std::string& path);
+
+    /**
+     * Drops all cached images.
+     */
+    void clear();
+
+private:
+
+    struct Entry
+    {
+        Image* image;
+        long long modified;
+        long long fileSize;
+        std::list<std::string>::iterator use;
+    };
+
+    ImageCache();
+    ~ImageCache();
+    ImageCache(const ImageCache&);
+    ImageCache& operator=(const ImageCache&);
+
+    void trim(size_t capacity);
+
+    std::map<std::string, Entry> _entries;
+    std::list<std::string> _uses;
+    std::mutex _mutex;
+    size_t _capacity;
+    size_t _size;
+};
+
+}
+
+#endif
@@ -0,0 +1,94 @@
+#include "Base.h"
+#include "JobContext.h"
+
+namespace gameplay
+{
+
+static thread_local JobContext* __currentContext = NULL;
+
+JobContext::Scope::Scope(JobContext* context) :
+    _previous(__currentContext)
+{
+    __currentContext = context;
+}
+
+JobContext::Scope::~Scope()
+{
+    __currentContext = _previous;
+}
+
+JobContext::JobContext(int logVerbosity) :
+    _arguments(NULL), _gpbFile(NULL), _logVerbosity(logVerbosity)
+{
+}
+
+JobContext::~JobContext()
+{
+}
+
+JobContext* JobContext::getCurrent()
+{
+    return __currentContext;
+}
+
+EncoderArguments* JobContext::getArguments() const
+{
+    return _arguments;
+}
+
+void JobContext::setArguments(EncoderArguments* arguments)
+{
+    _arguments = arguments;
+}
+
+GPBFile* JobContext::getGPBFile() const
+{
+    return _gpbFile;
+}
+
+void JobContext::setGPBFile(GPBFile* gpbFile)
+{
+    _gpbFile = gpbFile;
+}
+
+int JobContext::getLogVerbosity() const
+{
+    return _logVerbosity;
+}
+
+void JobContext::setLogVerbosity(int logVerbosity)
+{
+    _logVerbosity = logVerbosity;
+}
+
+void JobContext::appendLog(const char* text)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _log.append(text);
+}
+
+std::string JobContext::getLog() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _log;
+}
+
+void JobContext::addOutput(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _outputs.push_back(path);
+}
+
+std::vector<std::string> JobContext::getOutputs() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _outputs;
+}
+
+void JobContext::clearOutputs()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _outputs.clear();
+}
+
+}
@@ -0,0 +1,124 @@
+#ifndef JOBCONTEXT_H_
+#define JOBCONTEXT_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gameplay
+{
+
+class EncoderArguments;
+class GPBFile;
+
+/**
+ * The state of a single encode: its arguments, the GPB file being built, its log and the
+ * files it has written.
+ *
+ * Encoding used to be one file per process, so this state was reached through process
+ * wide instances such as EncoderArguments::getInstance(). When several files are encoded
+ * at once each has a context of its own, and those instances return the state of the
+ * context current on the calling thread. The task scheduler carries the current context
+ * over to the tasks a job queues, so parallel stages see the state of their own job.
+ *
+ * Without a current context the process wide instances are used, as before.
+ */
+class JobContext
+{
+public:
+
+    /**
+     * Makes a context current on the calling thread for the lifetime of the scope,
+     * restoring the previously current context afterwards.
+     */
+    class Scope
+    {
+    public:
+
+        /**
+         * Constructor.
+         *
+         * @param context The context to make current, or NULL for none.
+         */
+        Scope(JobContext* context);
+
+        /**
+         * Destructor.
+         */
+        ~Scope();
+
+    private:
+
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+
+        JobContext* _previous;
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param logVerbosity The verbosity of the job's log, until its arguments set it.
+     */
+    JobContext(int logVerbosity);
+
+    /**
+     * Destructor.
+     */
+    ~JobContext();
+
+    /**
+     * Returns the context current on the calling thread, or NULL if there is none.
+     */
+    static JobContext* getCurrent();
+
+    EncoderArguments* getArguments() const;
+    void setArguments(EncoderArguments* arguments);
+
+    GPBFile* getGPBFile() const;
+    void setGPBFile(GPBFile* gpbFile);
+
+    int getLogVerbosity() const;
+    void setLogVerbosity(int logVerbosity);
+
+    /**
+     * Appends text to the job's log. Tasks of the job may log concurrently.
+     */
+    void appendLog(const char* text);
+
+    /**
+     * Returns the job's log.
+     */
+    std::string getLog() const;
+
+    /**
+     * Records a file the job has written. Tasks of the job may write files concurrently.
+     */
+    void addOutput(const std::string& path);
+
+    /**
+     * Returns the files the job has written, in the order they were recorded.
+     */
+    std::vector<std::string> getOutputs() const;
+
+    /**
+     * Forgets the files recorded so far.
+     */
+    void clearOutputs();
+
+private:
+
+    JobContext(const JobContext&);
+    JobContext& operator=(const JobContext&);
+
+    EncoderArguments* _arguments;
+    GPBFile* _gpbFile;
+    int _logVerbosity;
+    mutable std::mutex _mutex;
+    std::string _log;
+    std::vector<std::string> _outputs;
+};
+
+}
+
+#endif
@@ -0,0 +1,677 @@
+#include "Base.h"
+#include "MSDFGenerator.h"
+
+// Channel bits of an edge
+#define MSDF_RED 1
+#define MSDF_GREEN 2
+#define MSDF_BLUE 4
+#define MSDF_WHITE 7
+
+// Edges meeting at a sharper angle than this (in radians) form a corner
+#define MSDF_CORNER_ANGLE 3.0
+
+// Newton iterations used to find the nearest point on a cubic curve
+#define MSDF_CUBIC_SEARCH_STARTS 4
+#define MSDF_CUBIC_SEARCH_STEPS 4
+
+// Distance field levels per pixel of distance, the same scale as single channel distance fields
+#define MSDF_PIXEL_LEVELS 16.0f
+
+// Channel difference (in pixels) between neighbouring pixels that causes interpolation artifacts
+#define MSDF_CLASH_THRESHOLD 1.001f
+
+namespace gameplay
+{
+
+typedef MSDFGenerator::Point Point;
+typedef MSDFGenerator::Edge Edge;
+
+// A signed distance to an edge, ordered by absolute distance and then by how far the
+// edge points away from the query point.
+struct SignedDistance
+{
+    double distance;
+    double dot;
+
+    bool operator<(const SignedDistance& other) const
+    {
+        return fabs(distance) < fabs(other.distance) || (fabs(distance) == fabs(other.distance) && dot < other.dot);
+    }
+};
+
+static Point makePoint(double x, double y)
+{
+    Point point = { x, y };
+    return point;
+}
+
+static Point operator+(const Point& a, const Point& b)
+{
+    return makePoint(a.x + b.x, a.y + b.y);
+}
+
+static Point operator-(const Point& a, const Point& b)
+{
+    return makePoint(a.x - b.x, a.y - b.y);
+}
+
+static Point operator*(double s, const Point& a)
+{
+    return makePoint(s * a.x, s * a.y);
+}
+
+static double dot(const Point& a, const Point& b)
+{
+    return a.x * b.x + a.y * b.y;
+}
+
+static double cross(const Point& a, const Point& b)
+{
+    return a.x * b.y - a.y * b.x;
+}
+
+static double length(const Point& a)
+{
+    return sqrt(a.x * a.x + a.y * a.y);
+}
+
+static Point normalize(const Point& a)
+{
+    double l = length(a);
+    return l == 0 ? makePoint(0, 1) : makePoint(a.x / l, a.y / l);
+}
+
+static Point mix(const Point& a, const Point& b, double t)
+{
+    return makePoint(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t);
+}
+
+static double nonZeroSign(double value)
+{
+    return value > 0 ? 1.0 : -1.0;
+}
+
+static bool isZero(const Point& a)
+{
+    return a.x == 0 && a.y == 0;
+}
+
+static Point edgeDirection(const Edge& edge, double t)
+{
+    const Point* p = edge.p;
+    switch (edge.degree)
+    {
+    case 1:
+        return p[1] - p[0];
+    case 2:
+        {
+            Point tangent = mix(p[1] - p[0], p[2] - p[1], t);
+            return isZero(tangent) ? p[2] - p[0] : tangent;
+        }
+    default:
+        {
+            Point tangent = mix(mix(p[1] - p[0], p[2] - p[1], t), mix(p[2] - p[1], p[3] - p[2], t), t);
+            if (isZero(tangent))
+            {
+                if (t == 0)
+                    return p[2] - p[0];
+                if (t == 1)
+                    return p[3] - p[1];
+            }
+            return tangent;
+        }
+    }
+}
+
+// Splits an edge into two at t with de Casteljau's algorithm.
+static void splitEdge(const Edge& edge, double t, Edge* first, Edge* second)
+{
+    Point p[4];
+    for (int i = 0; i <= edge.degree; ++i)
+        p[i] = edge.p[i];
+
+    *first = edge;
+    *second = edge;
+    first->p[0] = p[0];
+    second->p[edge.degree] = p[edge.degree];
+    for (int level = 1; level <= edge.degree; ++level)
+    {
+        for (int i = 0; i <= edge.degree - level; ++i)
+            p[i] = mix(p[i], p[i + 1], t);
+        first->p[level] = p[0];
+        second->p[edge.degree - level] = p[edge.degree - level];
+    }
+}
+
+// Finishes the distance to an edge whose nearest point is at param, measuring from the
+// nearer endpoint with the given direction.
+static SignedDistance endpointDistance(double distance, double param, const Point& direction0, const Point& toStart, const Point& direction1, const Point& toEnd)
+{
+    SignedDistance result;
+    result.distance = distance;
+    if (param >= 0 && param <= 1)
+        result.dot = 0;
+    else if (param < 0.5)
+        result.dot = fabs(dot(normalize(direction0), normalize(toStart)));
+    else
+        result.dot = fabs(dot(normalize(direction1), normalize(toEnd)));
+    return result;
+}
+
+static int solveQuadratic(double x[2], double a, double b, double c)
+{
+    if (fabs(a) < 1e-14)
+    {
+        if (fabs(b) < 1e-14)
+            return 0;
+        x[0] = -c / b;
+        return 1;
+    }
+    double discriminant = b * b - 4 * a * c;
+    if (discriminant > 0)
+    {
+        discriminant = sqrt(discriminant);
+        x[0] = (-b + discriminant) / (2 * a);
+        x[1] = (-b - discriminant) / (2 * a);
+        return 2;
+    }
+    if (discriminant == 0)
+    {
+        x[0] = -b / (2 * a);
+        return 1;
+    }
+    return 0;
+}
+
+// Solves x^3 + a x^2 + b x + c = 0 and returns the number of real roots.
+static int solveCubicNormed(double x[3], double a, double b, double c)
+{
+    double a2 = a * a;
+    double q = (a2 - 3 * b) / 9;
+    double r = (a * (2 * a2 - 9 * b) + 27 * c) / 54;
+    double r2 = r * r;
+    double q3 = q * q * q;
+    if (r2 < q3)
+    {
+        double t = r / sqrt(q3);
+        if (t < -1)
+            t = -1;
+        if (t > 1)
+            t = 1;
+        t = acos(t);
+        a /= 3;
+        q = -2 * sqrt(q);
+        x[0] = q * cos(t / 3) - a;
+        x[1] = q * cos((t + 2 * MATH_PI) / 3) - a;
+        x[2] = q * cos((t - 2 * MATH_PI) / 3) - a;
+        return 3;
+    }
+
+    double A = -pow(fabs(r) + sqrt(r2 - q3), 1 / 3.0);
+    if (r < 0)
+        A = -A;
+    double B = A == 0 ? 0 : q / A;
+    a /= 3;
+    x[0] = (A + B) - a;
+    x[1] = -0.5 * (A + B) - a;
+    x[2] = 0.5 * sqrt(3.0) * (A - B);
+    if (fabs(x[2]) < 1e-14)
+        return 2;
+    return 1;
+}
+
+static SignedDistance signedDistance(const Edge& edge, const Point& origin, double* param)
+{
+    const Point* p = edge.p;
+    if (edge.degree == 1)
+    {
+        Point aq = origin - p[0];
+        Point ab = p[1] - p[0];
+        *param = dot(aq, ab) / dot(ab, ab);
+        Point eq = (*param > 0.5 ? p[1] : p[0]) - origin;
+        double distance = length(eq);
+        if (*param > 0 && *param < 1)
+        {
+            // Distance along the normal of the line
+            Point normal = normalize(makePoint(ab.y, -ab.x));
+            double orthoDistance = dot(normal, aq);
+            if (fabs(orthoDistance) < distance)
+            {
+                SignedDistance result = { orthoDistance, 0 };
+                return result;
+            }
+        }
+        SignedDistance result = { nonZeroSign(cross(aq, ab)) * distance, fabs(dot(normalize(ab), normalize(eq))) };
+        return result;
+    }
+
+    Point qa = p[0] - origin;
+    Point toEnd = p[edge.degree] - origin;
+    Point direction0 = edgeDirection(edge, 0);
+    Point direction1 = edgeDirection(edge, 1);
+
+    // Start with the nearer endpoint
+    double minDistance = nonZeroSign(cross(direction0, qa)) * length(qa);
+    *param = -dot(qa, direction0) / dot(direction0, direction0);
+    double distance = nonZeroSign(cross(direction1, toEnd)) * length(toEnd);
+    if (fabs(distance) < fabs(minDistance))
+    {
+        minDistance = distance;
+        *param = dot(direction1 - toEnd, direction1) / dot(direction1, direction1);
+    }
+
+    if (edge.degree == 2)
+    {
+        // The nearest point is where the curve is perpendicular to the direction to it,
+        // which is a root of a cubic.
+        Point ab = p[1] - p[0];
+        Point br = p[2] - p[1] - ab;
+        double a = dot(br, br);
+        double b = 3 * dot(ab, br);
+        double c = 2 * dot(ab, ab) + dot(qa, br);
+        double d = dot(qa, ab);
+        double t[3];
+        int solutions;
+        if (fabs(a) < 1e-14)
+        {
+            solutions = solveQuadratic(t, b, c, d);
+        }
+        else
+        {
+            solutions = solveCubicNormed(t, b / a, c / a, d / a);
+        }
+        for (int i = 0; i < solutions; ++i)
+        {
+            if (t[i] > 0 && t[i] < 1)
+            {
+                Point qe = qa + 2 * t[i] * ab + t[i] * t[i] * br;
+                distance = nonZeroSign(cross(ab + t[i] * br, qe)) * length(qe);
+                if (fabs(distance) <= fabs(minDistance))
+                {
+                    minDistance = distance;
+                    *param = t[i];
+                }
+            }
+        }
+    }
+    else
+    {
+        // Newton's method from a few starting points along the curve
+        Point ab = p[1] - p[0];
+        Point br = p[2] - p[1] - ab;
+        Point as = (p[3] - p[2]) - (p[2] - p[1]) - br;
+        for (int i = 0; i <= MSDF_CUBIC_SEARCH_STARTS; ++i)
+        {
+            double t = (double)i / MSDF_CUBIC_SEARCH_STARTS;
+            Point qe = qa + 3 * t * ab + 3 * t * t * br + t * t * t * as;
+            for (int step = 0; step < MSDF_CUBIC_SEARCH_STEPS; ++step)
+            {
+                Point d1 = 3 * ab + 6 * t * br + 3 * t * t * as;
+                Point d2 = 6 * br + 6 * t * as;
+                t -= dot(qe, d1) / (dot(d1, d1) + dot(qe, d2));
+                if (t <= 0 || t >= 1)
+                    break;
+                qe = qa + 3 * t * ab + 3 * t * t * br + t * t * t * as;
+                distance = nonZeroSign(cross(edgeDirection(edge, t), qe)) * length(qe);
+                if (fabs(distance) < fabs(minDistance))
+                {
+                    minDistance = distance;
+                    *param = t;
+                }
+            }
+        }
+    }
+
+    return endpointDistance(minDistance, *param, direction0, qa, direction1, toEnd);
+}
+
+// Replaces the distance past the end of an edge with the distance to the extension of
+// its end tangent, so that neighbouring edges meet cleanly at corners.
+static void toPseudoDistance(const Edge& edge, const Point& origin, double param, SignedDistance* distance)
+{
+    if (param < 0)
+    {
+        Point direction = normalize(edgeDirection(edge, 0));
+        Point aq = origin - edge.p[0];
+        if (dot(aq, direction) < 0)
+        {
+            double pseudoDistance = cross(aq, direction);
+            if (fabs(pseudoDistance) <= fabs(distance->distance))
+            {
+                distance->distance = pseudoDistance;
+                distance->dot = 0;
+            }
+        }
+    }
+    else if (param > 1)
+    {
+        Point direction = normalize(edgeDirection(edge, 1));
+        Point bq = origin - edge.p[edge.degree];
+        if (dot(bq, direction) > 0)
+        {
+            double pseudoDistance = cross(bq, direction);
+            if (fabs(pseudoDistance) <= fabs(distance->distance))
+            {
+                distance->distance = pseudoDistance;
+                distance->dot = 0;
+            }
+        }
+    }
+}
+
+static bool isCorner(const Point& a, const Point& b, double crossThreshold)
+{
+    return dot(a, b) <= 0 || fabs(cross(a, b)) > crossThreshold;
+}
+
+// Moves to the next pair of channels, avoiding the banned channels where possible.
+static int switchChannels(int channels, int banned)
+{
+    int combined = channels & banned;
+    if (combined == MSDF_RED || combined == MSDF_GREEN || combined == MSDF_BLUE)
+        return combined ^ MSDF_WHITE;
+    if (channels == 0 || channels == MSDF_WHITE)
+        return MSDF_GREEN | MSDF_BLUE;
+    int shifted = channels << 1;
+    return (shifted | shifted >> 3) & MSDF_WHITE;
+}
+
+static float median(float a, float b, float c)
+{
+    return max(min(a, b), min(max(a, b), c));
+}
+
+// Returns true if interpolating between two pixels would produce an artifact, and the
+// first pixel is the one to fix.
+static bool detectClash(const float* a, const float* b)
+{
+    // Sort the channel pairs by decreasing absolute difference
+    float a0 = a[0], a1 = a[1], a2 = a[2];
+    float b0 = b[0], b1 = b[1], b2 = b[2];
+    if (fabs(b0 - a0) < fabs(b1 - a1))
+    {
+        std::swap(a0, a1);
+        std::swap(b0, b1);
+    }
+    if (fabs(b1 - a1) < fabs(b2 - a2))
+    {
+        std::swap(a1, a2);
+        std::swap(b1, b2);
+        if (fabs(b0 - a0) < fabs(b1 - a1))
+        {
+            std::swap(a0, a1);
+            std::swap(b0, b1);
+        }
+    }
+    return fabs(b1 - a1) >= MSDF_CLASH_THRESHOLD &&
+        !(b0 == b1 && b0 == b2) &&
+        fabs(a2) >= fabs(b2);
+}
+
+MSDFGenerator::MSDFGenerator() : _reverse(false)
+{
+    _position.x = 0;
+    _position.y = 0;
+}
+
+bool MSDFGenerator::load(const FT_Outline* outline)
+{
+    _contours.clear();
+
+    FT_Outline_Funcs funcs;
+    funcs.move_to = &MSDFGenerator::moveTo;
+    funcs.line_to = &MSDFGenerator::lineTo;
+    funcs.conic_to = &MSDFGenerator::conicTo;
+    funcs.cubic_to = &MSDFGenerator::cubicTo;
+    funcs.shift = 0;
+    funcs.delta = 0;
+    if (FT_Outline_Decompose(const_cast<FT_Outline*>(outline), &funcs, this))
+        return false;
+
+    // Contours that were only a move
+    for (size_t i = _contours.size(); i > 0; --i)
+    {
+        if (_contours[i - 1].empty())
+            _contours.erase(_contours.begin() + (i - 1));
+    }
+
+    // Distances are positive inside the glyph for TrueType contour orientation
+    _reverse = FT_Outline_Get_Orientation(const_cast<FT_Outline*>(outline)) == FT_ORIENTATION_POSTSCRIPT;
+
+    assignChannels();
+    return true;
+}
+
+int MSDFGenerator::moveTo(const FT_Vector* to, void* user)
+{
+    MSDFGenerator* generator = (MSDFGenerator*)user;
+    generator->_contours.push_back(Contour());
+    generator->_position = makePoint(to->x / 64.0, to->y / 64.0);
+    return 0;
+}
+
+int MSDFGenerator::lineTo(const FT_Vector* to, void* user)
+{
+    MSDFGenerator* generator = (MSDFGenerator*)user;
+    Point end = makePoint(to->x / 64.0, to->y / 64.0);
+    if (end.x != generator->_position.x || end.y != generator->_position.y)
+    {
+        Edge edge;
+        edge.degree = 1;
+        edge.p[0] = generator->_position;
+        edge.p[1] = end;
+        edge.channels = MSDF_WHITE;
+        generator->_contours.back().push_back(edge);
+    }
+    generator->_position = end;
+    return 0;
+}
+
+int MSDFGenerator::conicTo(const FT_Vector* control, const FT_Vector* to, void* user)
+{
+    MSDFGenerator* generator = (MSDFGenerator*)user;
+    Edge edge;
+    edge.degree = 2;
+    edge.p[0] = generator->_position;
+    edge.p[1] = makePoint(control->x / 64.0, control->y / 64.0);
+    edge.p[2] = makePoint(to->x / 64.0, to->y / 64.0);
+    edge.channels = MSDF_WHITE;
+    generator->_contours.back().push_back(edge);
+    generator->_position = edge.p[2];
+    return 0;
+}
+
+int MSDFGenerator::cubicTo(const FT_Vector* control1, const FT_Vector* control2, const FT_Vector* to, void* user)
+{
+    MSDFGenerator* generator = (MSDFGenerator*)user;
+    Edge edge;
+    edge.degree = 3;
+    edge.p[0] = generator->_position;
+    edge.p[1] = makePoint(control1->x / 64.0, control1->y / 64.0);
+    edge.p[2] = makePoint(control2->x / 64.0, control2->y / 64.0);
+    edge.p[3] = makePoint(to->x / 64.0, to->y / 64.0);
+    edge.channels = MSDF_WHITE;
+    generator->_contours.back().push_back(edge);
+    generator->_position = edge.p[3];
+    return 0;
+}
+
+void MSDFGenerator::assignChannels()
+{
+    double crossThreshold = sin(MSDF_CORNER_ANGLE);
+    for (size_t c = 0, contourCount = _contours.size(); c < contourCount; ++c)
+    {
+        Contour& contour = _contours[c];
+
+        // Find the edges that start at a corner
+        std::vector<size_t> corners;
+        Point previousDirection = edgeDirection(contour.back(), 1);
+        for (size_t i = 0, count = contour.size(); i < count; ++i)
+        {
+            if (isCorner(normalize(previousDirection), normalize(edgeDirection(contour[i], 0)), crossThreshold))
+                corners.push_back(i);
+            previousDirection = edgeDirection(contour[i], 1);
+        }
+
+        if (corners.empty())
+        {
+            // Smooth contours use all channels
+            for (size_t i = 0, count = contour.size(); i < count; ++i)
+                contour[i].channels = MSDF_WHITE;
+        }
+        else if (corners.size() == 1)
+        {
+            // A single corner (a teardrop) needs three sets of channels going around the
+            // contour, so edges are split when there are fewer than three of them.
+            int channels[3];
+            channels[0] = switchChannels(MSDF_WHITE, 0);
+            channels[1] = MSDF_WHITE;
+            channels[2] = switchChannels(channels[0], 0);
+
+            size_t corner = corners[0];
+            if (contour.size() < 3)
+            {
+                Contour split;
+                for (size_t i = 0, count = contour.size(); i < count; ++i)
+                {
+                    Edge first, rest, second, third;
+                    splitEdge(contour[(corner + i) % count], 1.0 / 3.0, &first, &rest);
+                    splitEdge(rest, 0.5, &second, &third);
+                    split.push_back(first);
+                    split.push_back(second);
+                    split.push_back(third);
+                }
+                contour = split;
+                corner = 0;
+            }
+
+            size_t count = contour.size();
+            for (size_t i = 0; i < count; ++i)
+            {
+                // Spread the three sets of channels evenly over the edges
+                int third = (int)(3 + 2.875 * i / (count - 1) - 1.4375 + 0.5) - 3;
+                contour[(corner + i) % count].channels = channels[third + 1];
+            }
+        }
+        else
+        {
+            // Switch channels at every corner, and make sure the last run of edges doesn't
+            // share channels with the first
+            size_t cornerCount = corners.size();
+            size_t spline = 0;
+            size_t start = corners[0];
+            size_t count = contour.size();
+            int channels = switchChannels(MSDF_WHITE, 0);
+            int initialChannels = channels;
+            for (size_t i = 0; i < count; ++i)
+            {
+                size_t index = (start + i) % count;
+                if (spline + 1 < cornerCount && corners[spline + 1] == index)
+                {
+                    ++spline;
+                    channels = switchChannels(channels, spline == cornerCount - 1 ? initialChannels : 0);
+                }
+                contour[index].channels = channels;
+            }
+        }
+    }
+}
+
+void MSDFGenerator::generate(unsigned char* image, unsigned int imageWidth, int x, int y, int width, int height, float originX, float originY) const
+{
+    std::vector<float> field(width * height * 3, 0.0f);
+    double sign = _reverse ? -1.0 : 1.0;
+
+    for (int row = 0; row < height; ++row)
+    {
+        for (int column = 0; column < width; ++column)
+        {
+            // Pixel centre in outline coordinates, which have y up
+            Point origin = makePoint(x + column + 0.5 - originX, originY - (y + row + 0.5));
+
+            SignedDistance minDistance[3];
+            const Edge* nearEdge[3] = { NULL, NULL, NULL };
+            double nearParam[3] = { 0, 0, 0 };
+            for (int channel = 0; channel < 3; ++channel)
+            {
+                minDistance[channel].distance = -DBL_MAX;
+                minDistance[channel].dot = 1;
+            }
+
+            for (size_t c = 0, contourCount = _contours.size(); c < contourCount; ++c)
+            {
+                const Contour& contour = _contours[c];
+                for (size_t e = 0, edgeCount = contour.size(); e < edgeCount; ++e)
+                {
+                    const Edge& edge = contour[e];
+                    double param;
+                    SignedDistance distance = signedDistance(edge, origin, &param);
+                    for (int channel = 0; channel < 3; ++channel)
+                    {
+                        if ((edge.channels & (1 << channel)) && distance < minDistance[channel])
+                        {
+                            minDistance[channel] = distance;
+                            nearEdge[channel] = &edge;
+                            nearParam[channel] = param;
+                        }
+                    }
+                }
+            }
+
+            // Channels without any edges (such as in an empty glyph) are outside
+            float* pixel = &field[(row * width + column) * 3];
+            for (int channel = 0; channel < 3; ++channel)
+            {
+                if (nearEdge[channel])
+                {
+                    toPseudoDistance(*nearEdge[channel], origin, nearParam[channel], &minDistance[channel]);
+                    pixel[channel] = (float)(sign * minDistance[channel].distance);
+                }
+                else
+                {
+                    pixel[channel] = -FLT_MAX;
+                }
+            }
+        }
+    }
+
+    // Pixels whose channels would interpolate into a false edge with a neighbour are
+    // replaced with their median.
+    std::vector<int> clashes;
+    for (int row = 0; row < height; ++row)
+    {
+        for (int column = 0; column < width; ++column)
+        {
+            const float* pixel = &field[(row * width + column) * 3];
+            if ((column > 0 && detectClash(pixel, pixel - 3)) ||
+                (column < width - 1 && detectClash(pixel, pixel + 3)) ||
+                (row > 0 && detectClash(pixel, pixel - width * 3)) ||
+                (row < height - 1 && detectClash(pixel, pixel + width * 3)))
+            {
+                clashes.push_back(row * width + column);
+            }
+        }
+    }
+    for (size_t i = 0, count = clashes.size(); i < count; ++i)
+    {
+        float* pixel = &field[clashes[i] * 3];
+        pixel[0] = pixel[1] = pixel[2] = median(pixel[0], pixel[1], pixel[2]);
+    }
+
+    for (int row = 0; row < height; ++row)
+    {
+        unsigned char* dst = image + ((y + row) * imageWidth + x) * 3;
+        const float* src = &field[row * width * 3];
+        for (int i = 0; i < width * 3; ++i)
+        {
+            float value = 128 + src[i] * MSDF_PIXEL_LEVELS;
+            if (value < 0)
+                value = 0;
+            if (value > 255)
+                value = 255;
+            dst[i] = (unsigned char)value;
+        }
+    }
+}
+
+}
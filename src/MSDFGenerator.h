@@ -0,0 +1,94 @@
+#ifndef MSDFGENERATOR_H_
+#define MSDFGENERATOR_H_
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_OUTLINE_H
+#include <vector>
+
+namespace gameplay
+{
+
+/**
+ * Generates multi-channel signed distance fields (MSDF) from glyph outlines.
+ *
+ * The edges of each contour are given one or two of the red, green and blue channels so
+ * that the edges meeting at a sharp corner never share all of their channels. Each channel
+ * then holds the signed distance to the nearest edge that has that channel, and the median
+ * of the three channels reproduces the corner exactly, where a single channel distance
+ * field would round it off.
+ *
+ * Based on the method described in "Shape Decomposition for Multi-channel Distance Fields"
+ * by Viktor Chlumsky.
+ */
+class MSDFGenerator
+{
+public:
+
+    /**
+     * A point on an outline, in pixels.
+     */
+    struct Point
+    {
+        double x;
+        double y;
+    };
+
+    /**
+     * An edge of an outline contour: a line (degree 1), quadratic (degree 2) or
+     * cubic (degree 3) Bezier curve, and the channels it contributes to.
+     */
+    struct Edge
+    {
+        int degree;
+        Point p[4];
+        int channels;
+    };
+
+    typedef std::vector<Edge> Contour;
+
+    /**
+     * Constructor.
+     */
+    MSDFGenerator();
+
+    /**
+     * Reads the contours of a glyph outline and assigns channels to their edges.
+     *
+     * @param outline The outline, in 26.6 fixed point pixels.
+     *
+     * @return True if successful, false if the outline could not be decomposed.
+     */
+    bool load(const FT_Outline* outline);
+
+    /**
+     * Generates the distance field into a region of an RGB image.
+     *
+     * @param image RGB image with 3 bytes per pixel.
+     * @param imageWidth Width of the image in pixels.
+     * @param x Left of the region in pixels.
+     * @param y Top of the region in pixels.
+     * @param width Width of the region in pixels.
+     * @param height Height of the region in pixels.
+     * @param originX Horizontal position of the outline origin in the image.
+     * @param originY Vertical position of the outline origin (the baseline) in the image.
+     */
+    void generate(unsigned char* image, unsigned int imageWidth, int x, int y, int width, int height, float originX, float originY) const;
+
+private:
+
+    static int moveTo(const FT_Vector* to, void* user);
+    static int lineTo(const FT_Vector* to, void* user);
+    static int conicTo(const FT_Vector* control, const FT_Vector* to, void* user);
+    static int cubicTo(const FT_Vector* control1, const FT_Vector* control2, const FT_Vector* to, void* user);
+
+    void assignChannels();
+
+    std::vector<Contour> _contours;
+    Point _position;
+    bool _reverse;
+};
+
+}
+
+#endif
@@ -1,12 +1,29 @@
 #include "NormalMapGenerator.h"
 #include "Image.h"
 #include "Base.h"
+#include "TaskScheduler.h"
+#include "PngWriter.h"
+
+// SSE2 is part of every x64 target, so it only needs to be detected for 32-bit builds
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define NORMALMAP_SIMD
+    #include <emmintrin.h>
+#endif
+
+// Number of consecutive rows calculated by a single task
+#define NORMALMAP_TASK_ROWS 16
+
+// Heightmaps with more pixels than this are always streamed (16384 x 16384)
+#define NORMALMAP_STREAMING_PIXELS 268435456LL
+
+// Read buffer size for RAW heightmaps
+#define NORMALMAP_READ_BUFFER_SIZE (1 << 20)
 
 namespace gameplay
 {
 
-NormalMapGenerator::NormalMapGenerator(const char* inputFile, const char* outputFile, int resolutionX, int resolutionY, const Vector3& worldSize)
-    : _inputFile(inputFile), _outputFile(outputFile), _resolutionX(resolutionX), _resolutionY(resolutionY), _worldSize(worldSize)
+NormalMapGenerator::NormalMapGenerator(const char* inputFile, const char* outputFile, int resolutionX, int resolutionY, const Vector3& worldSize, bool streaming)
+    : _inputFile(inputFile), _outputFile(outputFile), _resolutionX(resolutionX), _resolutionY(resolutionY), _worldSize(worldSize), _streaming(streaming)
 {
 }
 
@@ -30,34 +47,156 @@ bool equalsIgnoreCase(const std::string& s1, const std::string& s2)
     return true;
 }
 
-float getHeight(float* heights, int width, int height, int x, int y)
+/**
+ * Converts a normal component (-1 to 1) to an unsigned byte (0 to 255).
+ */
+inline unsigned char normalToByte(float n)
 {
-    if (x < 0)
-        x = 0;
-    else if (x >= width)
-        x = width-1;
-    if (y < 0)
-        y = 0;
-    else if (y >= height)
-        y = height-1;
-    return heights[y*width+x];
+    return (unsigned char)((n + 1.0f) * 0.5f * 255.0f);
+}
+
+/**
+ * Calculates the vertex normal at x by summing the normals of the triangles that share
+ * the vertex. This is used along the edges of the heightmap, where some of the triangles
+ * surrounding a vertex are missing.
+ *
+ * @param above Heights of the previous row, or NULL for the first row.
+ * @param row Heights of the row containing the vertex.
+ * @param below Heights of the next row, or NULL for the last row.
+ */
+void calculateEdgeNormal(const float* above, const float* row, const float* below, int width, int x, float scaleX, float scaleZ, Vector3* normal)
+{
+    // Each cell is split into two triangles from its bottom left to its top right corner,
+    // see the note in NormalMapGenerator::generate.
+    const float h = row[x];
+    const float y = scaleX * scaleZ;
+    normal->set(0, 0, 0);
+
+    if (x > 0)
+    {
+        if (above)
+        {
+            // Top left
+            normal->add(Vector3(-scaleZ * (h - row[x-1]), y, scaleX * (above[x] - h)));
+        }
+
+        if (below)
+        {
+            // Bottom left
+            normal->add(Vector3(scaleZ * (row[x-1] - h), y, scaleX * (row[x-1] - below[x-1])));
+            normal->add(Vector3(-scaleZ * (below[x] - below[x-1]), y, scaleX * (h - below[x])));
+        }
+    }
+
+    if (x < width - 1)
+    {
+        if (above)
+        {
+            // Top right
+            normal->add(Vector3(scaleZ * (above[x] - above[x+1]), y, scaleX * (above[x] - h)));
+            normal->add(Vector3(-scaleZ * (row[x+1] - h), y, scaleX * (above[x+1] - row[x+1])));
+        }
+
+        if (below)
+        {
+            // Bottom right
+            normal->add(Vector3(scaleZ * (h - row[x+1]), y, scaleX * (h - below[x])));
+        }
+    }
+
+    normal->normalize();
 }
 
-void calculateNormal(
-    float x1, float y1, float z1,
-    float x2, float y2, float z2,
-    float x3, float y3, float z3,
-    Vector3* normal)
+/**
+ * Calculates the normals for a row of the heightmap and stores them as RGB bytes.
+ *
+ * Interior vertices are shared by six triangles of equal area, so the sum of their face
+ * normals reduces to a closed form over the 3x3 neighbourhood of heights around the
+ * vertex, which is evaluated four vertices at a time when SIMD is available.
+ *
+ * @param above Heights of the previous row, or NULL for the first row.
+ * @param row Heights of the row to calculate normals for.
+ * @param below Heights of the next row, or NULL for the last row.
+ * @param pixels Receives width RGB pixels.
+ */
+void calculateNormalRow(const float* above, const float* row, const float* below, int width, float scaleX, float scaleZ, unsigned char* pixels)
 {
-    Vector3 E(x1, y1, z1);
-    Vector3 F(x2, y2, z2);
-    Vector3 G(x3, y3, z3);
+    Vector3 normal;
+    if (above == NULL || below == NULL)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            calculateEdgeNormal(above, row, below, width, x, scaleX, scaleZ, &normal);
+            pixels[x*3] = normalToByte(normal.x);
+            pixels[x*3+1] = normalToByte(normal.y);
+            pixels[x*3+2] = normalToByte(normal.z);
+        }
+        return;
+    }
 
-    Vector3 P, Q;
-    Vector3::subtract(F, E, &P);
-    Vector3::subtract(G, E, &Q);
+    calculateEdgeNormal(above, row, below, width, 0, scaleX, scaleZ, &normal);
+    pixels[0] = normalToByte(normal.x);
+    pixels[1] = normalToByte(normal.y);
+    pixels[2] = normalToByte(normal.z);
+
+    const float normalY = 6.0f * scaleX * scaleZ;
+    int x = 1;
+
+#ifdef NORMALMAP_SIMD
+    const __m128 sx = _mm_set1_ps(scaleX);
+    const __m128 sz = _mm_set1_ps(scaleZ);
+    const __m128 ny = _mm_set1_ps(normalY);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    int r[4], g[4], b[4];
+    for (; x + 4 < width; x += 4)
+    {
+        __m128 left = _mm_loadu_ps(row + x - 1);
+        __m128 right = _mm_loadu_ps(row + x + 1);
+        __m128 top = _mm_loadu_ps(above + x);
+        __m128 topRight = _mm_loadu_ps(above + x + 1);
+        __m128 bottom = _mm_loadu_ps(below + x);
+        __m128 bottomLeft = _mm_loadu_ps(below + x - 1);
+
+        // Same operation order as the scalar loop below, so both give identical results
+        __m128 nx = _mm_mul_ps(sz, _mm_add_ps(_mm_add_ps(_mm_mul_ps(two, _mm_sub_ps(left, right)), _mm_sub_ps(bottomLeft, bottom)), _mm_sub_ps(top, topRight)));
+        __m128 nz = _mm_mul_ps(sx, _mm_add_ps(_mm_add_ps(_mm_mul_ps(two, _mm_sub_ps(top, bottom)), _mm_sub_ps(left, bottomLeft)), _mm_sub_ps(topRight, right)));
+        __m128 n = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz))));
+
+        _mm_storeu_si128((__m128i*)r, _mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(nx, n), one), half), scale)));
+        _mm_storeu_si128((__m128i*)g, _mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(ny, n), one), half), scale)));
+        _mm_storeu_si128((__m128i*)b, _mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(nz, n), one), half), scale)));
+        for (int i = 0; i < 4; ++i)
+        {
+            unsigned char* pixel = pixels + (x + i) * 3;
+            pixel[0] = (unsigned char)r[i];
+            pixel[1] = (unsigned char)g[i];
+            pixel[2] = (unsigned char)b[i];
+        }
+    }
+#endif
+
+    for (; x < width - 1; ++x)
+    {
+        float nx = scaleZ * (2.0f * (row[x-1] - row[x+1]) + (below[x-1] - below[x]) + (above[x] - above[x+1]));
+        float nz = scaleX * (2.0f * (above[x] - below[x]) + (row[x-1] - below[x-1]) + (above[x+1] - row[x+1]));
+        float n = 1.0f / sqrt(nx * nx + normalY * normalY + nz * nz);
+
+        unsigned char* pixel = pixels + x * 3;
+        pixel[0] = normalToByte(nx * n);
+        pixel[1] = normalToByte(normalY * n);
+        pixel[2] = normalToByte(nz * n);
+    }
 
-    Vector3::cross(Q, P, normal);
+    if (width > 1)
+    {
+        calculateEdgeNormal(above, row, below, width, width - 1, scaleX, scaleZ, &normal);
+        pixels[(width-1)*3] = normalToByte(normal.x);
+        pixels[(width-1)*3+1] = normalToByte(normal.y);
+        pixels[(width-1)*3+2] = normalToByte(normal.z);
+    }
 }
 
 float normalizedHeightPacked(float r, float g, float b)
@@ -70,124 +209,281 @@ float normalizedHeightPacked(float r, float g, float b)
     return (256.0f*r + g + 0.00390625f*b) / 65536.0f;
 }
 
-void NormalMapGenerator::generate()
+/**
+ * Returns the size of an open file in bytes, which may exceed 2GB for large RAW heightmaps.
+ */
+long long getFileSize(FILE* fp)
 {
-    // Load the input heightmap
-    float* heights = NULL;
-    size_t pos = _inputFile.find_last_of('.');
-    std::string ext = pos == std::string::npos ? "" : _inputFile.substr(pos, _inputFile.size()-pos);
-    if (equalsIgnoreCase(ext, ".png"))
+#ifdef WIN32
+    _fseeki64(fp, 0, SEEK_END);
+    long long size = _ftelli64(fp);
+    _fseeki64(fp, 0, SEEK_SET);
+#else
+    fseeko(fp, 0, SEEK_END);
+    long long size = ftello(fp);
+    fseeko(fp, 0, SEEK_SET);
+#endif
+    return size;
+}
+
+/**
+ * Reads a PNG or RAW heightmap one row at a time, so that the whole heightmap never
+ * has to be held in memory.
+ */
+class HeightmapReader
+{
+public:
+
+    HeightmapReader() : _fp(NULL), _png(NULL), _info(NULL), _width(0), _height(0), _bytesPerSample(0), _channels(0), _interlaced(NULL), _row(0)
+    {
+    }
+
+    ~HeightmapReader()
+    {
+        close();
+    }
+
+    /**
+     * Opens a heightmap for reading.
+     *
+     * @param path PNG or RAW heightmap file.
+     * @param width Width of the heightmap. Required for RAW files, set to the image width for PNG files.
+     * @param height Height of the heightmap. Required for RAW files, set to the image height for PNG files.
+     *
+     * @return True if the heightmap was opened, false if there was an error (which is logged).
+     */
+    bool open(const std::string& path, int* width, int* height)
     {
-        // Load heights from PNG image
-        Image* image = Image::create(_inputFile.c_str());
-        if (image == NULL)
+        size_t pos = path.find_last_of('.');
+        std::string ext = pos == std::string::npos ? "" : path.substr(pos, path.size()-pos);
+        if (equalsIgnoreCase(ext, ".png"))
         {
-            LOG(1, "Failed to load input heightmap PNG: %s.\n", _inputFile.c_str());
-            return;
+            if (!openPng(path.c_str()))
+                return false;
+            *width = _width;
+            *height = _height;
         }
-
-        _resolutionX = image->getWidth();
-        _resolutionY = image->getHeight();
-        int size = _resolutionX * _resolutionY;
-        heights = new float[size];
-        unsigned char* data = (unsigned char*)image->getData();
-        for (int i = 0; i < size; ++i)
+        else if (equalsIgnoreCase(ext, ".raw"))
         {
-            switch (image->getFormat())
+            if (*width <= 0 || *height <= 0)
             {
-            case Image::LUMINANCE:
-                heights[i] = data[i] / 255.0f;
-                break;
-            case Image::RGB:
-            case Image::RGBA:
-                {
-                    int pos = i * image->getBpp();
-                    heights[i] = normalizedHeightPacked(data[pos], data[pos+1], data[pos+2]);
-                }
-                break;
-            default:
-                heights[i] = 0.0f;
-                break;
+                LOG(1, "Missing resolution argument - must be explicitly specified for RAW heightmap files: %s.\n", path.c_str());
+                return false;
             }
-            heights[i] = heights[i] * _worldSize.y;
+            _width = *width;
+            _height = *height;
+            if (!openRaw(path.c_str()))
+                return false;
+        }
+        else
+        {
+            LOG(1, "Unsupported input heightmap file (must be a valid PNG or RAW file: %s.\n", path.c_str());
+            return false;
         }
-        SAFE_DELETE(image);
+
+        _rowBytes.resize((size_t)_width * _bytesPerSample * _channels);
+        return true;
     }
-    else if (equalsIgnoreCase(ext, ".raw"))
+
+    /**
+     * Reads the next row of heights, scaled from 0-1 to 0-scale.
+     *
+     * @return True if the row was read, false if there was an error (which is logged).
+     */
+    bool readRow(float* heights, float scale)
     {
-        // Load heights from RAW 8 or 16-bit file
-        if (_resolutionX <= 0 || _resolutionY <= 0)
+        const unsigned char* data = &_rowBytes[0];
+        if (_png)
         {
-            LOG(1, "Missing resolution argument - must be explicitly specified for RAW heightmap files: %s.\n", _inputFile.c_str());
-            return;
+            if (_interlaced)
+                data = _interlaced + (size_t)_row * _rowBytes.size();
+            else
+                png_read_row(_png, &_rowBytes[0], NULL);
         }
+        else if (fread(&_rowBytes[0], 1, _rowBytes.size(), _fp) != _rowBytes.size())
+        {
+            LOG(1, "Failed to read bytes from input file.\n");
+            return false;
+        }
+        ++_row;
 
-        // Read all data from file
-        FILE* fp = fopen(_inputFile.c_str(), "rb");
-        if (fp == NULL)
+        if (_png && _bytesPerSample == 2)
         {
-            LOG(1, "Failed to open input file: %s.\n", _inputFile.c_str());
-            return;
+            // 16-bit grayscale PNG (0-65535, big-endian)
+            for (int x = 0; x < _width; ++x)
+                heights[x] = ((data[x*2] << 8 | data[x*2+1]) / 65535.0f) * scale;
+        }
+        else if (_png && _channels >= 3)
+        {
+            // Packed RGB(A) PNG
+            for (int x = 0; x < _width; ++x)
+            {
+                const unsigned char* pixel = data + x * _channels;
+                heights[x] = normalizedHeightPacked(pixel[0], pixel[1], pixel[2]) * scale;
+            }
+        }
+        else if (_bytesPerSample == 4)
+        {
+            // 32-bit little-endian float (0-1)
+            for (int x = 0; x < _width; ++x)
+            {
+                unsigned int value = data[x*4] | (unsigned int)data[x*4+1] << 8 | (unsigned int)data[x*4+2] << 16 | (unsigned int)data[x*4+3] << 24;
+                float h;
+                memcpy(&h, &value, sizeof(float));
+                heights[x] = h * scale;
+            }
+        }
+        else if (_bytesPerSample == 2)
+        {
+            // 16-bit RAW (0-65535, little-endian)
+            for (int x = 0; x < _width; ++x)
+                heights[x] = ((data[x*2] | (int)data[x*2+1] << 8) / 65535.0f) * scale;
+        }
+        else
+        {
+            // 8-bit grayscale PNG or RAW (0-255), ignoring any alpha channel
+            for (int x = 0; x < _width; ++x)
+                heights[x] = (data[x * _channels] / 255.0f) * scale;
         }
 
-        fseek(fp, 0, SEEK_END);
-        long fileSize = ftell(fp);
-        fseek(fp, 0, SEEK_SET);
+        return true;
+    }
 
-        unsigned char* data = new unsigned char[fileSize];
-        if (fread(data, 1, fileSize, fp) != (size_t)fileSize)
+    void close()
+    {
+        if (_png)
         {
-            fclose(fp);
-            delete[] data;
-            LOG(1, "Failed to read bytes from input file: %s.\n", _inputFile.c_str());
-            return;
+            png_destroy_read_struct(&_png, &_info, NULL);
+            _png = NULL;
+            _info = NULL;
+        }
+        if (_fp)
+        {
+            fclose(_fp);
+            _fp = NULL;
         }
-        fclose(fp);
+        delete[] _interlaced;
+        _interlaced = NULL;
+    }
+
+private:
 
-        // Determine if the RAW file is 8-bit or 16-bit based on file size.
-        int bits = (fileSize / (_resolutionX * _resolutionY)) * 8;
-        if (bits != 8 && bits != 16)
+    bool openPng(const char* path)
+    {
+        _fp = fopen(path, "rb");
+        if (_fp == NULL)
         {
-            LOG(1, "Invalid RAW file - must be 8-bit or 16-bit, but found neither: %s.", _inputFile.c_str());
-            delete[] data;
-            return;
+            LOG(1, "Failed to load input heightmap PNG: %s.\n", path);
+            return false;
         }
 
-        int size = _resolutionX * _resolutionY;
-        heights = new float[size];
-        if (bits == 16)
+        unsigned char sig[8];
+        if (fread(sig, 1, 8, _fp) != 8 || png_sig_cmp(sig, 0, 8) != 0)
         {
-            // 16-bit (0-65535)
-            int idx;
-            for (unsigned int y = 0, i = 0; y < (unsigned int)_resolutionY; ++y)
-            {
-                for (unsigned int x = 0; x < (unsigned int)_resolutionX; ++x, ++i)
-                {
-                    idx = (y * _resolutionX + x) << 1;
-                    heights[i] = ((data[idx] | (int)data[idx+1] << 8) / 65535.0f) * _worldSize.y;
-                }
-            }
+            LOG(1, "Failed to load input heightmap PNG: %s.\n", path);
+            return false;
+        }
+
+        _png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        _info = _png ? png_create_info_struct(_png) : NULL;
+        if (_info == NULL)
+        {
+            LOG(1, "Failed to load input heightmap PNG: %s.\n", path);
+            return false;
+        }
+
+        png_init_io(_png, _fp);
+        png_set_sig_bytes(_png, 8);
+        png_read_info(_png, _info);
+
+        _width = png_get_image_width(_png, _info);
+        _height = png_get_image_height(_png, _info);
+
+        // 16-bit grayscale is kept at full precision, everything else is reduced to 8 bits
+        // per channel like Image does, so packed RGB heightmaps decode the same way.
+        if (png_get_bit_depth(_png, _info) == 16 && png_get_color_type(_png, _info) == PNG_COLOR_TYPE_GRAY)
+        {
+            _bytesPerSample = 2;
         }
         else
         {
-            // 8-bit (0-255)
-            for (unsigned int y = 0, i = 0; y < (unsigned int)_resolutionY; ++y)
-            {
-                for (unsigned int x = 0; x < (unsigned int)_resolutionX; ++x, ++i)
-                {
-                    heights[i] = (data[y * _resolutionX + x] / 255.0f) * _worldSize.y;
-                }
-            }
+            png_set_strip_16(_png);
+            png_set_packing(_png);
+            png_set_expand(_png);
+            _bytesPerSample = 1;
         }
+        png_read_update_info(_png, _info);
+        _channels = png_get_channels(_png, _info);
 
-        delete[] data;
+        // Interlaced rows can only be assembled once every pass has been read
+        if (png_get_interlace_type(_png, _info) != PNG_INTERLACE_NONE)
+        {
+            LOG(2, "Warning: %s is interlaced and must be decoded entirely into memory.\n", path);
+            size_t rowBytes = (size_t)_width * _bytesPerSample * _channels;
+            _interlaced = new unsigned char[rowBytes * _height];
+            std::vector<png_bytep> rows(_height);
+            for (int y = 0; y < _height; ++y)
+                rows[y] = _interlaced + y * rowBytes;
+            png_read_image(_png, &rows[0]);
+        }
+
+        return true;
     }
-    else
+
+    bool openRaw(const char* path)
     {
-        LOG(1, "Unsupported input heightmap file (must be a valid PNG or RAW file: %s.\n", _inputFile.c_str());
-        return;
+        _fp = fopen(path, "rb");
+        if (_fp == NULL)
+        {
+            LOG(1, "Failed to open input file: %s.\n", path);
+            return false;
+        }
+
+        // Determine if the RAW file is 8-bit, 16-bit or 32-bit based on file size.
+        _bytesPerSample = (int)(getFileSize(_fp) / ((long long)_width * _height));
+        if (_bytesPerSample != 1 && _bytesPerSample != 2 && _bytesPerSample != 4)
+        {
+            LOG(1, "Invalid RAW file - must be 8-bit, 16-bit or 32-bit, but found none of these: %s.", path);
+            return false;
+        }
+        _channels = 1;
+
+        // Read ahead in large blocks rather than a row at a time
+        setvbuf(_fp, NULL, _IOFBF, NORMALMAP_READ_BUFFER_SIZE);
+
+        return true;
     }
 
+    FILE* _fp;
+    png_structp _png;
+    png_infop _info;
+    int _width;
+    int _height;
+    int _bytesPerSample;
+    int _channels;
+    unsigned char* _interlaced;
+    int _row;
+    std::vector<unsigned char> _rowBytes;
+};
+
+/**
+ * Reports normal map progress when the percentage changes.
+ */
+void reportNormalMapProgress(std::atomic<int>* processedRows, int rowCount, int height)
+{
+    int processed = *processedRows += rowCount;
+    int percent = (int)(((float)processed / height) * 100.0f);
+    if (percent != (int)(((float)(processed - rowCount) / height) * 100.0f))
+        LOG(1, "\rCalculating normals... %d%%", percent);
+}
+
+void NormalMapGenerator::generate()
+{
+    // Open the input heightmap
+    HeightmapReader reader;
+    if (!reader.open(_inputFile, &_resolutionX, &_resolutionY))
+        return;
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
     //
     // NOTE: This method assumes the heightmap geometry is generated as follows.
@@ -202,128 +498,94 @@ void NormalMapGenerator::generate()
     //
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
-    struct NormalPixel
-    {
-        unsigned char r, g, b;
-    };
-    NormalPixel* normalPixels = new NormalPixel[_resolutionX * _resolutionY];
+    const int width = _resolutionX;
+    const int height = _resolutionY;
+    const float scaleX = _worldSize.x / (width - 1);
+    const float scaleZ = _worldSize.z / (height - 1);
+    std::atomic<int> processedRows(0);
 
-    struct Face
+    // Heightmaps too large to hold in memory are always streamed
+    if (_streaming || (long long)width * height > NORMALMAP_STREAMING_PIXELS)
     {
-        Vector3 normal1;
-        Vector3 normal2;
-    };
-
-    int progressMax = (_resolutionX-1) * (_resolutionY-1) + _resolutionX * _resolutionY;
-    int progress = 0;
+        PngWriter writer;
+        if (!writer.open(_outputFile.c_str(), width, height, 3))
+            return;
 
-    Vector2 scale(_worldSize.x / (_resolutionX-1), _worldSize.z / (_resolutionY-1));
+        LOG(2, "Streaming normal map generation in bands of %d rows.\n", NORMALMAP_TASK_ROWS);
+        LOG(1, "Calculating normals... 0%%");
 
-    // First calculate all face normals for the heightmap
-    LOG(1, "Calculating normals... 0%%");
-    Face* faceNormals = new Face[(_resolutionX - 1) * (_resolutionY - 1)];
-    Vector3 v1, v2;
-    for (int z = 0; z < _resolutionY-1; z++)
-    {
-        for (int x = 0; x < _resolutionX-1; x++)
+        // Only a band of rows is held at a time, plus the rows on either side of it
+        // (window row 0 holds the row above the band).
+        std::vector<float> window((size_t)(NORMALMAP_TASK_ROWS + 2) * width);
+        std::vector<unsigned char> pixels((size_t)NORMALMAP_TASK_ROWS * width * 3);
+        int nextRow = 0;
+        for (int firstRow = 0; firstRow < height; firstRow += NORMALMAP_TASK_ROWS)
         {
-            float topLeftHeight = getHeight(heights, _resolutionX, _resolutionY, x, z);
-            float bottomLeftHeight = getHeight(heights, _resolutionX, _resolutionY, x, z + 1);
-            float bottomRightHeight = getHeight(heights, _resolutionX, _resolutionY, x + 1, z + 1);
-            float topRightHeight = getHeight(heights, _resolutionX, _resolutionY, x + 1, z);
-
-            // Triangle 1
-            calculateNormal(
-                (float)x*scale.x, bottomLeftHeight, (float)(z + 1)*scale.y,
-                (float)x*scale.x, topLeftHeight, (float)z*scale.y,
-                (float)(x + 1)*scale.x, topRightHeight, (float)z*scale.y,
-                &faceNormals[z*(_resolutionX-1)+x].normal1);
-
-            // Triangle 2
-            calculateNormal(
-                (float)x*scale.x, bottomLeftHeight, (float)(z + 1)*scale.y,
-                (float)(x + 1)*scale.x, topRightHeight, (float)z*scale.y,
-                (float)(x + 1)*scale.x, bottomRightHeight, (float)(z + 1)*scale.y,
-                &faceNormals[z*(_resolutionX-1)+x].normal2);
-
-            ++progress;
-            LOG(1, "\rCalculating normals... %d%%", (int)(((float)progress / progressMax) * 100));
-        }
-    }
+            int lastRow = min(firstRow + NORMALMAP_TASK_ROWS, height);
 
-    // Free height array
-    delete[] heights;
-    heights = NULL;
+            // Read up to and including the row below the band
+            for (; nextRow <= min(lastRow, height - 1); ++nextRow)
+            {
+                if (!reader.readRow(&window[(size_t)(nextRow - firstRow + 1) * width], _worldSize.y))
+                    return;
+            }
 
-    // Smooth normals by taking an average for each vertex
-    Vector3 normal;
-    for (int z = 0; z < _resolutionY; z++)
+            TaskScheduler::getInstance()->parallelFor(firstRow, lastRow, [&](int z)
+            {
+                const float* row = &window[(size_t)(z - firstRow + 1) * width];
+                calculateNormalRow(z > 0 ? row - width : NULL, row, z < height - 1 ? row + width : NULL, width, scaleX, scaleZ, &pixels[(size_t)(z - firstRow) * width * 3]);
+            });
+            writer.writeRows(&pixels[0], lastRow - firstRow);
+            reportNormalMapProgress(&processedRows, lastRow - firstRow, height);
+
+            // The last row of the band and the row below it start the next window
+            if (lastRow < height)
+                memmove(&window[0], &window[(size_t)(lastRow - firstRow) * width], (size_t)width * 2 * sizeof(float));
+        }
+        writer.close();
+        LOG(1, "\rCalculating normals... Done.\n");
+    }
+    else
     {
-        for (int x = 0; x < _resolutionX; x++)
+        // Load all heights
+        float* heights = new float[(size_t)width * height];
+        for (int z = 0; z < height; ++z)
         {
-            // Reset normal sum
-            normal.set(0, 0, 0);
-
-            if (x > 0)
+            if (!reader.readRow(heights + (size_t)z * width, _worldSize.y))
             {
-                if (z > 0)
-                {
-                    // Top left
-                    normal.add(faceNormals[(z-1)*(_resolutionX-1) + (x-1)].normal2);
-                }
-
-                if (z < (_resolutionY - 1))
-                {
-                    // Bottom left
-                    normal.add(faceNormals[z*(_resolutionX-1) + (x - 1)].normal1);
-                    normal.add(faceNormals[z*(_resolutionX-1) + (x - 1)].normal2);
-                }
+                delete[] heights;
+                return;
             }
+        }
+        reader.close();
+
+        // Calculate normals straight into the output image, a band of rows per task
+        Image* normalMap = Image::create(Image::RGB, width, height);
+        unsigned char* pixels = (unsigned char*)normalMap->getData();
 
-            if (x < (_resolutionX - 1))
+        LOG(1, "Calculating normals... 0%%");
+        TaskScheduler::getInstance()->parallelFor(0, (height + NORMALMAP_TASK_ROWS - 1) / NORMALMAP_TASK_ROWS, [&](int task)
+        {
+            int firstRow = task * NORMALMAP_TASK_ROWS;
+            int lastRow = min(firstRow + NORMALMAP_TASK_ROWS, height);
+            for (int z = firstRow; z < lastRow; ++z)
             {
-                if (z > 0)
-                {
-                    // Top right
-                    normal.add(faceNormals[(z-1)*(_resolutionX-1) + x].normal1);
-                    normal.add(faceNormals[(z-1)*(_resolutionX-1) + x].normal2);
-                }
-
-                if (z < (_resolutionY - 1))
-                {
-                    // Bottom right
-                    normal.add(faceNormals[z*(_resolutionX-1) + x].normal1);
-                }
+                const float* row = heights + (size_t)z * width;
+                calculateNormalRow(z > 0 ? row - width : NULL, row, z < height - 1 ? row + width : NULL, width, scaleX, scaleZ, pixels + (size_t)z * width * 3);
             }
+            reportNormalMapProgress(&processedRows, lastRow - firstRow, height);
+        });
+        LOG(1, "\rCalculating normals... Done.\n");
 
-            // We don't have to worry about weighting the normals by
-            // the surface area of the triangles since a heightmap 
-            // guarantees that all triangles have the same surface area.
-            normal.normalize();
-
-            // Store this vertex normal
-            NormalPixel& pixel = normalPixels[z*_resolutionX + x];
-            pixel.r = (unsigned char)((normal.x + 1.0f) * 0.5f * 255.0f);
-            pixel.g = (unsigned char)((normal.y + 1.0f) * 0.5f * 255.0f);
-            pixel.b = (unsigned char)((normal.z + 1.0f) * 0.5f * 255.0f);
+        // Free height array
+        delete[] heights;
+        heights = NULL;
 
-            ++progress;
-            LOG(1, "\rCalculating normals... %d%%", (int)(((float)progress / progressMax) * 100));
-        }
+        normalMap->save(_outputFile.c_str());
+        SAFE_DELETE(normalMap);
     }
 
-    LOG(1, "\rCalculating normals... Done.\n");
-
-    // Create and save an image for the normal map
-    Image* normalMap = Image::create(Image::RGB, _resolutionX, _resolutionY);
-    normalMap->setData(normalPixels);
-    normalMap->save(_outputFile.c_str());
-
     LOG(1, "Normal map saved to '%s'.\n", _outputFile.c_str());
-
-    // Free temp data
-    delete[] normalPixels;
-    normalPixels = NULL;
 }
 
 }
@@ -11,7 +11,13 @@ class NormalMapGenerator
 
 public:
 
-    NormalMapGenerator(const char* inputFile, const char* outputFile, int resolutionX, int resolutionY, const Vector3& worldSize);
+    /**
+     * Constructor.
+     *
+     * @param streaming Generate the normal map a band of rows at a time, without holding the
+     *        whole heightmap or normal map in memory. Very large heightmaps are always streamed.
+     */
+    NormalMapGenerator(const char* inputFile, const char* outputFile, int resolutionX, int resolutionY, const Vector3& worldSize, bool streaming = false);
     ~NormalMapGenerator();
 
     void generate();
@@ -27,6 +33,7 @@ private:
     int _resolutionX;
     int _resolutionY;
     Vector3 _worldSize;
+    bool _streaming;
 
 };
 
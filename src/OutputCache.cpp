@@ -0,0 +1,634 @@
+#include "Base.h"
+#include "OutputCache.h"
+#include "EncoderArguments.h"
+#include "GPBFile.h"
+#include "JobContext.h"
+#include "json.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <tinyxml2.h>
+
+#if defined(WIN32)
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#elif defined(__APPLE__)
+#include <mach-o/dyld.h>
+#include <unistd.h>
+#else
+#include <unistd.h>
+#endif
+
+// Changes whenever the key or the layout of cache entries changes
+#define CACHE_FORMAT "gameplay-encoder output cache 1"
+
+using nlohmann::json;
+
+namespace gameplay
+{
+
+static std::mutex __recordedOutputsMutex;
+static std::vector<std::string> __recordedOutputs;
+
+// Options that change how an encode runs but not what it writes. Each takes one value.
+static const char* __neutralOptions[] =
+{
+    "-v", "-threads", "-cache", "-ca", "-batch", "-bt", "-batchReport", "-br", "-server", "-sv"
+};
+
+/**
+ * SHA-256 (FIPS 180-4).
+ */
+class Sha256
+{
+public:
+
+    Sha256() :
+        _length(0), _bufferLength(0)
+    {
+        static const unsigned int initial[8] =
+        {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        memcpy(_state, initial, sizeof(_state));
+    }
+
+    void update(const void* data, size_t length)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+        _length += length;
+        while (length > 0)
+        {
+            size_t count = min(length, sizeof(_buffer) - _bufferLength);
+            memcpy(_buffer + _bufferLength, bytes, count);
+            _bufferLength += count;
+            bytes += count;
+            length -= count;
+            if (_bufferLength == sizeof(_buffer))
+            {
+                transform(_buffer);
+                _bufferLength = 0;
+            }
+        }
+    }
+
+    // Adds a string with its length, so consecutive strings can't run into each other
+    void update(const std::string& value)
+    {
+        unsigned long long length = value.length();
+        update(&length, sizeof(length));
+        update(value.data(), value.length());
+    }
+
+    std::string finish()
+    {
+        unsigned long long bits = (unsigned long long)_length * 8;
+        unsigned char padding[72] = { 0x80 };
+        size_t paddingLength = (_bufferLength < 56 ? 56 : 120) - _bufferLength;
+        update(padding, paddingLength);
+        unsigned char length[8];
+        for (int i = 0; i < 8; ++i)
+            length[i] = (unsigned char)(bits >> (56 - i * 8));
+        update(length, 8);
+
+        std::string digest;
+        for (int i = 0; i < 8; ++i)
+        {
+            char word[9];
+            sprintf(word, "%08x", _state[i]);
+            digest += word;
+        }
+        return digest;
+    }
+
+private:
+
+    static unsigned int rotate(unsigned int value, int count)
+    {
+        return (value >> count) | (value << (32 - count));
+    }
+
+    void transform(const unsigned char* block)
+    {
+        static const unsigned int k[64] =
+        {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        unsigned int w[64];
+        for (int i = 0; i < 16; ++i)
+            w[i] = (block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+        for (int i = 16; i < 64; ++i)
+        {
+            unsigned int s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            unsigned int s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        unsigned int a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+        unsigned int e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+        for (int i = 0; i < 64; ++i)
+        {
+            unsigned int t1 = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            unsigned int t2 = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        _state[0] += a;
+        _state[1] += b;
+        _state[2] += c;
+        _state[3] += d;
+        _state[4] += e;
+        _state[5] += f;
+        _state[6] += g;
+        _state[7] += h;
+    }
+
+    unsigned int _state[8];
+    unsigned long long _length;
+    unsigned char _buffer[64];
+    size_t _bufferLength;
+};
+
+// Size of the blocks files are copied and hashed in, so large outputs such as tiled
+// heightmaps never have to fit in memory
+#define COPY_BLOCK_SIZE 65536
+
+static bool readFile(const std::string& path, std::string* data)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+
+    data->clear();
+    char buffer[COPY_BLOCK_SIZE];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        data->append(buffer, count);
+    bool read = ferror(fp) == 0;
+    fclose(fp);
+    return read;
+}
+
+static bool getFileSize(const std::string& path, unsigned long long* size)
+{
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0)
+        return false;
+    *size = (unsigned long long)status.st_size;
+    return true;
+}
+
+// Copies exactly size bytes from one file to another
+static bool copyBlocks(FILE* source, FILE* destination, unsigned long long size)
+{
+    char buffer[COPY_BLOCK_SIZE];
+    while (size > 0)
+    {
+        size_t count = (size_t)min(size, (unsigned long long)sizeof(buffer));
+        if (fread(buffer, 1, count, source) != count || fwrite(buffer, 1, count, destination) != count)
+            return false;
+        size -= count;
+    }
+    return true;
+}
+
+// Hashes a file the same way as Sha256::update(const std::string&) hashes its contents
+static bool hashFile(const std::string& path, Sha256* hash)
+{
+    unsigned long long size;
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == NULL || !getFileSize(path, &size))
+    {
+        if (fp)
+            fclose(fp);
+        return false;
+    }
+
+    hash->update(&size, sizeof(size));
+    char buffer[COPY_BLOCK_SIZE];
+    unsigned long long read = 0;
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    {
+        hash->update(buffer, count);
+        read += count;
+    }
+    bool hashed = ferror(fp) == 0 && read == size;
+    fclose(fp);
+    return hashed;
+}
+
+// Reads a line without its line break
+static bool readLine(FILE* fp, std::string* line)
+{
+    line->clear();
+    int c;
+    while ((c = fgetc(fp)) != EOF && c != '\n')
+        *line += (char)c;
+    return c == '\n';
+}
+
+// Gives a file written under a name of its own its final name
+static bool replaceFile(const std::string& temporaryPath, const std::string& path)
+{
+#ifdef WIN32
+    // rename() doesn't replace existing files on Windows
+    remove(path.c_str());
+#endif
+    return rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+static std::string getTemporarySuffix()
+{
+    static std::atomic<unsigned int> __temporaryCount(0);
+    char suffix[64];
+#ifdef WIN32
+    sprintf(suffix, ".%d.%u.tmp", _getpid(), __temporaryCount++);
+#else
+    sprintf(suffix, ".%d.%u.tmp", (int)getpid(), __temporaryCount++);
+#endif
+    return suffix;
+}
+
+static std::string getDirectory(const std::string& path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+static void makeDirectory(const std::string& path)
+{
+#ifdef WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0777);
+#endif
+}
+
+// The encoder build is identified by its executable's size and modification time, so
+// rebuilding the encoder invalidates everything it cached.
+static bool getEncoderBuild(std::string* build)
+{
+    char path[4096];
+#if defined(WIN32)
+    DWORD length = GetModuleFileNameA(NULL, path, sizeof(path));
+    if (length == 0 || length == sizeof(path))
+        return false;
+#elif defined(__APPLE__)
+    uint32_t size = sizeof(path);
+    if (_NSGetExecutablePath(path, &size) != 0)
+        return false;
+#else
+    strcpy(path, "/proc/self/exe");
+#endif
+    struct stat status;
+    if (stat(path, &status) != 0)
+        return false;
+
+    char text[64];
+    sprintf(text, "%lld %lld", (long long)status.st_size, (long long)status.st_mtime);
+    *build = text;
+    return true;
+}
+
+// Adds the external tilesets of a TMX map, and the images of the map and its tilesets.
+// The encoder looks for all of them relative to the map.
+static bool addTmxReferences(const tinyxml2::XMLElement* element, const std::string& directory, std::vector<std::string>* files)
+{
+    for (; element; element = element->NextSiblingElement())
+    {
+        const char* source = element->Attribute("source");
+        if (source && strcmp(element->Name(), "image") == 0)
+        {
+            files->push_back(directory + source);
+        }
+        else if (source && strcmp(element->Name(), "tileset") == 0)
+        {
+            std::string path = directory + source;
+            tinyxml2::XMLDocument tileset;
+            if (tileset.LoadFile(path.c_str()) != tinyxml2::XML_NO_ERROR || !addTmxReferences(tileset.RootElement(), directory, files))
+                return false;
+            files->push_back(path);
+        }
+        if (!addTmxReferences(element->FirstChildElement(), directory, files))
+            return false;
+    }
+    return true;
+}
+
+// Adds the buffers and images of a glTF file that aren't embedded in it
+static bool addGltfReferences(const std::string& text, const std::string& directory, std::vector<std::string>* files)
+{
+    json document = json::parse(text, NULL, false);
+    if (document.is_discarded() || !document.is_object())
+        return false;
+
+    const char* arrays[] = { "buffers", "images" };
+    for (size_t i = 0; i < 2; ++i)
+    {
+        if (!document.contains(arrays[i]) || !document[arrays[i]].is_array())
+            continue;
+
+        const json& items = document[arrays[i]];
+        for (size_t j = 0, count = items.size(); j < count; ++j)
+        {
+            if (!items[j].is_object() || !items[j].contains("uri") || !items[j]["uri"].is_string())
+                continue;
+            std::string uri = items[j]["uri"].get<std::string>();
+            if (uri.compare(0, 5, "data:") != 0)
+                files->push_back(directory + uri);
+        }
+    }
+    return true;
+}
+
+// Reads the JSON chunk of a binary glTF file
+static bool readGlbJson(const std::string& path, std::string* text)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+
+    unsigned char header[20];
+    bool valid = fread(header, 1, sizeof(header), fp) == sizeof(header) &&
+        memcmp(header, "glTF", 4) == 0 && memcmp(header + 16, "JSON", 4) == 0;
+    if (valid)
+    {
+        size_t length = header[12] | (header[13] << 8) | (header[14] << 16) | ((size_t)header[15] << 24);
+        text->resize(length);
+        valid = length == 0 || fread(&(*text)[0], 1, length, fp) == length;
+    }
+    fclose(fp);
+    return valid;
+}
+
+OutputCache::OutputCache(const std::string& directory) :
+    _directory(directory)
+{
+    if (!_directory.empty() && _directory.find_last_of("/\\") != _directory.length() - 1)
+        _directory += '/';
+}
+
+OutputCache::~OutputCache()
+{
+}
+
+bool OutputCache::computeKey(const EncoderArguments& arguments, std::string* key) const
+{
+    // Decoding only prints the file
+    EncoderArguments::FileFormat format = arguments.getFileFormat();
+    if (format == EncoderArguments::FILEFORMAT_GPB || format == EncoderArguments::FILEFORMAT_UNKNOWN)
+        return false;
+
+    std::string build;
+    if (!getEncoderBuild(&build))
+    {
+        LOG(2, "The encoder executable could not be found, outputs are not cached.\n");
+        return false;
+    }
+
+    Sha256 hash;
+    hash.update(std::string(CACHE_FORMAT));
+    hash.update(build);
+    hash.update(std::string((const char*)GPB_VERSION, 2));
+
+    const std::vector<std::string>& options = arguments.getOptions();
+    for (size_t i = 0, count = options.size(); i < count; ++i)
+    {
+        bool neutral = false;
+        for (size_t j = 0; j < sizeof(__neutralOptions) / sizeof(__neutralOptions[0]) && !neutral; ++j)
+            neutral = options[i] == __neutralOptions[j];
+        if (neutral)
+            ++i;
+        else
+            hash.update(options[i]);
+    }
+    hash.update(arguments.getFilePath());
+    hash.update(arguments.getOutputFilePath());
+
+    if (!hashFile(arguments.getFilePath(), &hash))
+        return false;
+
+    // The files the input refers to
+    std::vector<std::string> files;
+    std::string directory = getDirectory(arguments.getFilePath());
+    std::string text;
+    switch (format)
+    {
+    case EncoderArguments::FILEFORMAT_TMX:
+        {
+            tinyxml2::XMLDocument document;
+            if (document.LoadFile(arguments.getFilePath().c_str()) != tinyxml2::XML_NO_ERROR ||
+                !addTmxReferences(document.RootElement(), directory, &files))
+                return false;
+            break;
+        }
+    case EncoderArguments::FILEFORMAT_GLTF:
+        if (!readFile(arguments.getFilePath(), &text) || !addGltfReferences(text, directory, &files))
+            return false;
+        break;
+    case EncoderArguments::FILEFORMAT_GLB:
+        if (!readGlbJson(arguments.getFilePath(), &text) || !addGltfReferences(text, directory, &files))
+            return false;
+        break;
+    case EncoderArguments::FILEFORMAT_TTF:
+    case EncoderArguments::FILEFORMAT_OTF:
+        if (!arguments.getFontCharsetFile().empty())
+            files.push_back(arguments.getFontCharsetFile());
+        break;
+    default:
+        break;
+    }
+
+    for (size_t i = 0, count = files.size(); i < count; ++i)
+    {
+        hash.update(files[i]);
+        if (!hashFile(files[i], &hash))
+        {
+            LOG(2, "Not caching the outputs of %s, %s could not be read.\n", arguments.getFilePath().c_str(), files[i].c_str());
+            return false;
+        }
+    }
+
+    *key = hash.finish();
+    return true;
+}
+
+bool OutputCache::restore(const std::string& key) const
+{
+    std::string path = getEntryPath(key);
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+
+    // Each output is copied to a file of its own first, and only given its name once the
+    // whole entry has been read, so a damaged entry doesn't overwrite any outputs
+    std::vector<std::pair<std::string, std::string> > outputs;
+    std::string line;
+    unsigned int count = 0;
+    bool valid = readLine(fp, &line) && line == CACHE_FORMAT && readLine(fp, &line) && sscanf(line.c_str(), "%u", &count) == 1;
+    bool written = true;
+    for (unsigned int i = 0; valid && written && i < count; ++i)
+    {
+        std::string outputPath;
+        unsigned long long size = 0;
+        valid = readLine(fp, &outputPath) && readLine(fp, &line) && sscanf(line.c_str(), "%llu", &size) == 1;
+        if (!valid)
+            break;
+
+        std::string temporaryPath = outputPath + getTemporarySuffix();
+        FILE* output = fopen(temporaryPath.c_str(), "wb");
+        if (output == NULL)
+        {
+            LOG(1, "Error: Failed to write cached output: %s\n", outputPath.c_str());
+            written = false;
+            break;
+        }
+        outputs.push_back(std::make_pair(outputPath, temporaryPath));
+
+        char buffer[COPY_BLOCK_SIZE];
+        while (valid && written && size > 0)
+        {
+            size_t blockSize = (size_t)min(size, (unsigned long long)sizeof(buffer));
+            valid = fread(buffer, 1, blockSize, fp) == blockSize;
+            written = !valid || fwrite(buffer, 1, blockSize, output) == blockSize;
+            size -= blockSize;
+        }
+        written = fclose(output) == 0 && written;
+        if (!written)
+            LOG(1, "Error: Failed to write cached output: %s\n", outputPath.c_str());
+    }
+    valid = valid && (!written || fgetc(fp) == EOF);
+    fclose(fp);
+
+    if (!valid)
+        LOG(1, "Warning: Ignoring damaged cache entry: %s\n", path.c_str());
+    for (size_t i = 0, outputCount = outputs.size(); i < outputCount; ++i)
+    {
+        if (valid && written && !replaceFile(outputs[i].second, outputs[i].first))
+        {
+            LOG(1, "Error: Failed to write cached output: %s\n", outputs[i].first.c_str());
+            written = false;
+        }
+        if (valid && written)
+            recordOutput(outputs[i].first);
+        else
+            remove(outputs[i].second.c_str());
+    }
+    return valid && written;
+}
+
+bool OutputCache::store(const std::string& key, const std::vector<std::string>& outputs) const
+{
+    // Files written more than once are stored once, as they are now
+    std::vector<std::string> paths;
+    for (size_t i = 0, count = outputs.size(); i < count; ++i)
+    {
+        if (std::find(paths.begin(), paths.end(), outputs[i]) == paths.end())
+            paths.push_back(outputs[i]);
+    }
+    for (size_t i = 0, count = paths.size(); i < count; ++i)
+    {
+        if (paths[i].find('\n') != std::string::npos)
+            return false;
+    }
+
+    // Write the entry under a name of its own and rename it into place, so an entry is
+    // either complete or missing even when several encoders share the cache. Outputs are
+    // copied into it a block at a time.
+    std::string path = getEntryPath(key);
+    makeDirectory(_directory);
+    makeDirectory(getDirectory(path));
+    std::string temporaryPath = path + getTemporarySuffix();
+    FILE* fp = fopen(temporaryPath.c_str(), "wb");
+    if (fp == NULL)
+    {
+        LOG(1, "Warning: Failed to write cache entry: %s\n", temporaryPath.c_str());
+        return false;
+    }
+
+    bool stored = fprintf(fp, "%s\n%u\n", CACHE_FORMAT, (unsigned int)paths.size()) > 0;
+    for (size_t i = 0, count = paths.size(); stored && i < count; ++i)
+    {
+        // The size is written ahead of the data, so the output must not change while it
+        // is copied
+        unsigned long long size;
+        FILE* output = fopen(paths[i].c_str(), "rb");
+        stored = output != NULL && getFileSize(paths[i], &size) &&
+            fprintf(fp, "%s\n%llu\n", paths[i].c_str(), size) > 0 &&
+            copyBlocks(output, fp, size) && fgetc(output) == EOF;
+        if (output)
+            fclose(output);
+    }
+    stored = fclose(fp) == 0 && stored;
+
+    if (!stored)
+    {
+        LOG(1, "Warning: Failed to write cache entry: %s\n", temporaryPath.c_str());
+        remove(temporaryPath.c_str());
+        return false;
+    }
+    if (!replaceFile(temporaryPath, path))
+    {
+        // Another encoder may have stored the same entry first
+        remove(temporaryPath.c_str());
+    }
+    return true;
+}
+
+std::string OutputCache::getEntryPath(const std::string& key) const
+{
+    return _directory + key.substr(0, 2) + "/" + key;
+}
+
+void OutputCache::recordOutput(const std::string& path)
+{
+    if (JobContext* context = JobContext::getCurrent())
+    {
+        context->addOutput(path);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(__recordedOutputsMutex);
+        __recordedOutputs.push_back(path);
+    }
+}
+
+std::vector<std::string> OutputCache::getRecordedOutputs()
+{
+    if (JobContext* context = JobContext::getCurrent())
+        return context->getOutputs();
+
+    std::lock_guard<std::mutex> lock(__recordedOutputsMutex);
+    return __recordedOutputs;
+}
+
+void OutputCache::clearRecordedOutputs()
+{
+    if (JobContext* context = JobContext::getCurrent())
+    {
+        context->clearOutputs();
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(__recordedOutputsMutex);
+        __recordedOutputs.clear();
+    }
+}
+
+}
@@ -0,0 +1,105 @@
+#ifndef OUTPUTCACHE_H_
+#define OUTPUTCACHE_H_
+
+#include <string>
+#include <vector>
+
+namespace gameplay
+{
+
+class EncoderArguments;
+
+/**
+ * An on-disk cache of encoder outputs, so files that haven't changed since they were last
+ * encoded are not encoded again.
+ *
+ * Each encode is identified by a SHA-256 key over everything that determines its
+ * outputs: the bytes of the input file and of the files it references (the tilesets and
+ * images of a TMX map, the buffers and images of a glTF file, a font's character set
+ * file), the options it was given other than those that only affect how it runs (such
+ * as -v and -threads), the input and output paths, and the encoder build, identified by
+ * the size and modification time of its executable.
+ *
+ * The files an encode writes are recorded as they are written (see recordOutput()) and
+ * stored together in a single entry named after the key. A later encode with the same
+ * key copies them back to where they were written instead of encoding. Entries are
+ * written to a temporary file and renamed into place, so processes sharing a cache never
+ * see half written entries.
+ */
+class OutputCache
+{
+public:
+
+    /**
+     * Constructor.
+     *
+     * @param directory The cache directory. It is created when the first entry is stored.
+     */
+    OutputCache(const std::string& directory);
+
+    /**
+     * Destructor.
+     */
+    ~OutputCache();
+
+    /**
+     * Computes the cache key of an encode.
+     *
+     * @param arguments The arguments of the encode.
+     * @param key Set to the key, as a hexadecimal string.
+     *
+     * @return True if successful, false if the encode can't be cached, such as when one of
+     *         the files it reads can't be.
+     */
+    bool computeKey(const EncoderArguments& arguments, std::string* key) const;
+
+    /**
+     * Writes the outputs of a cached encode.
+     *
+     * @return True if the key was in the cache and all of its outputs were written.
+     */
+    bool restore(const std::string& key) const;
+
+    /**
+     * Stores the outputs of an encode.
+     *
+     * @param key The key of the encode.
+     * @param outputs The files the encode wrote.
+     *
+     * @return True if successful, false if the outputs could not be read or the entry
+     *         could not be written.
+     */
+    bool store(const std::string& key, const std::vector<std::string>& outputs) const;
+
+    /**
+     * Records a file written by the encoder. Every file an encode writes must be
+     * recorded for its outputs to be cached.
+     *
+     * Files are recorded in the current JobContext, or for the whole process when there
+     * is none.
+     */
+    static void recordOutput(const std::string& path);
+
+    /**
+     * Returns the files recorded since they were last cleared.
+     */
+    static std::vector<std::string> getRecordedOutputs();
+
+    /**
+     * Forgets the files recorded so far.
+     */
+    static void clearRecordedOutputs();
+
+private:
+
+    OutputCache(const OutputCache&);
+    OutputCache& operator=(const OutputCache&);
+
+    std::string getEntryPath(const std::string& key) const;
+
+    std::string _directory;
+};
+
+}
+
+#endif
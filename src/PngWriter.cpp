@@ -0,0 +1,361 @@
+#include "Base.h"
+#include "PngWriter.h"
+#include "EncoderArguments.h"
+#include "TaskScheduler.h"
+#include "OutputCache.h"
+#include <atomic>
+#include <zlib.h>
+
+// Amount of filtered image data compressed by a single task
+#define PNG_BAND_SIZE (256 * 1024)
+
+// Size of the deflate window, and so of the preset dictionary given to each band
+#define PNG_WINDOW_SIZE 32768
+
+namespace gameplay
+{
+
+/**
+ * Writes a 32-bit value in big-endian byte order, as used throughout PNG files.
+ */
+void writeBigEndian(unsigned char* data, unsigned long value)
+{
+    data[0] = (unsigned char)((value >> 24) & 0xff);
+    data[1] = (unsigned char)((value >> 16) & 0xff);
+    data[2] = (unsigned char)((value >> 8) & 0xff);
+    data[3] = (unsigned char)(value & 0xff);
+}
+
+/**
+ * Returns the Paeth predictor for a byte, given its left, upper and upper left neighbours.
+ */
+inline int paethPredictor(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+/**
+ * Filters a row, writing the filter type byte followed by the filtered bytes to output.
+ *
+ * When adaptive, all five filters are tried and the one with the smallest sum of absolute
+ * differences (treating filtered bytes as signed) is used, which is the heuristic libpng
+ * uses. Otherwise the row is stored unfiltered.
+ *
+ * @param row Row to filter.
+ * @param prior Unfiltered row above it (all zeros for the first row of the image).
+ * @param scratch rowBytes bytes of scratch space.
+ */
+void filterRow(const unsigned char* row, const unsigned char* prior, size_t rowBytes, unsigned int pixelBytes, bool adaptive, unsigned char* output, unsigned char* scratch)
+{
+    output[0] = 0;
+    memcpy(output + 1, row, rowBytes);
+    if (!adaptive)
+        return;
+
+    unsigned long bestSum = 0;
+    for (size_t i = 0; i < rowBytes; ++i)
+        bestSum += row[i] < 128 ? row[i] : 256 - row[i];
+
+    for (unsigned char type = 1; type <= 4; ++type)
+    {
+        unsigned long sum = 0;
+        for (size_t i = 0; i < rowBytes; ++i)
+        {
+            int left = i >= pixelBytes ? row[i - pixelBytes] : 0;
+            int upperLeft = i >= pixelBytes ? prior[i - pixelBytes] : 0;
+            int predictor;
+            switch (type)
+            {
+            case 1:
+                predictor = left;
+                break;
+            case 2:
+                predictor = prior[i];
+                break;
+            case 3:
+                predictor = (left + prior[i]) >> 1;
+                break;
+            default:
+                predictor = paethPredictor(left, prior[i], upperLeft);
+                break;
+            }
+            unsigned char value = (unsigned char)(row[i] - predictor);
+            scratch[i] = value;
+            sum += value < 128 ? value : 256 - value;
+        }
+
+        if (sum < bestSum)
+        {
+            bestSum = sum;
+            output[0] = type;
+            memcpy(output + 1, scratch, rowBytes);
+        }
+    }
+}
+
+/**
+ * Compresses a band of filtered data as a raw deflate stream.
+ *
+ * Bands other than the last end with a sync flush, which byte aligns the output without
+ * ending the stream, so that the next band's output can follow on directly.
+ */
+bool deflateBand(const unsigned char* data, size_t length, const unsigned char* dictionary, size_t dictionaryLength, int level, bool finish, std::vector<unsigned char>* output)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    int strategy = level == 0 ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+    if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, strategy) != Z_OK)
+        return false;
+    if (dictionaryLength > 0 && deflateSetDictionary(&stream, dictionary, (uInt)dictionaryLength) != Z_OK)
+    {
+        deflateEnd(&stream);
+        return false;
+    }
+
+    // Leave room for the sync flush marker on top of the worst case expansion
+    output->resize(deflateBound(&stream, (uLong)length) + 16);
+    stream.next_in = const_cast<Bytef*>(data);
+    stream.avail_in = (uInt)length;
+    int flush = finish ? Z_FINISH : Z_SYNC_FLUSH;
+    for (;;)
+    {
+        stream.next_out = &(*output)[stream.total_out];
+        stream.avail_out = (uInt)(output->size() - stream.total_out);
+        int err = deflate(&stream, flush);
+        if (err == Z_STREAM_END || (err == Z_OK && !finish && stream.avail_in == 0 && stream.avail_out > 0))
+            break;
+        if (err != Z_OK && err != Z_BUF_ERROR)
+        {
+            deflateEnd(&stream);
+            return false;
+        }
+        output->resize(output->size() * 2);
+    }
+    output->resize(stream.total_out);
+    deflateEnd(&stream);
+
+    return true;
+}
+
+PngWriter::PngWriter() :
+    _fp(NULL), _height(0), _rowBytes(0), _pixelBytes(0), _rowsWritten(0), _level(Z_DEFAULT_COMPRESSION), _adler(1), _error(false)
+{
+}
+
+PngWriter::~PngWriter()
+{
+    if (_fp)
+        close();
+}
+
+bool PngWriter::write(const char* path, const unsigned char* data, unsigned int width, unsigned int height, unsigned int channels, unsigned int bitDepth)
+{
+    PngWriter writer;
+    if (!writer.open(path, width, height, channels, bitDepth))
+        return false;
+    writer.writeRows(data, height);
+    return writer.close();
+}
+
+bool PngWriter::open(const char* path, unsigned int width, unsigned int height, unsigned int channels, unsigned int bitDepth)
+{
+    static const unsigned char colorTypes[] = { 0, 0, 4, 2, 6 };
+    static const unsigned char signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+    if (channels < 1 || channels > 4 || (bitDepth != 8 && bitDepth != 16) || width == 0 || height == 0)
+    {
+        LOG(1, "Error: Unsupported PNG format: %s\n", path);
+        return false;
+    }
+
+    _fp = fopen(path, "wb");
+    if (_fp == NULL)
+    {
+        LOG(1, "Error: Failed to open image for writing: %s\n", path);
+        return false;
+    }
+    OutputCache::recordOutput(path);
+
+    _path = path;
+    _height = height;
+    _pixelBytes = channels * bitDepth / 8;
+    _rowBytes = (size_t)width * _pixelBytes;
+    _rowsWritten = 0;
+    _previousRow.assign(_rowBytes, 0);
+    _dictionary.clear();
+    _adler = adler32(0, NULL, 0);
+    _error = false;
+
+    EncoderArguments* arguments = EncoderArguments::getInstance();
+    _level = arguments ? arguments->getPngCompressionLevel() : Z_DEFAULT_COMPRESSION;
+
+    unsigned char header[13];
+    writeBigEndian(header, width);
+    writeBigEndian(header + 4, height);
+    header[8] = (unsigned char)bitDepth;
+    header[9] = colorTypes[channels];
+    header[10] = 0; // deflate
+    header[11] = 0; // adaptive filtering
+    header[12] = 0; // no interlacing
+
+    if (fwrite(signature, 1, sizeof(signature), _fp) != sizeof(signature) || !writeChunk("IHDR", header, sizeof(header)))
+        _error = true;
+
+    return !_error;
+}
+
+bool PngWriter::writeRows(const unsigned char* data, unsigned int rowCount)
+{
+    if (_fp == NULL || _error)
+        return false;
+    if (rowCount > _height - _rowsWritten)
+    {
+        LOG(1, "Error: Too many rows written to image: %s\n", _path.c_str());
+        _error = true;
+        return false;
+    }
+    if (rowCount == 0)
+        return true;
+
+    const size_t filteredRowBytes = _rowBytes + 1;
+    const unsigned int bandRows = (unsigned int)max((size_t)1, PNG_BAND_SIZE / filteredRowBytes);
+    const int bandCount = (int)((rowCount + bandRows - 1) / bandRows);
+    const bool finish = _rowsWritten + rowCount == _height;
+    TaskScheduler* scheduler = TaskScheduler::getInstance();
+
+    // Filter the rows. Filters only refer to the unfiltered row above, so bands of rows
+    // can be filtered independently.
+    std::vector<unsigned char> filtered(filteredRowBytes * rowCount);
+    scheduler->parallelFor(0, bandCount, [&](int band)
+    {
+        std::vector<unsigned char> scratch(_rowBytes);
+        unsigned int lastRow = min((band + 1) * bandRows, rowCount);
+        for (unsigned int y = band * bandRows; y < lastRow; ++y)
+        {
+            const unsigned char* prior = y > 0 ? data + (y - 1) * _rowBytes : &_previousRow[0];
+            filterRow(data + y * _rowBytes, prior, _rowBytes, _pixelBytes, _level != 0, &filtered[y * filteredRowBytes], &scratch[0]);
+        }
+    });
+
+    // Compress each band, primed with the filtered data that precedes it
+    std::vector<std::vector<unsigned char> > compressed(bandCount);
+    std::vector<unsigned long> adlers(bandCount);
+    std::atomic<bool> failed(false);
+    scheduler->parallelFor(0, bandCount, [&](int band)
+    {
+        size_t start = band * bandRows * filteredRowBytes;
+        size_t length = min((size_t)(band + 1) * bandRows * filteredRowBytes, filtered.size()) - start;
+        const unsigned char* dictionary = NULL;
+        size_t dictionaryLength = 0;
+        if (start > 0)
+        {
+            dictionaryLength = min(start, (size_t)PNG_WINDOW_SIZE);
+            dictionary = &filtered[start - dictionaryLength];
+        }
+        else if (!_dictionary.empty())
+        {
+            dictionaryLength = _dictionary.size();
+            dictionary = &_dictionary[0];
+        }
+
+        adlers[band] = adler32(adler32(0, NULL, 0), &filtered[start], (uInt)length);
+        if (!deflateBand(&filtered[start], length, dictionary, dictionaryLength, _level, finish && band == bandCount - 1, &compressed[band]))
+            failed = true;
+    });
+    if (failed)
+    {
+        LOG(1, "Error: Failed to compress image data: %s\n", _path.c_str());
+        _error = true;
+        return false;
+    }
+
+    // The zlib header goes at the start of the first chunk (deflate with a 32K window and
+    // the compression level hint).
+    if (_rowsWritten == 0)
+    {
+        unsigned char header[2] = { 0x78, 0 };
+        header[1] = (unsigned char)((_level < 0 || _level == 6) ? 2 : (_level <= 1 ? 0 : (_level <= 5 ? 1 : 3))) << 6;
+        header[1] += (unsigned char)(31 - ((header[0] * 256 + header[1]) % 31));
+        compressed[0].insert(compressed[0].begin(), header, header + 2);
+    }
+
+    for (int band = 0; band < bandCount; ++band)
+    {
+        size_t length = min((size_t)(band + 1) * bandRows, (size_t)rowCount) * filteredRowBytes - band * bandRows * filteredRowBytes;
+        _adler = adler32_combine(_adler, adlers[band], (z_off_t)length);
+        if (!writeChunk("IDAT", &compressed[band][0], compressed[band].size()))
+        {
+            _error = true;
+            return false;
+        }
+    }
+
+    // Keep what the next call needs: the last unfiltered row and the end of the filtered data
+    memcpy(&_previousRow[0], data + (size_t)(rowCount - 1) * _rowBytes, _rowBytes);
+    size_t tail = min(filtered.size(), (size_t)PNG_WINDOW_SIZE);
+    _dictionary.insert(_dictionary.end(), filtered.end() - tail, filtered.end());
+    if (_dictionary.size() > PNG_WINDOW_SIZE)
+        _dictionary.erase(_dictionary.begin(), _dictionary.end() - PNG_WINDOW_SIZE);
+
+    _rowsWritten += rowCount;
+    return true;
+}
+
+bool PngWriter::close()
+{
+    if (_fp == NULL)
+        return false;
+
+    bool result = !_error;
+    if (result && _rowsWritten != _height)
+    {
+        LOG(1, "Error: Image closed after %u of %u rows: %s\n", _rowsWritten, _height, _path.c_str());
+        result = false;
+    }
+    if (result)
+    {
+        // The stream ends with the Adler-32 checksum of the filtered data
+        unsigned char checksum[4];
+        writeBigEndian(checksum, _adler);
+        result = writeChunk("IDAT", checksum, sizeof(checksum)) && writeChunk("IEND", NULL, 0);
+    }
+
+    if (fclose(_fp) != 0 && result)
+    {
+        LOG(1, "Error: Failed to write image: %s\n", _path.c_str());
+        result = false;
+    }
+    _fp = NULL;
+    _error = !result;
+    return result;
+}
+
+bool PngWriter::writeChunk(const char* type, const unsigned char* data, size_t length)
+{
+    unsigned char header[8];
+    writeBigEndian(header, (unsigned long)length);
+    memcpy(header + 4, type, 4);
+
+    unsigned char crc[4];
+    unsigned long value = crc32(crc32(0, NULL, 0), header + 4, 4);
+    if (length > 0)
+        value = crc32(value, data, (uInt)length);
+    writeBigEndian(crc, value);
+
+    if (fwrite(header, 1, 8, _fp) != 8 ||
+        (length > 0 && fwrite(data, 1, length, _fp) != length) ||
+        fwrite(crc, 1, 4, _fp) != 4)
+    {
+        LOG(1, "Error: Failed to write image data: %s\n", _path.c_str());
+        return false;
+    }
+    return true;
+}
+
+}
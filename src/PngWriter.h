@@ -0,0 +1,96 @@
+#ifndef PNGWRITER_H_
+#define PNGWRITER_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace gameplay
+{
+
+/**
+ * Writes PNG images, compressing bands of rows in parallel.
+ *
+ * Each band of rows is filtered and deflated independently on the task scheduler and ends
+ * with a sync flush, so the compressed bands can simply be concatenated into IDAT chunks.
+ * Every band is primed with the end of the data before it as a preset dictionary, which
+ * keeps the compressed size close to that of a single deflate stream. Rows are filtered
+ * adaptively, using the filter with the smallest sum of absolute differences for each row.
+ *
+ * The compression level comes from the -pngLevel command line option.
+ */
+class PngWriter
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    PngWriter();
+
+    /**
+     * Destructor. Closes the file if it is still open.
+     */
+    ~PngWriter();
+
+    /**
+     * Writes an entire image.
+     *
+     * @param path Path to save to.
+     * @param data Rows of pixel data, with 16-bit samples in big-endian byte order.
+     * @param width Image width.
+     * @param height Image height.
+     * @param channels Number of channels: 1 (grayscale), 2 (grayscale and alpha), 3 (RGB) or 4 (RGBA).
+     * @param bitDepth Bits per channel, 8 or 16.
+     *
+     * @return True if the image was written, false if there was an error (which is logged).
+     */
+    static bool write(const char* path, const unsigned char* data, unsigned int width, unsigned int height, unsigned int channels, unsigned int bitDepth = 8);
+
+    /**
+     * Creates a PNG file whose rows are written incrementally with writeRows.
+     *
+     * @see write
+     */
+    bool open(const char* path, unsigned int width, unsigned int height, unsigned int channels, unsigned int bitDepth = 8);
+
+    /**
+     * Compresses and writes the next rows of the image.
+     *
+     * @param data Tightly packed rows of pixel data.
+     * @param rowCount Number of rows.
+     *
+     * @return True if the rows were written, false if there was an error (which is logged).
+     */
+    bool writeRows(const unsigned char* data, unsigned int rowCount);
+
+    /**
+     * Finishes writing the image and closes the file. All rows must have been written.
+     *
+     * @return True if the image was written, false if there was an error (which is logged).
+     */
+    bool close();
+
+private:
+
+    PngWriter(const PngWriter&);
+    PngWriter& operator=(const PngWriter&);
+
+    bool writeChunk(const char* type, const unsigned char* data, size_t length);
+
+    FILE* _fp;
+    std::string _path;
+    unsigned int _height;
+    size_t _rowBytes;
+    unsigned int _pixelBytes;
+    unsigned int _rowsWritten;
+    int _level;
+    std::vector<unsigned char> _previousRow;
+    std::vector<unsigned char> _dictionary;
+    unsigned long _adler;
+    bool _error;
+};
+
+}
+
+#endif
@@ -3,6 +3,10 @@
 #include <zlib.h>
 
 #include "TMXSceneEncoder.h"
+#include "TaskScheduler.h"
+#include "AtlasPacker.h"
+#include "ImageCache.h"
+#include "OutputCache.h"
 
 using namespace gameplay;
 using namespace tinyxml2;
@@ -16,12 +20,27 @@ using std::string;
 
 #define BUFFER_SIZE 256
 
+// Bytes of base64 decoded tile data handed to the inflater at a time
+#define TILE_DATA_CHUNK_SIZE 16384
+
+// Rows of a guttered tileset image built by each task
+#define GUTTER_TASK_ROWS 16
+
+// Largest width and height of a tileset atlas page
+#define TILE_ATLAS_PAGE_SIZE 4096
+
+// Transparent pixels between the tileset images in an atlas
+#define TILE_ATLAS_PADDING 2
+
+// Most rows a run-length encoded tileset spans, since each row has an entry in its row offsets
+#define TILE_RUN_MAX_ROWS 1048576
+
 #ifdef WIN32
 #define snprintf(s, n, fmt, ...) sprintf((s), (fmt), __VA_ARGS__)
 #endif
 
 TMXSceneEncoder::TMXSceneEncoder() :
-    _tabCount(0)
+    _tabCount(0), _tileEncoding(EncoderArguments::TILEENCODING_TILES)
 {
 }
 
@@ -51,18 +70,39 @@ void TMXSceneEncoder::write(const EncoderArguments& arguments)
     }
 
     // Apply a gutter, or skirt, around the tiles to prevent gaps
+    string imageDirectory = inputDirectory;
     if (arguments.generateTextureGutter())
     {
         LOG(2, "Bulding gutter tilesets.\n");
-        buildTileGutter(map, inputDirectory, arguments.getOutputDirPath());
+        if (buildTileGutter(map, inputDirectory, arguments.getOutputDirPath()))
+        {
+            imageDirectory = arguments.getOutputDirPath();
+        }
     }
 
     // Write the tile map
     string fileName = arguments.getFileName();
     int pos = fileName.find_last_of('.');
 
+    // Pack the tileset images into atlas pages, so layers that use several tilesets are drawn in fewer batches
+    if (arguments.generateTileAtlas())
+    {
+        LOG(2, "Building tileset atlas.\n");
+        buildTileAtlas(map, imageDirectory, arguments.getOutputDirPath(), (pos == -1 ? fileName : fileName.substr(0, pos)));
+    }
+
     LOG(2, "Writing .scene file.\n");
-    writeScene(map, arguments.getOutputFilePath(), (pos == -1 ? fileName : fileName.substr(0, pos)));
+    _tileEncoding = arguments.getTileEncoding();
+    string sceneName = (pos == -1 ? fileName : fileName.substr(0, pos));
+    unsigned int regionSize = arguments.getTileRegionSize();
+    writeScene(map, arguments.getOutputFilePath(), sceneName, arguments.getTileChunkSize(), regionSize == 0);
+
+    // Split the tile layers into region scenes the runtime can stream in and out
+    if (regionSize != 0)
+    {
+        LOG(2, "Writing region .scene files.\n");
+        writeRegionScenes(map, arguments.getOutputDirPath(), sceneName, regionSize, arguments.getTileChunkSize());
+    }
 }
 
 bool TMXSceneEncoder::parseTmx(const XMLDocument& xmlDoc, TMXMap& map, const string& inputDirectory) const
@@ -205,7 +245,7 @@ bool TMXSceneEncoder::parseTmx(const XMLDocument& xmlDoc, TMXMap& map, const str
                 return false;
             }
 
-            Image* img = Image::create(imageLocation.c_str());
+            Image* img = ImageCache::getInstance()->load(imageLocation);
             if (!img)
             {
                 LOG(1, "Could not load TileSet image. %s\n", imageLocation.c_str());
@@ -257,15 +297,13 @@ bool TMXSceneEncoder::parseTmx(const XMLDocument& xmlDoc, TMXMap& map, const str
         }
 
         // Load tiles
-        layer->setupTiles();
-        auto data = loadDataElement(xmlLayer->FirstChildElement("data"));
-        size_t dataSize = data.size();
-        for (int i = 0; i < dataSize; i++)
+        const XMLElement* xmlData = xmlLayer->FirstChildElement("data");
+        const XMLElement* xmlChunk = xmlData ? xmlData->FirstChildElement("chunk") : NULL;
+        if (!(xmlChunk ? loadChunks(xmlData, layer) : loadTiles(xmlData, layer)))
         {
-            //XXX this might depend on map's renderorder... not sure
-            unsigned int x = i % layer->getWidth();
-            unsigned int y = i / layer->getWidth();
-            layer->setTile(x, y, data[i]);
+            LOG(1, "Could not load the tiles of layer '%s'.\n", layer->getName().c_str());
+            SAFE_DELETE(layer);
+            return false;
         }
 
         // Save layer
@@ -349,105 +387,96 @@ void TMXSceneEncoder::parseBaseLayerProperties(const tinyxml2::XMLElement* xmlBa
     }
 }
 
-void TMXSceneEncoder::buildTileGutter(TMXMap& map, const string& inputDirectory, const string& outputDirectory)
+bool TMXSceneEncoder::buildTileGutter(TMXMap& map, const string& inputDirectory, const string& outputDirectory)
 {
-#define ACTUAL_ADJUST_TILESET(imgPath, spacing, margin) tileset.setImagePath((imgPath)); \
-    tileset.setSpacing(tileset.getSpacing() + (spacing), false); \
-    tileset.setMargin(tileset.getMargin() + (margin), false); \
+#define ADJUST_TILESET(imgPath) tileset.setImagePath((imgPath)); \
+    tileset.setSpacing(tileset.getSpacing() + 2, false); \
+    tileset.setMargin(tileset.getMargin() + 1, false); \
     tileset.setImageWidth(TMXTileSet::calculateImageDimension(tileset.getHorizontalTileCount(), tileset.getMaxTileWidth(), tileset.getSpacing(), tileset.getMargin())); \
     tileset.setImageHeight(TMXTileSet::calculateImageDimension(tileset.getVerticalTileCount(), tileset.getMaxTileHeight(), tileset.getSpacing(), tileset.getMargin()))
-#define ADJUST_TILESET(imgPath) ACTUAL_ADJUST_TILESET(imgPath, 2, 1)
-#define UNDO_ADJUST_TILESET(imgPath) ACTUAL_ADJUST_TILESET(imgPath, -2, -1)
 
-    std::unordered_map<std::string, std::string> processedFiles;
-    std::unordered_map<std::string, std::string> reverseLookupProcessedFiles;
+    // Tilesets that use the same image share its guttered image, so find the distinct images first
+    std::unordered_map<std::string, size_t> imageIndices;
+    std::vector<unsigned int> imageTilesets;
+    std::vector<string> inputFiles;
+    std::vector<string> outputPaths;
+    std::vector<string> outputFiles;
 
     unsigned int tilesetCount = map.getTileSetCount();
     for (unsigned int i = 0; i < tilesetCount; i++)
     {
-        TMXTileSet& tileset = map.getTileSet(i);
-
-        // See if the tileset was already processed. Then we can skip it
-        auto potentialEasyProcess = processedFiles.find(tileset.getImagePath());
-        if (potentialEasyProcess != processedFiles.end())
+        const string& imgPath = map.getTileSet(i).getImagePath();
+        if (imageIndices.find(imgPath) != imageIndices.end())
         {
-            ADJUST_TILESET(potentialEasyProcess->second);
             continue;
         }
+        imageIndices[imgPath] = imageTilesets.size();
+        imageTilesets.push_back(i);
 
-        // Process tileset
-        string orgImgPath = tileset.getImagePath();
-        string imgPath = orgImgPath;
-        string inputFile = buildFilePath(inputDirectory, imgPath);
+        string outputPath = imgPath;
         int pos = imgPath.find_last_of('.');
         if (pos == -1)
         {
-            imgPath = imgPath + "_guttered";
+            outputPath = imgPath + "_guttered";
         }
         else
         {
-            imgPath = imgPath.substr(0, pos) + "_guttered" + imgPath.substr(pos);
+            outputPath = imgPath.substr(0, pos) + "_guttered" + imgPath.substr(pos);
         }
-        string outputFile = buildFilePath(outputDirectory, imgPath);
+        inputFiles.push_back(buildFilePath(inputDirectory, imgPath));
+        outputPaths.push_back(outputPath);
+        outputFiles.push_back(buildFilePath(outputDirectory, outputPath));
+    }
 
-        if (buildTileGutterTileset(tileset, inputFile, outputFile))
+    // Each image is processed on its own, so build them all concurrently
+    size_t imageCount = imageTilesets.size();
+    std::vector<char> built(imageCount, 0);
+    TaskScheduler::TaskGroup group;
+    for (size_t i = 0; i < imageCount; i++)
+    {
+        group.run([this, &map, &imageTilesets, &inputFiles, &outputFiles, &built, i]()
         {
-            // Update tileset
-            ADJUST_TILESET(imgPath);
+            built[i] = buildTileGutterTileset(map.getTileSet(imageTilesets[i]), inputFiles[i], outputFiles[i]);
+        });
+    }
+    group.wait();
 
-            // Remember image paths
-            processedFiles[orgImgPath] = imgPath;
-            reverseLookupProcessedFiles[imgPath] = orgImgPath;
-        }
-        else
+    // Only switch to the guttered images if all of them were built
+    for (size_t i = 0; i < imageCount; i++)
+    {
+        if (!built[i])
         {
-            // Revert all processed tilemaps
-            for (unsigned int k = 0; k < i; k++)
+            for (size_t k = 0; k < imageCount; k++)
             {
-                tileset = map.getTileSet(k);
-
-                // Revert to original image and settings
-                orgImgPath = reverseLookupProcessedFiles[tileset.getImagePath()];
-                UNDO_ADJUST_TILESET(orgImgPath);
-
-                // Delete the processed image, if they exist
-                auto it = processedFiles.find(orgImgPath);
-                if (it != processedFiles.end())
+                if (built[k] && remove(outputFiles[k].c_str()) != 0)
                 {
-                    outputFile = buildFilePath(outputDirectory, it->second);
-                    if (remove(outputFile.c_str()) != 0)
-                    {
-                        LOG(3, "Could not remove '%s' during tileset revert.\n", outputFile.c_str());
-                    }
-                    processedFiles.erase(it);
+                    LOG(3, "Could not remove '%s' during tileset revert.\n", outputFiles[k].c_str());
                 }
             }
-            LOG(1, "Failed to process '%s'. Reverting all tileset gutters.\n", orgImgPath.c_str());
-            return;
+            LOG(1, "Failed to process '%s'. Reverting all tileset gutters.\n", map.getTileSet(imageTilesets[i]).getImagePath().c_str());
+            return false;
         }
     }
 
-#undef UNDO_ADJUST_TILESET
+    for (unsigned int i = 0; i < tilesetCount; i++)
+    {
+        TMXTileSet& tileset = map.getTileSet(i);
+        ADJUST_TILESET(outputPaths[imageIndices[tileset.getImagePath()]]);
+    }
+    return true;
+
 #undef ADJUST_TILESET
-#undef ACTUAL_ADJUST_TILESET
 }
 
 bool TMXSceneEncoder::buildTileGutterTileset(const TMXTileSet& tileset, const string& inputFile, const string& outputFile)
 {
-#define COPY_CONTENTS(sx, sy, dx, dy, w, h) copyImage(outputData, static_cast<unsigned char*>(inputImage->getData()), \
-    inputImageWidth, outputImageWidth, bpp, \
-    (sx), (sy), (dx), (dy), (w), (h))
-
     // Setup images
-    const Image* inputImage = Image::create(inputFile.c_str());
+    Image* inputImage = ImageCache::getInstance()->load(inputFile);
     if (!inputImage)
     {
         return false;
     }
 
-    unsigned int tilesetWidth = tileset.getHorizontalTileCount();
-    unsigned int tilesetHeight = tileset.getVerticalTileCount();
-    Vector2 tileSize = Vector2(tileset.getMaxTileWidth(), tileset.getMaxTileHeight());
     unsigned int bpp = 0;
     switch (inputImage->getFormat())
     {
@@ -462,112 +491,210 @@ bool TMXSceneEncoder::buildTileGutterTileset(const TMXTileSet& tileset, const st
             break;
         default:
             LOG(4, "Unknown image format. Possibly need update by developer.\n")
+            SAFE_DELETE(inputImage);
             return false;
     }
 
-    Image* outputImage = Image::create(inputImage->getFormat(),
-        TMXTileSet::calculateImageDimension(tilesetWidth, tileSize.x, tileset.getSpacing() + 2, tileset.getMargin() + 1),
-        TMXTileSet::calculateImageDimension(tilesetHeight, tileSize.y, tileset.getSpacing() + 2, tileset.getMargin() + 1));
-
     // Get a couple variables so we don't constantly call functions (they aren't inline)
+    unsigned int tilesetWidth = tileset.getHorizontalTileCount();
+    unsigned int tilesetHeight = tileset.getVerticalTileCount();
+    unsigned int tileWidth = tileset.getMaxTileWidth();
+    unsigned int tileHeight = tileset.getMaxTileHeight();
+    unsigned int tilesetSpacing = tileset.getSpacing();
+    unsigned int tilesetMargin = tileset.getMargin();
     unsigned int inputImageWidth = inputImage->getWidth();
     unsigned int inputImageHeight = inputImage->getHeight();
+
+    // The tile counts come from the map, so make sure the image really holds the tiles
+    if (tilesetWidth == 0 || tilesetHeight == 0 ||
+        TMXTileSet::calculateImageDimension(tilesetWidth, tileWidth, tilesetSpacing, tilesetMargin) - tilesetMargin > inputImageWidth ||
+        TMXTileSet::calculateImageDimension(tilesetHeight, tileHeight, tilesetSpacing, tilesetMargin) - tilesetMargin > inputImageHeight)
+    {
+        LOG(1, "Tileset image '%s' is smaller than its tiles.\n", inputFile.c_str());
+        SAFE_DELETE(inputImage);
+        return false;
+    }
+
+    Image* outputImage = Image::create(inputImage->getFormat(),
+        TMXTileSet::calculateImageDimension(tilesetWidth, tileWidth, tilesetSpacing + 2, tilesetMargin + 1),
+        TMXTileSet::calculateImageDimension(tilesetHeight, tileHeight, tilesetSpacing + 2, tilesetMargin + 1));
+
     unsigned int outputImageWidth = outputImage->getWidth();
-    unsigned int outputImageHeight = outputImage->getHeight();
+    const unsigned char* inputData = static_cast<const unsigned char*>(inputImage->getData());
     unsigned char* outputData = static_cast<unsigned char*>(outputImage->getData());
-    unsigned int tilesetSpacing = tileset.getSpacing();
-    unsigned int tilesetMargin = tileset.getMargin();
 
-    // Copy margin
-    if (tilesetMargin != 0)
+    // Build the output a row at a time, from the gutter above the first row of tiles to the
+    // gutter below the last. Each row of tiles is its row in the input image with the first
+    // and last rows repeated for the gutters above and below it, and each tile in a row is
+    // copied as one span with its edge pixels repeated for the gutters either side. The
+    // margin and spacing are left clear, since they are never sampled.
+    unsigned int outputRowPitch = tileHeight + tilesetSpacing + 2;
+    unsigned int rowCount = tilesetHeight * outputRowPitch - tilesetSpacing;
+    unsigned int tileSpan = tileWidth * bpp;
+    TaskScheduler::getInstance()->parallelFor(0, rowCount, [&](int row)
     {
-        // Horizontal
-        unsigned int avaliable = inputImageWidth;
-        unsigned int remaining = outputImageWidth;
-        unsigned int use = min(avaliable, remaining);
-
-        while (remaining > 0)
+        unsigned int tileY = row / outputRowPitch;
+        unsigned int tileRow = row % outputRowPitch;
+        if (tileRow > tileHeight + 1)
         {
-            // Top
-            COPY_CONTENTS(0, 0, outputImageWidth - remaining, 0, use, tilesetMargin);
+            return;
+        }
+        tileRow = tileRow == 0 ? 0 : min(tileRow - 1, tileHeight - 1);
 
-            // Bottom
-            COPY_CONTENTS(0, inputImageHeight - tilesetMargin - 1, outputImageWidth - remaining, outputImageHeight - tilesetMargin - 1, use, tilesetMargin);
+        const unsigned char* src = inputData + ((tilesetMargin + tileY * (tileHeight + tilesetSpacing) + tileRow) * inputImageWidth + tilesetMargin) * bpp;
+        unsigned char* dst = outputData + ((tilesetMargin + row) * outputImageWidth + tilesetMargin) * bpp;
+        for (unsigned int x = 0; x < tilesetWidth; x++)
+        {
+            memcpy(dst, src, bpp);
+            memcpy(dst + bpp, src, tileSpan);
+            memcpy(dst + bpp + tileSpan, src + tileSpan - bpp, bpp);
 
-            remaining -= use;
-            use = min(avaliable, remaining);
+            src += (tileWidth + tilesetSpacing) * bpp;
+            dst += (tileWidth + tilesetSpacing + 2) * bpp;
         }
+    }, GUTTER_TASK_ROWS);
 
-        // Vertical
-        avaliable = inputImageHeight;
-        remaining = outputImageHeight;
-        use = min(avaliable, remaining);
-
-        while (remaining > 0)
-        {
-            // Left
-            COPY_CONTENTS(0, 0, 0, outputImageHeight - remaining, tilesetMargin, use);
+    // Save and cleanup
+    outputImage->save(outputFile.c_str());
+    SAFE_DELETE(inputImage);
+    SAFE_DELETE(outputImage);
 
-            // Right
-            COPY_CONTENTS(inputImageWidth - tilesetMargin - 1, 0, inputImageWidth - tilesetMargin - 1, outputImageHeight - remaining, tilesetMargin, use);
+    return true;
+}
 
-            remaining -= use;
-            use = min(avaliable, remaining);
+bool TMXSceneEncoder::buildTileAtlas(TMXMap& map, const string& imageDirectory, const string& outputDirectory, const string& atlasName)
+{
+    // Tilesets that use the same image share its place in the atlas
+    std::unordered_map<std::string, size_t> imageIndices;
+    std::vector<string> imageFiles;
+    unsigned int tilesetCount = map.getTileSetCount();
+    for (unsigned int i = 0; i < tilesetCount; i++)
+    {
+        const string& imgPath = map.getTileSet(i).getImagePath();
+        if (imageIndices.find(imgPath) == imageIndices.end())
+        {
+            imageIndices[imgPath] = imageFiles.size();
+            imageFiles.push_back(buildFilePath(imageDirectory, imgPath));
         }
     }
+    if (imageFiles.size() < 2)
+    {
+        LOG(2, "The map uses a single tileset image, no atlas needed.\n");
+        return false;
+    }
 
-    // Copy the contents of each tile
-    for (unsigned int y = 0; y < tilesetHeight; y++)
+    // Load the images concurrently
+    size_t imageCount = imageFiles.size();
+    std::vector<Image*> images(imageCount, (Image*)NULL);
     {
-        for (unsigned int x = 0; x < tilesetWidth; x++)
+        TaskScheduler::TaskGroup group;
+        for (size_t i = 0; i < imageCount; i++)
         {
-            Vector2 src = TMXTileSet::calculateTileOrigin(Vector2(x, y), tileSize, tilesetSpacing, tilesetMargin);
-            Vector2 dst = TMXTileSet::calculateTileOrigin(Vector2(x, y), tileSize, tilesetSpacing + 2, tilesetMargin + 1);
+            group.run([&images, &imageFiles, i]()
+            {
+                images[i] = ImageCache::getInstance()->load(imageFiles[i]);
+            });
+        }
+        group.wait();
+    }
 
-            COPY_CONTENTS(src.x, src.y, dst.x, dst.y, tileSize.x, tileSize.y);
+    // Lay the images out over as few pages as they fit on, keeping a transparent border
+    // between them so tiles at the edge of one image don't bleed into the next
+    std::vector<AtlasPacker::Rect> rects(imageCount);
+    bool loaded = true;
+    for (size_t i = 0; i < imageCount; i++)
+    {
+        if (!images[i])
+        {
+            loaded = false;
+            continue;
         }
+        rects[i].width = images[i]->getWidth() + TILE_ATLAS_PADDING;
+        rects[i].height = images[i]->getHeight() + TILE_ATLAS_PADDING;
     }
-    
-    // Extend the edges of the tiles to produce the "gutter"
-    unsigned int gutterContents = outputImageHeight - ((tilesetMargin + 1) * 2);
-    for (unsigned int x = 0; x < tilesetWidth; x++)
+    unsigned int pageCount = 0;
+    if (!loaded || !AtlasPacker::packPages(rects, TILE_ATLAS_PAGE_SIZE, &pageCount))
     {
-        Vector2 pos = TMXTileSet::calculateTileOrigin(Vector2(x, 0), tileSize, tilesetSpacing + 2, tilesetMargin + 1);
-        
-        // Left
-        copyImage(outputData, outputData,
-            outputImageWidth, outputImageWidth, bpp,
-            pos.x, pos.y, pos.x - 1, pos.y, 1, gutterContents);
+        LOG(1, loaded ? "A tileset image is too large for an atlas page of %d. Not building the atlas.\n" : "Could not load the tileset images. Not building the atlas.\n", TILE_ATLAS_PAGE_SIZE);
+        for (size_t i = 0; i < imageCount; i++)
+        {
+            SAFE_DELETE(images[i]);
+        }
+        return false;
+    }
 
-        // Right
-        copyImage(outputData, outputData,
-            outputImageWidth, outputImageWidth, bpp,
-            pos.x + tileSize.x - 1, pos.y, pos.x + tileSize.x, pos.y, 1, gutterContents);
+    // Each page is only as large as the images on it
+    std::vector<unsigned int> pageWidths(pageCount, 1);
+    std::vector<unsigned int> pageHeights(pageCount, 1);
+    for (size_t i = 0; i < imageCount; i++)
+    {
+        pageWidths[rects[i].page] = max(pageWidths[rects[i].page], rects[i].x + images[i]->getWidth());
+        pageHeights[rects[i].page] = max(pageHeights[rects[i].page], rects[i].y + images[i]->getHeight());
     }
-    gutterContents = outputImageWidth - ((tilesetMargin + 1) * 2);
-    for (unsigned int y = 0; y < tilesetHeight; y++)
+
+    std::vector<string> pagePaths(pageCount);
+    std::vector<string> pageFiles(pageCount);
+    for (unsigned int page = 0; page < pageCount; page++)
+    {
+        char buffer[BUFFER_SIZE];
+        snprintf(buffer, BUFFER_SIZE, "%s_atlas_%u.png", atlasName.c_str(), page);
+        pagePaths[page] = buffer;
+        pageFiles[page] = buildFilePath(outputDirectory, pagePaths[page]);
+    }
+
+    // Build and save the pages concurrently, converting every image to RGBA
+    TaskScheduler::getInstance()->parallelFor(0, pageCount, [&](int page)
     {
-        Vector2 pos = TMXTileSet::calculateTileOrigin(Vector2(0, y), tileSize, tilesetSpacing + 2, tilesetMargin + 1);
+        Image* atlas = Image::create(Image::RGBA, pageWidths[page], pageHeights[page]);
+        unsigned char* atlasData = static_cast<unsigned char*>(atlas->getData());
+        for (size_t i = 0; i < imageCount; i++)
+        {
+            if (rects[i].page != (unsigned int)page)
+            {
+                continue;
+            }
 
-        // Top
-        copyImage(outputData, outputData,
-            outputImageWidth, outputImageWidth, bpp,
-            pos.x, pos.y, pos.x, pos.y - 1, gutterContents, 1);
+            const Image* image = images[i];
+            unsigned int width = image->getWidth();
+            unsigned int bpp = image->getBpp();
+            const unsigned char* src = static_cast<const unsigned char*>(image->getData());
+            for (unsigned int y = 0, height = image->getHeight(); y < height; y++)
+            {
+                unsigned char* dst = atlasData + ((rects[i].y + y) * pageWidths[page] + rects[i].x) * 4;
+                if (bpp == 4)
+                {
+                    memcpy(dst, src, width * 4);
+                    src += width * 4;
+                    continue;
+                }
+                for (unsigned int x = 0; x < width; x++, src += bpp, dst += 4)
+                {
+                    dst[0] = src[0];
+                    dst[1] = src[bpp == 3 ? 1 : 0];
+                    dst[2] = src[bpp == 3 ? 2 : 0];
+                    dst[3] = 255;
+                }
+            }
+        }
+        atlas->save(pageFiles[page].c_str());
+        SAFE_DELETE(atlas);
+    });
 
-        // Bottom
-        copyImage(outputData, outputData,
-            outputImageWidth, outputImageWidth, bpp,
-            pos.x, pos.y + tileSize.y - 1, pos.x, pos.y + tileSize.y, gutterContents, 1);
+    // Point the tilesets at their images within the atlas
+    for (unsigned int i = 0; i < tilesetCount; i++)
+    {
+        TMXTileSet& tileset = map.getTileSet(i);
+        const AtlasPacker::Rect& rect = rects[imageIndices[tileset.getImagePath()]];
+        tileset.setImagePath(pagePaths[rect.page]);
+        tileset.setImageOrigin(Vector2(static_cast<float>(rect.x), static_cast<float>(rect.y)));
     }
 
-    // Save and cleanup
-    outputImage->save(outputFile.c_str());
-    SAFE_DELETE(inputImage);
-    SAFE_DELETE(outputImage);
-
+    for (size_t i = 0; i < imageCount; i++)
+    {
+        SAFE_DELETE(images[i]);
+    }
+    LOG(2, "Packed %u tileset images into %u atlas pages.\n", (unsigned int)imageCount, pageCount);
     return true;
-
-#undef COPY_CONTENTS
 }
 
 //XXX could probably seperate the writing process to a seperate class (PropertyWriter...)
@@ -578,12 +705,13 @@ bool TMXSceneEncoder::buildTileGutterTileset(const TMXTileSet& tileset, const st
     writeLine(file, "}")
 #define WRITE_PROPERTY_BLOCK_VALUE(name, value) writeLine(file, string(name) + " = " + (value))
 #define WRITE_PROPERTY_DIRECT(value) writeLine(file, (value))
-#define WRITE_PROPERTY_NEWLINE() file << std::endl
+#define WRITE_PROPERTY_NEWLINE() file << '\n'
 
-void TMXSceneEncoder::writeScene(const TMXMap& map, const string& outputFilepath, const string& sceneName)
+void TMXSceneEncoder::writeScene(const TMXMap& map, const string& outputFilepath, const string& sceneName, unsigned int chunkSize, bool writeTileLayers)
 {
     // Prepare for writing the scene
     std::ofstream file(outputFilepath.c_str(), std::ofstream::out | std::ofstream::trunc);
+    OutputCache::recordOutput(outputFilepath);
 
     unsigned int layerCount = map.getLayerCount();
 
@@ -595,9 +723,13 @@ void TMXSceneEncoder::writeScene(const TMXMap& map, const string& outputFilepath
     {
         const TMXBaseLayer* layer = map.getLayer(i);
         TMXLayerType type = layer->getType();
-        if (type == TMXLayerType::NormalLayer)
+        if (type == TMXLayerType::NormalLayer && writeTileLayers)
         {
-            writeTileset(map, dynamic_cast<const TMXLayer*>(layer), file);
+            const TMXLayer* tileset = dynamic_cast<const TMXLayer*>(layer);
+            if (tileset && tileset->hasTiles())
+            {
+                writeTileset(map, tileset, 0, 0, tileset->getWidth(), tileset->getHeight(), chunkSize, file);
+            }
             WRITE_PROPERTY_NEWLINE();
         }
         else if (type == TMXLayerType::ImageLayer)
@@ -614,45 +746,288 @@ void TMXSceneEncoder::writeScene(const TMXMap& map, const string& outputFilepath
     file.close();
 }
 
+// Splits a map position, in tiles, into the region it's in
+static int getRegion(long long position, unsigned int regionSize)
+{
+    long long size = static_cast<long long>(regionSize);
+    return static_cast<int>(position >= 0 ? position / size : -((size - 1 - position) / size));
+}
+
+void TMXSceneEncoder::writeRegionScenes(const TMXMap& map, const string& outputDirectory, const string& sceneName, unsigned int regionSize, unsigned int chunkSize)
+{
+    // Find the regions the tile layers have tiles in, row by row. Layers of infinite maps can
+    // start at any position and have their tiles far apart, so only the areas of each layer
+    // that hold tiles are looked at, not every region between them.
+    std::vector<const TMXLayer*> layers;
+    std::set<std::pair<int, int> > cells;
+    for (unsigned int i = 0, layerCount = map.getLayerCount(); i < layerCount; i++)
+    {
+        const TMXBaseLayer* layer = map.getLayer(i);
+        const TMXLayer* tileset = layer->getType() == TMXLayerType::NormalLayer ? dynamic_cast<const TMXLayer*>(layer) : NULL;
+        if (!tileset || !tileset->hasTiles())
+        {
+            continue;
+        }
+        layers.push_back(tileset);
+
+        std::vector<TMXLayer::TileArea> areas = tileset->getTileAreas();
+        for (size_t j = 0, areaCount = areas.size(); j < areaCount; j++)
+        {
+            const TMXLayer::TileArea& area = areas[j];
+            long long left = static_cast<long long>(tileset->getOriginX()) + area.x;
+            long long top = static_cast<long long>(tileset->getOriginY()) + area.y;
+            for (int regionY = getRegion(top, regionSize), lastY = getRegion(top + area.height - 1, regionSize); regionY <= lastY; regionY++)
+            {
+                for (int regionX = getRegion(left, regionSize), lastX = getRegion(left + area.width - 1, regionSize); regionX <= lastX; regionX++)
+                {
+                    cells.insert(std::make_pair(regionY, regionX));
+                }
+            }
+        }
+    }
+
+    // Write the region scenes, only the regions with tiles are kept
+    std::vector<std::pair<int, int> > regions;
+    char buffer[BUFFER_SIZE];
+    for (std::set<std::pair<int, int> >::const_iterator it = cells.begin(); it != cells.end(); ++it)
+    {
+        int regionX = it->second;
+        int regionY = it->first;
+        snprintf(buffer, BUFFER_SIZE, "%s_%d_%d", sceneName.c_str(), regionX, regionY);
+        if (writeRegionScene(map, layers, static_cast<long long>(regionX) * regionSize, static_cast<long long>(regionY) * regionSize, regionSize, chunkSize,
+            outputDirectory + "/" + buffer + ".scene", buffer))
+        {
+            regions.push_back(std::make_pair(regionX, regionY));
+        }
+    }
+
+    // Write the index, with the bounds of each region in pixels
+    string indexPath = outputDirectory + "/" + sceneName + ".regions";
+    std::ofstream file(indexPath.c_str(), std::ofstream::out | std::ofstream::trunc);
+    OutputCache::recordOutput(indexPath);
+
+    unsigned int tileWidth = static_cast<unsigned int>(map.getTileWidth());
+    unsigned int tileHeight = static_cast<unsigned int>(map.getTileHeight());
+    WRITE_PROPERTY_BLOCK_START("regions " + sceneName);
+    snprintf(buffer, BUFFER_SIZE, "tileWidth = %u", tileWidth);
+    WRITE_PROPERTY_DIRECT(buffer);
+    snprintf(buffer, BUFFER_SIZE, "tileHeight = %u", tileHeight);
+    WRITE_PROPERTY_DIRECT(buffer);
+    snprintf(buffer, BUFFER_SIZE, "regionSize = %u", regionSize);
+    WRITE_PROPERTY_DIRECT(buffer);
+
+    for (size_t i = 0, count = regions.size(); i < count; i++)
+    {
+        int regionX = regions[i].first;
+        int regionY = regions[i].second;
+        WRITE_PROPERTY_NEWLINE();
+        WRITE_PROPERTY_BLOCK_START("region");
+        snprintf(buffer, BUFFER_SIZE, "cell = %d, %d", regionX, regionY);
+        WRITE_PROPERTY_DIRECT(buffer);
+        snprintf(buffer, BUFFER_SIZE, "path = %s_%d_%d.scene", sceneName.c_str(), regionX, regionY);
+        WRITE_PROPERTY_DIRECT(buffer);
+        snprintf(buffer, BUFFER_SIZE, "bounds = %lld, %lld, %llu, %llu", static_cast<long long>(regionX) * regionSize * tileWidth, static_cast<long long>(regionY) * regionSize * tileHeight,
+            static_cast<unsigned long long>(regionSize) * tileWidth, static_cast<unsigned long long>(regionSize) * tileHeight);
+        WRITE_PROPERTY_DIRECT(buffer);
+        WRITE_PROPERTY_BLOCK_END();
+    }
+
+    WRITE_PROPERTY_BLOCK_END();
+    file.close();
+}
+
+bool TMXSceneEncoder::writeRegionScene(const TMXMap& map, const std::vector<const TMXLayer*>& layers, long long left, long long top, unsigned int regionSize,
+    unsigned int chunkSize, const string& outputFilepath, const string& sceneName)
+{
+    // The scene is only created once a layer has tiles in the region
+    std::ofstream file;
+    for (size_t i = 0, count = layers.size(); i < count; i++)
+    {
+        // Clip the region to the layer
+        const TMXLayer* layer = layers[i];
+        long long x = max(left - layer->getOriginX(), 0LL);
+        long long y = max(top - layer->getOriginY(), 0LL);
+        long long right = min(left + regionSize - layer->getOriginX(), static_cast<long long>(layer->getWidth()));
+        long long bottom = min(top + regionSize - layer->getOriginY(), static_cast<long long>(layer->getHeight()));
+        if (x >= right || y >= bottom || layer->getTilesetsUsed(map, static_cast<unsigned int>(x), static_cast<unsigned int>(y),
+            static_cast<unsigned int>(right - x), static_cast<unsigned int>(bottom - y)).empty())
+        {
+            continue;
+        }
+
+        if (!file.is_open())
+        {
+            file.open(outputFilepath.c_str(), std::ofstream::out | std::ofstream::trunc);
+            OutputCache::recordOutput(outputFilepath);
+            WRITE_PROPERTY_BLOCK_START("scene " + sceneName);
+        }
+        writeTileset(map, layer, static_cast<unsigned int>(x), static_cast<unsigned int>(y),
+            static_cast<unsigned int>(right - x), static_cast<unsigned int>(bottom - y), chunkSize, file);
+        WRITE_PROPERTY_NEWLINE();
+    }
+
+    if (!file.is_open())
+    {
+        return false;
+    }
+    WRITE_PROPERTY_BLOCK_END();
+    file.close();
+    return true;
+}
+
+// Returns the areas of a layer that hold tiles, clipped to a region and relative to its first
+// tile. The areas keep the order of TMXLayer::getTileAreas, so the areas of a row of blocks are
+// next to each other, ordered by column, and have the same top and height.
+static std::vector<TMXLayer::TileArea> getRegionTileAreas(const TMXLayer& layer, unsigned int x, unsigned int y, unsigned int columns, unsigned int rows)
+{
+    std::vector<TMXLayer::TileArea> areas = layer.getTileAreas();
+    unsigned long long right = static_cast<unsigned long long>(x) + columns;
+    unsigned long long bottom = static_cast<unsigned long long>(y) + rows;
+    size_t regionCount = 0;
+    for (size_t i = 0, count = areas.size(); i < count; i++)
+    {
+        const TMXLayer::TileArea& area = areas[i];
+        unsigned long long areaLeft = max<unsigned long long>(area.x, x);
+        unsigned long long areaTop = max<unsigned long long>(area.y, y);
+        unsigned long long areaRight = min<unsigned long long>(static_cast<unsigned long long>(area.x) + area.width, right);
+        unsigned long long areaBottom = min<unsigned long long>(static_cast<unsigned long long>(area.y) + area.height, bottom);
+        if (areaLeft >= areaRight || areaTop >= areaBottom)
+        {
+            continue;
+        }
+
+        TMXLayer::TileArea& regionArea = areas[regionCount++];
+        regionArea.x = static_cast<unsigned int>(areaLeft - x);
+        regionArea.y = static_cast<unsigned int>(areaTop - y);
+        regionArea.width = static_cast<unsigned int>(areaRight - areaLeft);
+        regionArea.height = static_cast<unsigned int>(areaBottom - areaTop);
+    }
+    areas.resize(regionCount);
+    return areas;
+}
+
 // This is actually a misnomer. What is a Layer in Tiled/TMX is a TileSet for GamePlay3d. TileSet in Tiled/TMX is something different.
-void TMXSceneEncoder::writeTileset(const TMXMap& map, const TMXLayer* tileset, std::ofstream& file)
+void TMXSceneEncoder::writeTileset(const TMXMap& map, const TMXLayer* tileset, unsigned int x, unsigned int y, unsigned int columns, unsigned int rows,
+    unsigned int chunkSize, std::ofstream& file)
 {
-    if (!tileset || !tileset->hasTiles())
+    if (chunkSize == 0 || (chunkSize >= columns && chunkSize >= rows))
     {
-        return;
+        std::set<unsigned int> tilesets = tileset->getTilesetsUsed(map, x, y, columns, rows);
+        if (tilesets.size() == 0)
+        {
+            return;
+        }
+
+        WRITE_PROPERTY_BLOCK_START("node " + tileset->getName());
+        writeTilesetRegion(map, *tileset, tilesets, x, y, columns, rows, file);
     }
+    else
+    {
+        // Each chunk is a tileset of its own, drawn as a single batch, and its node bounds
+        // let the runtime skip chunks that are out of view. Empty chunks are left out.
+        char buffer[BUFFER_SIZE];
+        WRITE_PROPERTY_BLOCK_START("node " + tileset->getName());
+
+        // Only the chunks overlapping areas of the layer that hold tiles are looked at, row by
+        // row, so layers with their tiles far apart don't visit every chunk between them
+        std::set<std::pair<unsigned int, unsigned int> > cells;
+        std::vector<TMXLayer::TileArea> areas = getRegionTileAreas(*tileset, x, y, columns, rows);
+        for (size_t i = 0, count = areas.size(); i < count; i++)
+        {
+            const TMXLayer::TileArea& area = areas[i];
+            for (unsigned int cellY = area.y / chunkSize; cellY <= (area.y + area.height - 1) / chunkSize; cellY++)
+            {
+                for (unsigned int cellX = area.x / chunkSize; cellX <= (area.x + area.width - 1) / chunkSize; cellX++)
+                {
+                    cells.insert(std::make_pair(cellY, cellX));
+                }
+            }
+        }
+
+        bool chunkWritten = false;
+        for (std::set<std::pair<unsigned int, unsigned int> >::const_iterator it = cells.begin(); it != cells.end(); ++it)
+        {
+            unsigned int chunkX = it->second * chunkSize;
+            unsigned int chunkY = it->first * chunkSize;
+            unsigned int chunkColumns = min(chunkSize, columns - chunkX);
+            unsigned int chunkRows = min(chunkSize, rows - chunkY);
+            std::set<unsigned int> tilesets = tileset->getTilesetsUsed(map, x + chunkX, y + chunkY, chunkColumns, chunkRows);
+            if (tilesets.size() == 0)
+            {
+                continue;
+            }
 
-    std::set<unsigned int> tilesets = tileset->getTilesetsUsed(map);
-    if (tilesets.size() == 0)
+            if (chunkWritten)
+            {
+                WRITE_PROPERTY_NEWLINE();
+            }
+            chunkWritten = true;
+
+            snprintf(buffer, BUFFER_SIZE, "node chunk_%u_%u", it->second, it->first);
+            WRITE_PROPERTY_BLOCK_START(buffer);
+            writeTilesetRegion(map, *tileset, tilesets, x + chunkX, y + chunkY, chunkColumns, chunkRows, file);
+            WRITE_PROPERTY_BLOCK_END();
+        }
+    }
+
+    writeNodeProperties(tileset->getVisible(), tileset->getProperties(), file);
+    WRITE_PROPERTY_BLOCK_END();
+}
+
+void TMXSceneEncoder::writeTilesetRegion(const TMXMap& map, const TMXLayer& layer, const std::set<unsigned int>& tilesets,
+    unsigned int x, unsigned int y, unsigned int columns, unsigned int rows, std::ofstream& file)
+{
+    // Tilesets drawn from the same image with the same tile size and offset (such as those
+    // packed into the same atlas page) are written as a single batch
+    std::vector<std::set<unsigned int> > batches;
+    for (auto it = tilesets.begin(); it != tilesets.end(); it++)
     {
-        return;
+        const TMXTileSet& tmxTileset = map.getTileSet(*it);
+        size_t batch = 0;
+        for (; batch < batches.size(); batch++)
+        {
+            const TMXTileSet& batchTileset = map.getTileSet(*batches[batch].begin());
+            if (batchTileset.getImagePath() == tmxTileset.getImagePath() &&
+                batchTileset.getMaxTileWidth() == tmxTileset.getMaxTileWidth() &&
+                batchTileset.getMaxTileHeight() == tmxTileset.getMaxTileHeight() &&
+                batchTileset.getOffset() == tmxTileset.getOffset())
+            {
+                break;
+            }
+        }
+        if (batch == batches.size())
+        {
+            batches.push_back(std::set<unsigned int>());
+        }
+        batches[batch].insert(*it);
     }
 
     char buffer[BUFFER_SIZE];
-    WRITE_PROPERTY_BLOCK_START("node " + tileset->getName());
-
-    if (tilesets.size() > 1)
+    if (batches.size() > 1)
     {
         unsigned int i = 0;
-        for (auto it = tilesets.begin(); it != tilesets.end(); it++, i++)
+        for (auto it = batches.begin(); it != batches.end(); it++, i++)
         {
             snprintf(buffer, BUFFER_SIZE, "node tileset_%d", i);
             WRITE_PROPERTY_BLOCK_START(buffer);
 
-            const TMXTileSet& tmxTileset = map.getTileSet(*it);
-            writeSoloTileset(map, tmxTileset, *tileset, file, *it);
+            const TMXTileSet& tmxTileset = map.getTileSet(*it->begin());
+            writeSoloTileset(map, tmxTileset, layer, x, y, columns, rows, *it, file);
 
+            // Tile offset moves the tiles, not the origin of each tile. A region that doesn't
+            // start at the first tile of the map is moved to where its first tile goes.
             const Vector2& tileOffset = tmxTileset.getOffset();
-            if (!(tileOffset == Vector2::zero()))
+            long long translateX = static_cast<int>(tileOffset.x) + (static_cast<long long>(layer.getOriginX()) + x) * static_cast<int>(tmxTileset.getMaxTileWidth());
+            long long translateY = static_cast<int>(tileOffset.y) + (static_cast<long long>(layer.getOriginY()) + y) * static_cast<int>(tmxTileset.getMaxTileHeight());
+            if (translateX != 0 || translateY != 0)
             {
-                // Tile offset moves the tiles, not the origin of each tile
-                snprintf(buffer, BUFFER_SIZE, "translate = %d, %d, 0", static_cast<int>(tileOffset.x), static_cast<int>(tileOffset.y));
+                snprintf(buffer, BUFFER_SIZE, "translate = %lld, %lld, 0", translateX, translateY);
                 WRITE_PROPERTY_NEWLINE();
                 WRITE_PROPERTY_DIRECT(buffer);
             }
 
             WRITE_PROPERTY_BLOCK_END();
-            if ((i + 1) != tilesets.size())
+            if ((i + 1) != batches.size())
             {
                 WRITE_PROPERTY_NEWLINE();
             }
@@ -661,23 +1036,23 @@ void TMXSceneEncoder::writeTileset(const TMXMap& map, const TMXLayer* tileset, s
     else
     {
         const TMXTileSet& tmxTileset = map.getTileSet(*(tilesets.begin()));
-        writeSoloTileset(map, tmxTileset, *tileset, file);
+        writeSoloTileset(map, tmxTileset, layer, x, y, columns, rows, tilesets, file);
 
         const Vector2& tileOffset = tmxTileset.getOffset();
-        if (!(tileOffset == Vector2::zero()))
+        long long translateX = static_cast<int>(tileOffset.x) + (static_cast<long long>(layer.getOriginX()) + x) * static_cast<int>(tmxTileset.getMaxTileWidth());
+        long long translateY = static_cast<int>(tileOffset.y) + (static_cast<long long>(layer.getOriginY()) + y) * static_cast<int>(tmxTileset.getMaxTileHeight());
+        if (translateX != 0 || translateY != 0)
         {
             // Tile offset moves the tiles, not the origin of each tile
-            snprintf(buffer, BUFFER_SIZE, "translate = %d, %d, 0", static_cast<int>(tileOffset.x), static_cast<int>(tileOffset.y));
+            snprintf(buffer, BUFFER_SIZE, "translate = %lld, %lld, 0", translateX, translateY);
             WRITE_PROPERTY_NEWLINE();
             WRITE_PROPERTY_DIRECT(buffer);
         }
     }
-
-    writeNodeProperties(tileset->getVisible(), tileset->getProperties(), file);
-    WRITE_PROPERTY_BLOCK_END();
 }
 
-void TMXSceneEncoder::writeSoloTileset(const TMXMap& map, const gameplay::TMXTileSet& tmxTileset, const TMXLayer& tileset, std::ofstream& file, unsigned int resultOnlyForTileset)
+void TMXSceneEncoder::writeSoloTileset(const TMXMap& map, const gameplay::TMXTileSet& tmxTileset, const TMXLayer& tileset,
+    unsigned int x, unsigned int y, unsigned int columns, unsigned int rows, const std::set<unsigned int>& tilesets, std::ofstream& file)
 {
     WRITE_PROPERTY_BLOCK_START("tileset");
 
@@ -694,9 +1069,9 @@ void TMXSceneEncoder::writeSoloTileset(const TMXMap& map, const gameplay::TMXTil
     WRITE_PROPERTY_DIRECT(buffer);
 
     // Write tileset size
-    snprintf(buffer, BUFFER_SIZE, "columns = %u", tileset.getWidth());
+    snprintf(buffer, BUFFER_SIZE, "columns = %u", columns);
     WRITE_PROPERTY_DIRECT(buffer);
-    snprintf(buffer, BUFFER_SIZE, "rows = %u", tileset.getHeight());
+    snprintf(buffer, BUFFER_SIZE, "rows = %u", rows);
     WRITE_PROPERTY_DIRECT(buffer);
     WRITE_PROPERTY_NEWLINE();
 
@@ -708,35 +1083,190 @@ void TMXSceneEncoder::writeSoloTileset(const TMXMap& map, const gameplay::TMXTil
         WRITE_PROPERTY_NEWLINE();
     }
 
-    // Write tiles
-    unsigned int tilesetHeight = tileset.getHeight();
-    unsigned int tilesetWidth = tileset.getWidth();
-    for (unsigned int y = 0; y < tilesetHeight; y++)
+    if (_tileEncoding == EncoderArguments::TILEENCODING_RLE)
     {
-        bool tilesWritten = false;
-        for (unsigned int x = 0; x < tilesetWidth; x++)
+        if (writeTileRuns(map, tileset, x, y, columns, rows, tilesets, file))
         {
-            Vector2 startPos = tileset.getTileStart(x, y, map, resultOnlyForTileset);
-            if (startPos.x < 0 || startPos.y < 0)
+            WRITE_PROPERTY_BLOCK_END();
+            return;
+        }
+        LOG(1, "Layer '%s' spans too many rows to run-length encode, so its tiles are written one at a time. Use -tr to split it into regions.\n", tileset.getName().c_str());
+    }
+
+    // Write tiles, with cells relative to the region. Only the areas holding tiles are looked
+    // at, a row of blocks at a time, so the empty space of the region costs nothing.
+    std::vector<TMXLayer::TileArea> areas = getRegionTileAreas(tileset, x, y, columns, rows);
+    for (size_t first = 0, count = areas.size(); first < count; )
+    {
+        size_t last = first + 1;
+        while (last < count && areas[last].y == areas[first].y)
+        {
+            last++;
+        }
+        for (unsigned int row = areas[first].y; row < areas[first].y + areas[first].height; row++)
+        {
+            bool tilesWritten = false;
+            for (size_t i = first; i < last; i++)
             {
-                continue;
+                for (unsigned int column = areas[i].x; column < areas[i].x + areas[i].width; column++)
+                {
+                    unsigned int tilesetIndex = map.findTileSet(tileset.getTile(x + column, y + row));
+                    if (tilesets.find(tilesetIndex) == tilesets.end())
+                    {
+                        continue;
+                    }
+
+                    Vector2 startPos = tileset.getTileStart(x + column, y + row, map, tilesetIndex);
+                    if (startPos.x < 0 || startPos.y < 0)
+                    {
+                        continue;
+                    }
+
+                    tilesWritten = true;
+                    WRITE_PROPERTY_BLOCK_START("tile");
+                    snprintf(buffer, BUFFER_SIZE, "cell = %u, %u", column, row);
+                    WRITE_PROPERTY_DIRECT(buffer);
+                    snprintf(buffer, BUFFER_SIZE, "source = %u, %u", static_cast<unsigned int>(startPos.x), static_cast<unsigned int>(startPos.y));
+                    WRITE_PROPERTY_DIRECT(buffer);
+                    WRITE_PROPERTY_BLOCK_END();
+                }
+            }
+            if (tilesWritten && ((row + 1) != rows))
+            {
+                WRITE_PROPERTY_NEWLINE();
             }
+        }
+        first = last;
+    }
 
-            tilesWritten = true;
-            WRITE_PROPERTY_BLOCK_START("tile");
-            snprintf(buffer, BUFFER_SIZE, "cell = %u, %u", x, y);
-            WRITE_PROPERTY_DIRECT(buffer);
-            snprintf(buffer, BUFFER_SIZE, "source = %u, %u", static_cast<unsigned int>(startPos.x), static_cast<unsigned int>(startPos.y));
-            WRITE_PROPERTY_DIRECT(buffer);
-            WRITE_PROPERTY_BLOCK_END();
+    WRITE_PROPERTY_BLOCK_END();
+}
+
+bool TMXSceneEncoder::writeTileRuns(const TMXMap& map, const TMXLayer& tileset,
+    unsigned int x, unsigned int y, unsigned int columns, unsigned int rows, const std::set<unsigned int>& tilesets, std::ofstream& file)
+{
+    // Gather the tiles drawn from these tilesets, keyed by row then column, and the source of
+    // each tile ID. Tiles of other tilesets, or that aren't within their tileset, are left empty.
+    // Only the areas of the layer holding tiles are looked at, so the tiles stay sparse and the
+    // empty space of the region costs nothing.
+    std::vector<std::pair<unsigned long long, unsigned int> > tiles;
+    std::map<unsigned int, Vector2> sources;
+    unsigned int firstColumn = columns, lastColumn = 0;
+    std::vector<TMXLayer::TileArea> areas = getRegionTileAreas(tileset, x, y, columns, rows);
+    for (size_t first = 0, count = areas.size(); first < count; )
+    {
+        size_t last = first + 1;
+        while (last < count && areas[last].y == areas[first].y)
+        {
+            last++;
         }
-        if (tilesWritten && ((y + 1) != tilesetHeight))
+        for (unsigned int row = areas[first].y; row < areas[first].y + areas[first].height; row++)
         {
-            WRITE_PROPERTY_NEWLINE();
+            for (size_t i = first; i < last; i++)
+            {
+                for (unsigned int column = areas[i].x; column < areas[i].x + areas[i].width; column++)
+                {
+                    unsigned int gid = tileset.getTile(x + column, y + row);
+                    if (gid == 0)
+                    {
+                        continue;
+                    }
+
+                    auto source = sources.find(gid);
+                    if (source == sources.end())
+                    {
+                        unsigned int tilesetIndex = map.findTileSet(gid);
+                        Vector2 startPos(-1, -1);
+                        if (tilesets.find(tilesetIndex) != tilesets.end())
+                        {
+                            startPos = tileset.getTileStart(x + column, y + row, map, tilesetIndex);
+                        }
+                        source = sources.insert(std::make_pair(gid, startPos)).first;
+                    }
+                    if (source->second.x < 0 || source->second.y < 0)
+                    {
+                        continue;
+                    }
+
+                    unsigned long long position = (static_cast<unsigned long long>(row) << 32) | column;
+                    tiles.push_back(std::make_pair(position, tileset.getTileWithFlags(x + column, y + row)));
+                    firstColumn = min(firstColumn, column);
+                    lastColumn = max(lastColumn, column);
+                }
+            }
+        }
+        first = last;
+    }
+    if (tiles.empty())
+    {
+        return true;
+    }
+    unsigned int firstRow = static_cast<unsigned int>(tiles.front().first >> 32);
+    unsigned int lastRow = static_cast<unsigned int>(tiles.back().first >> 32);
+    if (lastRow - firstRow >= TILE_RUN_MAX_ROWS)
+    {
+        return false;
+    }
+
+    char buffer[BUFFER_SIZE];
+    for (auto it = sources.begin(); it != sources.end(); it++)
+    {
+        if (it->second.x < 0 || it->second.y < 0)
+        {
+            continue;
         }
+        WRITE_PROPERTY_BLOCK_START("tile");
+        snprintf(buffer, BUFFER_SIZE, "gid = %u", it->first);
+        WRITE_PROPERTY_DIRECT(buffer);
+        snprintf(buffer, BUFFER_SIZE, "source = %u, %u", static_cast<unsigned int>(it->second.x), static_cast<unsigned int>(it->second.y));
+        WRITE_PROPERTY_DIRECT(buffer);
+        WRITE_PROPERTY_BLOCK_END();
     }
+    WRITE_PROPERTY_NEWLINE();
 
-    WRITE_PROPERTY_BLOCK_END();
+    // Only the rows and columns between the first and last tiles are encoded, and the empty
+    // tiles at the end of each row are left out. Empty rows have no runs at all.
+    string rowOffsets = "rowOffsets = 0";
+    string runs = "runs =";
+    unsigned int runCount = 0;
+    size_t next = 0;
+    for (unsigned int row = firstRow; row <= lastRow; row++)
+    {
+        unsigned long long rowPosition = static_cast<unsigned long long>(row) << 32;
+        unsigned int column = firstColumn;
+        while (next < tiles.size() && (tiles[next].first >> 32) == row)
+        {
+            // The empty tiles before each tile are a run of ID 0, then tiles with the same ID
+            // next to each other are a run of that ID
+            unsigned int tileColumn = static_cast<unsigned int>(tiles[next].first - rowPosition);
+            if (tileColumn > column)
+            {
+                snprintf(buffer, BUFFER_SIZE, runCount == 0 ? " %u, %u" : ", %u, %u", tileColumn - column, 0);
+                runs += buffer;
+                runCount++;
+            }
+            unsigned int gid = tiles[next].second;
+            unsigned int count = 1;
+            while (next + count < tiles.size() && tiles[next + count].first == tiles[next].first + count && tiles[next + count].second == gid)
+            {
+                count++;
+            }
+            snprintf(buffer, BUFFER_SIZE, runCount == 0 ? " %u, %u" : ", %u, %u", count, gid);
+            runs += buffer;
+            runCount++;
+            column = tileColumn + count;
+            next += count;
+        }
+        snprintf(buffer, BUFFER_SIZE, ", %u", runCount);
+        rowOffsets += buffer;
+    }
+
+    WRITE_PROPERTY_DIRECT("encoding = rle");
+    snprintf(buffer, BUFFER_SIZE, "bounds = %u, %u, %u, %u", firstColumn, firstRow, lastColumn - firstColumn + 1, lastRow - firstRow + 1);
+    WRITE_PROPERTY_DIRECT(buffer);
+    WRITE_PROPERTY_DIRECT(rowOffsets);
+    WRITE_PROPERTY_DIRECT(runs);
+    return true;
 }
 
 void TMXSceneEncoder::writeSprite(const gameplay::TMXImageLayer* imageLayer, std::ofstream& file)
@@ -803,198 +1333,421 @@ void TMXSceneEncoder::writeNodeProperties(bool enabled, const Vector2& pos, cons
 
 void TMXSceneEncoder::writeLine(std::ofstream& file, const string& line) const
 {
-    file << TAB_STRING(_tabCount) << line << std::endl;
+    file << TAB_STRING(_tabCount) << line << '\n';
+}
+
+// Value of each base64 character, or -1 for characters that are not part of the encoding
+static const signed char BASE64_VALUES[256] =
+{
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+/**
+ * Decodes tile data into the bytes of a tile buffer, one chunk at a time. Base64 text is
+ * decoded into a small chunk which is inflated (or copied, when uncompressed) straight
+ * into the output, so the whole layer never exists as text or compressed bytes.
+ */
+class TileDataDecoder
+{
+public:
+
+    TileDataDecoder(unsigned char* output, size_t outputSize) :
+        _output(output), _outputSize(outputSize), _written(0), _compressed(false), _streamEnd(false)
+    {
+    }
+
+    ~TileDataDecoder()
+    {
+        if (_compressed)
+        {
+            inflateEnd(&_stream);
+        }
+    }
+
+    /**
+     * Sets up inflating of zlib or gzip compressed data.
+     */
+    bool initInflate(bool gzip)
+    {
+        memset(&_stream, 0, sizeof(_stream));
+        int err = gzip ? inflateInit2(&_stream, 16 + MAX_WBITS) : inflateInit(&_stream);
+        if (err != Z_OK)
+        {
+            LOG(1, "ZLIB inflateInit failed. Error: %d.\n", err);
+            return false;
+        }
+        _compressed = true;
+        return true;
+    }
+
+    /**
+     * Decodes base64 text, skipping whitespace, up to the end of the text or the padding.
+     */
+    bool decodeBase64(const char* text)
+    {
+        unsigned char chunk[TILE_DATA_CHUNK_SIZE];
+        size_t chunkSize = 0;
+        unsigned int bits = 0;
+        int bitCount = 0;
+        for (const unsigned char* c = reinterpret_cast<const unsigned char*>(text); *c && *c != '='; ++c)
+        {
+            int value = BASE64_VALUES[*c];
+            if (value < 0)
+            {
+                if (*c == ' ' || *c == '\n' || *c == '\r' || *c == '\t')
+                {
+                    continue;
+                }
+                LOG(1, "Invalid character in base64 tile data: '%c'.\n", *c);
+                return false;
+            }
+
+            bits = (bits << 6) | value;
+            bitCount += 6;
+            if (bitCount >= 8)
+            {
+                bitCount -= 8;
+                chunk[chunkSize++] = static_cast<unsigned char>(bits >> bitCount);
+                if (chunkSize == TILE_DATA_CHUNK_SIZE)
+                {
+                    if (!write(chunk, chunkSize))
+                    {
+                        return false;
+                    }
+                    chunkSize = 0;
+                }
+            }
+        }
+        return write(chunk, chunkSize);
+    }
+
+    /**
+     * Checks that all of the data was read and returns the number of bytes written.
+     */
+    bool finish(size_t* written)
+    {
+        if (_compressed && !_streamEnd)
+        {
+            LOG(1, "Compressed tile data is truncated.\n");
+            return false;
+        }
+        *written = _written;
+        return true;
+    }
+
+private:
+
+    bool write(const unsigned char* data, size_t size)
+    {
+        if (!_compressed)
+        {
+            if (size > _outputSize - _written)
+            {
+                LOG(1, "Tile data is larger than the layer.\n");
+                return false;
+            }
+            memcpy(_output + _written, data, size);
+            _written += size;
+            return true;
+        }
+
+        _stream.next_in = const_cast<Bytef*>(data);
+        _stream.avail_in = static_cast<uInt>(size);
+        while (_stream.avail_in > 0 && !_streamEnd)
+        {
+            // Once the output is full, inflate into a scratch buffer to find out whether
+            // the stream ends there or holds more tiles than the layer
+            unsigned char overflow[4];
+            bool full = _written == _outputSize;
+            _stream.next_out = full ? overflow : _output + _written;
+            _stream.avail_out = full ? sizeof(overflow) : static_cast<uInt>(min(_outputSize - _written, (size_t)UINT_MAX));
+            uInt availOut = _stream.avail_out;
+
+            int err = inflate(&_stream, Z_NO_FLUSH);
+            if (err != Z_OK && err != Z_STREAM_END)
+            {
+                LOG(1, "ZLIB inflate failed. Error: %d.\n", err);
+                return false;
+            }
+            if (full && _stream.avail_out != availOut)
+            {
+                LOG(1, "Tile data is larger than the layer.\n");
+                return false;
+            }
+            if (!full)
+            {
+                _written += availOut - _stream.avail_out;
+            }
+            _streamEnd = err == Z_STREAM_END;
+        }
+        return true;
+    }
+
+    unsigned char* _output;
+    size_t _outputSize;
+    size_t _written;
+    z_stream _stream;
+    bool _compressed;
+    bool _streamEnd;
+};
+
+bool TMXSceneEncoder::loadTiles(const XMLElement* data, TMXLayer* layer)
+{
+    layer->setupTiles();
+
+    unsigned long long tileCount = static_cast<unsigned long long>(layer->getWidth()) * layer->getHeight();
+    if (tileCount > UINT_MAX / sizeof(unsigned int))
+    {
+        LOG(1, "Layer is too large: %u x %u tiles.\n", layer->getWidth(), layer->getHeight());
+        return false;
+    }
+
+    std::vector<unsigned int> tileData;
+    if (data && !loadDataElement(data, data->Attribute("encoding"), data->Attribute("compression"), static_cast<unsigned int>(tileCount), &tileData))
+    {
+        return false;
+    }
+
+    size_t dataSize = tileData.size();
+    for (size_t i = 0; i < dataSize; i++)
+    {
+        //XXX this might depend on map's renderorder... not sure
+        unsigned int x = i % layer->getWidth();
+        unsigned int y = i / layer->getWidth();
+        layer->setTile(x, y, tileData[i]);
+    }
+    return true;
 }
 
-bool isBase64(char c)
+static bool readChunkBounds(const XMLElement* chunk, int* x, int* y, unsigned int* width, unsigned int* height)
 {
-    return (c >= 'a' && c <= 'z') ||
-        (c >= 'A' && c <= 'Z') ||
-        (c >= '0' && c <= '9') ||
-        (c == '=');
+    const char* xValue = chunk->Attribute("x");
+    const char* yValue = chunk->Attribute("y");
+    const char* widthValue = chunk->Attribute("width");
+    const char* heightValue = chunk->Attribute("height");
+    if (!xValue || !yValue || !widthValue || !heightValue ||
+        sscanf(xValue, "%d", x) != 1 || sscanf(yValue, "%d", y) != 1 ||
+        sscanf(widthValue, "%u", width) != 1 || sscanf(heightValue, "%u", height) != 1)
+    {
+        LOG(1, "Tile data chunk is missing its position or size.\n");
+        return false;
+    }
+    return true;
 }
 
-std::vector<unsigned int> TMXSceneEncoder::loadDataElement(const XMLElement* data)
+bool TMXSceneEncoder::loadChunks(const XMLElement* data, TMXLayer* layer)
 {
-    if (!data)
+    // Infinite maps have no fixed size, the layer covers whatever its chunks cover. Chunks
+    // can be far apart, so the bounds are worked out in 64 bits.
+    long long minX = LLONG_MAX, minY = LLONG_MAX, maxX = LLONG_MIN, maxY = LLONG_MIN;
+    for (const XMLElement* chunk = data->FirstChildElement("chunk"); chunk; chunk = chunk->NextSiblingElement("chunk"))
     {
-        return std::vector<unsigned int>();
+        int x, y;
+        unsigned int width, height;
+        if (!readChunkBounds(chunk, &x, &y, &width, &height))
+        {
+            return false;
+        }
+        if (width == 0 || height == 0)
+        {
+            continue;
+        }
+        minX = min(minX, static_cast<long long>(x));
+        minY = min(minY, static_cast<long long>(y));
+        maxX = max(maxX, static_cast<long long>(x) + width);
+        maxY = max(maxY, static_cast<long long>(y) + height);
+    }
+    if (maxX > INT_MAX || maxY > INT_MAX)
+    {
+        LOG(1, "Tile data chunk extends past the largest map position.\n");
+        return false;
+    }
+
+    if (minX > maxX)
+    {
+        layer->setWidth(0);
+        layer->setHeight(0);
+        layer->setupTiles();
+        return true;
     }
+    layer->setOrigin(static_cast<int>(minX), static_cast<int>(minY));
+    layer->setWidth(static_cast<unsigned int>(maxX - minX));
+    layer->setHeight(static_cast<unsigned int>(maxY - minY));
+    layer->setupTiles();
 
+    // Chunks use the encoding and compression of the <data> element they're in
     const char* encoding = data->Attribute("encoding");
     const char* compression = data->Attribute("compression");
+    std::vector<unsigned int> tileData;
+    for (const XMLElement* chunk = data->FirstChildElement("chunk"); chunk; chunk = chunk->NextSiblingElement("chunk"))
+    {
+        int x, y;
+        unsigned int width, height;
+        readChunkBounds(chunk, &x, &y, &width, &height);
+        if (width == 0 || height == 0)
+        {
+            continue;
+        }
+        if (static_cast<unsigned long long>(width) * height > UINT_MAX / sizeof(unsigned int))
+        {
+            LOG(1, "Tile data chunk is too large: %u x %u tiles.\n", width, height);
+            return false;
+        }
+        if (!loadDataElement(chunk, encoding, compression, width * height, &tileData))
+        {
+            return false;
+        }
+
+        unsigned int chunkX = static_cast<unsigned int>(x - minX);
+        unsigned int chunkY = static_cast<unsigned int>(y - minY);
+        for (size_t i = 0, dataSize = tileData.size(); i < dataSize; i++)
+        {
+            layer->setTile(chunkX + i % width, chunkY + i / width, tileData[i]);
+        }
+    }
+    return true;
+}
+
+bool TMXSceneEncoder::loadDataElement(const XMLElement* data, const char* encoding, const char* compression, unsigned int tileCount, std::vector<unsigned int>* tileData)
+{
+    tileData->clear();
 
     const char* attValue = "0";
     unsigned int tileGid;
-    std::vector<unsigned int> tileData;
 
     if (!compression && !encoding)
     {
+        tileData->reserve(tileCount);
         const XMLElement* xmlTile = data->FirstChildElement("tile");
         while (xmlTile)
         {
             attValue = xmlTile->Attribute("gid");
-            sscanf(attValue, "%u", &tileGid);
-            tileData.push_back(tileGid);
+            tileGid = 0;
+            if (attValue)
+            {
+                sscanf(attValue, "%u", &tileGid);
+            }
+            tileData->push_back(tileGid);
 
             xmlTile = xmlTile->NextSiblingElement("tile");
         }
     }
-    else
+    else if (!encoding)
     {
-        if (strcmp(encoding, "csv") == 0)
+        LOG(1, "Compression requires an encoding.\n");
+        return false;
+    }
+    else if (strcmp(encoding, "csv") == 0)
+    {
+        if (compression)
         {
-            if (compression)
-            {
-                LOG(1, "Compression is not supported with CSV encoding.\n");
-                exit(-1);
-            }
+            LOG(1, "Compression is not supported with CSV encoding.\n");
+            return false;
+        }
 
-            const char* rawCsvData = data->GetText();
-            int start = 0;
-            char* endptr;
-            // Skip everything before values
-            while (rawCsvData[start] == ' ' || rawCsvData[start] == '\n' || rawCsvData[start] == '\r' || rawCsvData[start] == '\t')
+        const char* rawCsvData = data->GetText();
+        if (!rawCsvData)
+        {
+            return true;
+        }
+
+        tileData->reserve(tileCount);
+        int start = 0;
+        char* endptr;
+        // Skip everything before values
+        while (rawCsvData[start] == ' ' || rawCsvData[start] == '\n' || rawCsvData[start] == '\r' || rawCsvData[start] == '\t')
+        {
+            start++;
+        }
+        // Iterate through values. Skipping to next value when done
+        while (rawCsvData[start])
+        {
+            tileData->push_back(strtoul(rawCsvData + start, &endptr, 10));
+            if (endptr == rawCsvData + start)
             {
-                start++;
+                LOG(1, "Invalid value in CSV tile data.\n");
+                return false;
             }
-            // Iterate through values. Skipping to next value when done
-            while (rawCsvData[start])
+            start = endptr - rawCsvData;
+            while (rawCsvData[start] == ' ' || rawCsvData[start] == ',' || rawCsvData[start] == '\n' || rawCsvData[start] == '\r' || rawCsvData[start] == '\t')
             {
-                tileData.push_back(strtoul(rawCsvData + start, &endptr, 10));
-                start = endptr - rawCsvData;
-                while (rawCsvData[start] == ' ' || rawCsvData[start] == ',' || rawCsvData[start] == '\n' || rawCsvData[start] == '\r' || rawCsvData[start] == '\t')
-                {
-                    start++;
-                }
+                start++;
             }
         }
-        else if (strcmp(encoding, "base64") == 0)
+    }
+    else if (strcmp(encoding, "base64") == 0)
+    {
+        const char* text = data->GetText();
+        if (!text)
         {
-            string base64Data = data->GetText();
-            if (base64Data.size() > 0 && (!isBase64(base64Data[0]) || !isBase64(base64Data[base64Data.size() - 1])))
-            {
-                int start = 0;
-                size_t end = base64Data.size() - 1;
-                while (!isBase64(base64Data[start]))
-                {
-                    start++;
-                }
-                while (!isBase64(base64Data[end]))
-                {
-                    end--;
-                }
-                base64Data = base64Data.substr(start, end - start + 1);
-            }
-            string byteData = base64_decode(base64Data);
+            return true;
+        }
 
-            if (compression)
+        // Tiles are decoded straight into the tile data, which is sized for the whole layer
+        tileData->resize(tileCount);
+        unsigned char* bytes = reinterpret_cast<unsigned char*>(tileCount > 0 ? &(*tileData)[0] : NULL);
+        TileDataDecoder decoder(bytes, tileCount * sizeof(unsigned int));
+        if (compression)
+        {
+            if (strcmp(compression, "zlib") != 0 && strcmp(compression, "gzip") != 0)
             {
-                int err;
-                const unsigned int buffer_size = 4096;
-                char buffer[buffer_size];
-                string decomData;
-
-                if (strcmp(compression, "zlib") == 0 || strcmp(compression, "gzip") == 0)
-                {
-                    z_stream dString;
-                    dString.zalloc = Z_NULL;
-                    dString.zfree = Z_NULL;
-                    dString.opaque = Z_NULL;
-                    dString.next_in = (Bytef*)byteData.c_str();
-                    dString.avail_in = byteData.size();
-
-                    if (strcmp(compression, "zlib") == 0)
-                    {
-                        // zlib
-                        if ((err = inflateInit(&dString)) != Z_OK)
-                        {
-                            LOG(1, "ZLIB inflateInit failed. Error: %d.\n", err);
-                            exit(-1);
-                        }
-                    }
-                    else
-                    {
-                        // gzip
-                        if ((err = inflateInit2(&dString, 16+MAX_WBITS)) != Z_OK)
-                        {
-                            LOG(1, "ZLIB inflateInit2 failed. Error: %d.\n", err);
-                            exit(-1);
-                        }
-                    }
-
-                    do
-                    {
-                        dString.next_out = (Bytef*)buffer;
-                        dString.avail_out = buffer_size;
-                        err = inflate(&dString, Z_NO_FLUSH);
-                        switch (err)
-                        {
-                            case Z_NEED_DICT:
-                            case Z_DATA_ERROR:
-                            case Z_MEM_ERROR:
-                                inflateEnd(&dString);
-                                LOG(1, "ZLIB inflate failed. Error: %d.\n", err);
-                                exit(-1);
-                                break;
-                        }
-
-                        string decomBlock(buffer, buffer_size - dString.avail_out);
-                        decomData += decomBlock;
-                    } while (err != Z_STREAM_END);
-
-                    inflateEnd(&dString);
-                }
-                else
-                {
-                    LOG(1, "Unknown compression: %s.\n", compression);
-                    exit(-1);
-                }
-
-                byteData = decomData;
+                LOG(1, "Unknown compression: %s.\n", compression);
+                return false;
             }
-
-            size_t byteDataSize = byteData.size();
-            for (unsigned int i = 0; i < byteDataSize; i += 4)
+            if (!decoder.initInflate(strcmp(compression, "gzip") == 0))
             {
-                unsigned int gid = static_cast<unsigned char>(byteData[i + 0]) |
-                    (static_cast<unsigned char>(byteData[i + 1]) << 8u) | 
-                    (static_cast<unsigned char>(byteData[i + 2]) << 16u) |
-                    (static_cast<unsigned char>(byteData[i + 3]) << 24u);
-                tileData.push_back(gid);
+                return false;
             }
         }
-        else
+
+        size_t byteDataSize;
+        if (!decoder.decodeBase64(text) || !decoder.finish(&byteDataSize))
+        {
+            return false;
+        }
+        tileData->resize(byteDataSize / 4);
+
+        // Tile data is stored as little endian
+        const unsigned int one = 1;
+        if (*reinterpret_cast<const unsigned char*>(&one) != 1)
         {
-            LOG(1, "Unknown encoding: %s.\n", encoding);
-            exit(-1);
+            for (size_t i = 0, count = tileData->size(); i < count; i++)
+            {
+                const unsigned char* gid = bytes + i * 4;
+                (*tileData)[i] = gid[0] | (gid[1] << 8u) | (gid[2] << 16u) | (gid[3] << 24u);
+            }
         }
     }
+    else
+    {
+        LOG(1, "Unknown encoding: %s.\n", encoding);
+        return false;
+    }
 
-    return tileData;
+    if (tileData->size() > tileCount)
+    {
+        LOG(1, "Tile data is larger than the layer.\n");
+        return false;
+    }
+    return true;
 }
 
 std::string TMXSceneEncoder::buildFilePath(const std::string& directory, const std::string& file)
 {
     return EncoderArguments::getRealPath(directory + "/" + file);
 }
-
-void TMXSceneEncoder::copyImage(unsigned char* dst, const unsigned char* src,
-    unsigned int srcWidth, unsigned int dstWidth, unsigned int bpp,
-    unsigned int srcx, unsigned int srcy, unsigned int dstx, unsigned int dsty, unsigned int width, unsigned int height)
-{
-    unsigned int sizePerRow = width * bpp;
-    for (unsigned int y = 0; y < height; y++)
-    {
-        const unsigned char* srcPtr = &src[((y + srcy) * srcWidth + srcx) * bpp];
-        unsigned char* dstPtr = &dst[((y + dsty) * dstWidth + dstx) * bpp];
-        if (src == dst)
-        {
-            memmove(dstPtr, srcPtr, sizePerRow);
-        }
-        else
-        {
-            memcpy(dstPtr, srcPtr, sizePerRow);
-        }
-    }
-}
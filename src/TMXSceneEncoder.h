@@ -33,25 +33,94 @@ public:
     void write(const gameplay::EncoderArguments& arguments);
 
 private:
-    static std::vector<unsigned int> loadDataElement(const tinyxml2::XMLElement* data);
+    /**
+     * Loads the tiles of a layer's <data> element.
+     *
+     * @param data The element, or NULL for a layer without tiles.
+     * @param layer The layer, with its width and height set.
+     *
+     * @return True if successful, false if the data is invalid (which is logged).
+     */
+    static bool loadTiles(const tinyxml2::XMLElement* data, gameplay::TMXLayer* layer);
+
+    /**
+     * Loads the tiles of an infinite map layer, which are stored in <chunk> elements
+     * within its <data> element. The layer is sized and placed to cover all of the chunks.
+     *
+     * @return True if successful, false if the data is invalid (which is logged).
+     */
+    static bool loadChunks(const tinyxml2::XMLElement* data, gameplay::TMXLayer* layer);
+
+    /**
+     * Loads the tiles of a <data> or <chunk> element.
+     *
+     * @param data The element.
+     * @param encoding The encoding of the tiles, or NULL for XML <tile> elements.
+     * @param compression The compression of the tiles, or NULL if they aren't compressed.
+     * @param tileCount Number of tiles the element can hold.
+     * @param tileData Receives the global tile IDs, including their flip flags.
+     *
+     * @return True if successful, false if the data is invalid (which is logged).
+     */
+    static bool loadDataElement(const tinyxml2::XMLElement* data, const char* encoding, const char* compression,
+        unsigned int tileCount, std::vector<unsigned int>* tileData);
     static inline std::string buildFilePath(const std::string& directory, const std::string& file);
-    static void copyImage(unsigned char* dst, const unsigned char* src,
-        unsigned int srcWidth, unsigned int dstWidth, unsigned int bpp,
-        unsigned int srcx, unsigned int srcy, unsigned int dstx, unsigned int dsty, unsigned int width, unsigned int height);
 
     // Parsing
     bool parseTmx(const tinyxml2::XMLDocument& xmlDoc, gameplay::TMXMap& map, const std::string& inputDirectory) const;
     void parseBaseLayerProperties(const tinyxml2::XMLElement* xmlBaseLayer, gameplay::TMXBaseLayer* layer) const;
 
     // Gutter
-    void buildTileGutter(gameplay::TMXMap& map, const std::string& inputDirectory, const std::string& outputDirectory);
+    bool buildTileGutter(gameplay::TMXMap& map, const std::string& inputDirectory, const std::string& outputDirectory);
     bool buildTileGutterTileset(const gameplay::TMXTileSet& tileset, const std::string& inputFile, const std::string& outputFile);
 
+    /**
+     * Packs the images of all tilesets into as few atlas pages as they fit on, and points
+     * the tilesets at their images within the pages.
+     *
+     * @return True if the atlas was built, false if the tilesets were left as they are.
+     */
+    bool buildTileAtlas(gameplay::TMXMap& map, const std::string& imageDirectory, const std::string& outputDirectory, const std::string& atlasName);
+
     // Writing
-    void writeScene(const gameplay::TMXMap& map, const std::string& outputFilepath, const std::string& sceneName);
+    void writeScene(const gameplay::TMXMap& map, const std::string& outputFilepath, const std::string& sceneName, unsigned int chunkSize, bool writeTileLayers);
 
-    void writeTileset(const gameplay::TMXMap& map, const gameplay::TMXLayer* layer, std::ofstream& file);
-    void writeSoloTileset(const gameplay::TMXMap& map, const gameplay::TMXTileSet& tmxTileset, const gameplay::TMXLayer& tileset, std::ofstream& file, unsigned int resultOnlyForTileset = TMX_INVALID_ID);
+    /**
+     * Writes the tile layers to a scene per region of regionSize x regionSize tiles, and an
+     * index of the regions (<sceneName>.regions). Regions are numbered from the map origin,
+     * so regions of infinite maps can have negative cells. Empty regions are not written.
+     */
+    void writeRegionScenes(const gameplay::TMXMap& map, const std::string& outputDirectory, const std::string& sceneName,
+        unsigned int regionSize, unsigned int chunkSize);
+
+    /**
+     * Writes the parts of the layers within a region to a scene.
+     *
+     * @return True if the scene was written, false if the layers have no tiles in the region.
+     */
+    bool writeRegionScene(const gameplay::TMXMap& map, const std::vector<const gameplay::TMXLayer*>& layers, long long left, long long top,
+        unsigned int regionSize, unsigned int chunkSize, const std::string& outputFilepath, const std::string& sceneName);
+
+    /**
+     * Writes part of a layer. When chunkSize is not 0 the part is split into child nodes of up
+     * to chunkSize x chunkSize tiles, so the runtime draws and culls whole chunks.
+     */
+    void writeTileset(const gameplay::TMXMap& map, const gameplay::TMXLayer* layer, unsigned int x, unsigned int y,
+        unsigned int columns, unsigned int rows, unsigned int chunkSize, std::ofstream& file);
+    void writeTilesetRegion(const gameplay::TMXMap& map, const gameplay::TMXLayer& layer, const std::set<unsigned int>& tilesets,
+        unsigned int x, unsigned int y, unsigned int columns, unsigned int rows, std::ofstream& file);
+    void writeSoloTileset(const gameplay::TMXMap& map, const gameplay::TMXTileSet& tmxTileset, const gameplay::TMXLayer& tileset,
+        unsigned int x, unsigned int y, unsigned int columns, unsigned int rows, const std::set<unsigned int>& tilesets, std::ofstream& file);
+
+    /**
+     * Writes the tiles of a tileset as run-length encoded global tile IDs. Each ID used is
+     * listed with its source position, then the runs of the rows with tiles are written as
+     * count, ID pairs (0 for empty tiles) along with the offset of each row's first run.
+     *
+     * @return False if the tiles span too many rows to encode, in which case nothing is written.
+     */
+    bool writeTileRuns(const gameplay::TMXMap& map, const gameplay::TMXLayer& tileset,
+        unsigned int x, unsigned int y, unsigned int columns, unsigned int rows, const std::set<unsigned int>& tilesets, std::ofstream& file);
 
     void writeSprite(const gameplay::TMXImageLayer* imageLayer, std::ofstream& file);
 
@@ -63,6 +132,7 @@ private:
     void writeLine(std::ofstream& file, const std::string& line) const;
 
     unsigned int _tabCount;
+    gameplay::EncoderArguments::TileEncoding _tileEncoding;
 };
 
 inline void TMXSceneEncoder::writeNodeProperties(bool enabled, std::ofstream& file, bool seperatorLineWritten)
@@ -1,4 +1,5 @@
 #include "TMXTypes.h"
+#include <algorithm>
 
 using namespace gameplay;
 
@@ -128,7 +129,7 @@ TMXTileSet::TMXTileSet()
     : _path(""),
     _imgWidth(0), _imgHeight(0), _horzTileCount(0), _vertTileCount(0),
     _firstGid(0), _maxTileWidth(0), _maxTileHeight(0),
-    _offset(), _spacing(0), _margin(0)
+    _offset(), _spacing(0), _margin(0), _imageOrigin()
 {
 }
 
@@ -254,6 +255,16 @@ const Vector2& TMXTileSet::getOffset() const
     return _offset;
 }
 
+void TMXTileSet::setImageOrigin(const Vector2& origin)
+{
+    _imageOrigin = origin;
+}
+
+const Vector2& TMXTileSet::getImageOrigin() const
+{
+    return _imageOrigin;
+}
+
 unsigned int TMXTileSet::calculateImageDimension(unsigned int tileCount, unsigned int tileSize, unsigned int spacing, unsigned int margin)
 {
     return tileCount * (tileSize + spacing) + (margin * 2) - spacing;
@@ -327,10 +338,19 @@ const TMXProperties& TMXBaseLayer::getProperties() const
 #define FLIPPED_VERTICALLY_FLAG 0x40000000
 #define FLIPPED_DIAGONALLY_FLAG 0x20000000
 
+// Width and height of the blocks layer tiles are stored in
+#define TILE_BLOCK_SIZE 16
+
+static unsigned long long getBlockKey(unsigned int blockX, unsigned int blockY)
+{
+    // Ordered row by row, like the tiles
+    return static_cast<unsigned long long>(blockY) << 32 | blockX;
+}
+
 TMXLayer::TMXLayer()
     : TMXBaseLayer(TMXLayerType::NormalLayer),
-    _width(0), _height(0),
-    _tiles()
+    _width(0), _height(0), _originX(0), _originY(0),
+    _blocks()
 {
 }
 
@@ -358,12 +378,25 @@ unsigned int TMXLayer::getHeight() const
     return _height;
 }
 
+void TMXLayer::setOrigin(int x, int y)
+{
+    _originX = x;
+    _originY = y;
+}
+
+int TMXLayer::getOriginX() const
+{
+    return _originX;
+}
+
+int TMXLayer::getOriginY() const
+{
+    return _originY;
+}
+
 void TMXLayer::setupTiles()
 {
-    if (_tiles.size() != (_width * _height))
-    {
-        _tiles.resize(_width * _height);
-    }
+    _blocks.clear();
 }
 
 void TMXLayer::setTile(unsigned int x, unsigned int y, unsigned int gid)
@@ -377,12 +410,32 @@ void TMXLayer::setTile(unsigned int x, unsigned int y, unsigned int gid)
         tile.diag_flip = (gid & FLIPPED_DIAGONALLY_FLAG) != 0,
     };
 
-    _tiles[x + y * _width] = tile;
+    unsigned long long key = getBlockKey(x / TILE_BLOCK_SIZE, y / TILE_BLOCK_SIZE);
+    if (tile.gid == 0 && _blocks.find(key) == _blocks.end())
+    {
+        return;
+    }
+    std::vector<layer_tile>& block = _blocks[key];
+    if (block.empty())
+    {
+        layer_tile empty = { 0, false, false, false };
+        block.resize(TILE_BLOCK_SIZE * TILE_BLOCK_SIZE, empty);
+    }
+    block[(y % TILE_BLOCK_SIZE) * TILE_BLOCK_SIZE + x % TILE_BLOCK_SIZE] = tile;
+}
+
+const std::vector<TMXLayer::layer_tile>* TMXLayer::getBlock(unsigned int blockX, unsigned int blockY) const
+{
+    std::unordered_map<unsigned long long, std::vector<layer_tile> >::const_iterator it = _blocks.find(getBlockKey(blockX, blockY));
+    return it == _blocks.end() ? NULL : &it->second;
 }
 
 const TMXLayer::layer_tile& TMXLayer::getTileStruct(unsigned int x, unsigned int y) const
 {
-    return _tiles[x + y * _width];
+    static const layer_tile empty = { 0, false, false, false };
+
+    const std::vector<layer_tile>* block = getBlock(x / TILE_BLOCK_SIZE, y / TILE_BLOCK_SIZE);
+    return block ? (*block)[(y % TILE_BLOCK_SIZE) * TILE_BLOCK_SIZE + x % TILE_BLOCK_SIZE] : empty;
 }
 
 unsigned int TMXLayer::getTile(unsigned int x, unsigned int y) const
@@ -390,6 +443,15 @@ unsigned int TMXLayer::getTile(unsigned int x, unsigned int y) const
     return getTileStruct(x, y).gid;
 }
 
+unsigned int TMXLayer::getTileWithFlags(unsigned int x, unsigned int y) const
+{
+    const layer_tile& tile = getTileStruct(x, y);
+    return tile.gid |
+        (tile.horz_flip ? FLIPPED_HORIZONTALLY_FLAG : 0) |
+        (tile.vert_flip ? FLIPPED_VERTICALLY_FLAG : 0) |
+        (tile.diag_flip ? FLIPPED_DIAGONALLY_FLAG : 0);
+}
+
 bool TMXLayer::isEmptyTile(unsigned int x, unsigned int y) const
 {
     return getTileStruct(x, y).gid == 0;
@@ -424,47 +486,136 @@ Vector2 TMXLayer::getTileStart(unsigned int x, unsigned int y, const TMXMap& map
     return TMXTileSet::calculateTileOrigin(Vector2(static_cast<float>(adjusted_gid % horzTileCount), static_cast<float>(adjusted_gid / horzTileCount)),
         Vector2(static_cast<float>(tileset.getMaxTileWidth()), static_cast<float>(tileset.getMaxTileHeight())),
         tileset.getSpacing(), 
-        tileset.getMargin());
+        tileset.getMargin()) + tileset.getImageOrigin();
 }
 
 bool TMXLayer::hasTiles() const
 {
-    size_t tile_size = _tiles.size();
-    for (unsigned int i = 0; i < tile_size; i++)
+    // Blocks are only allocated by a non-empty tile, but tiles can be cleared again afterwards
+    for (std::unordered_map<unsigned long long, std::vector<layer_tile> >::const_iterator it = _blocks.begin(); it != _blocks.end(); ++it)
     {
-        if (_tiles[i].gid != 0)
+        const std::vector<layer_tile>& block = it->second;
+        for (size_t j = 0, size = block.size(); j < size; j++)
         {
-            return true;
+            if (block[j].gid != 0)
+            {
+                return true;
+            }
         }
     }
     return false;
 }
 
+std::vector<TMXLayer::TileArea> TMXLayer::getTileAreas() const
+{
+    std::vector<unsigned long long> keys;
+    keys.reserve(_blocks.size());
+    for (std::unordered_map<unsigned long long, std::vector<layer_tile> >::const_iterator it = _blocks.begin(); it != _blocks.end(); ++it)
+    {
+        keys.push_back(it->first);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    // Blocks at the right and bottom edges can extend past the layer
+    std::vector<TileArea> areas(keys.size());
+    for (size_t i = 0, count = keys.size(); i < count; i++)
+    {
+        unsigned long long x = (keys[i] & 0xFFFFFFFF) * TILE_BLOCK_SIZE;
+        unsigned long long y = (keys[i] >> 32) * TILE_BLOCK_SIZE;
+        areas[i].x = static_cast<unsigned int>(x);
+        areas[i].y = static_cast<unsigned int>(y);
+        areas[i].width = static_cast<unsigned int>(std::min<unsigned long long>(TILE_BLOCK_SIZE, _width - x));
+        areas[i].height = static_cast<unsigned int>(std::min<unsigned long long>(TILE_BLOCK_SIZE, _height - y));
+    }
+    return areas;
+}
+
 std::set<unsigned int> TMXLayer::getTilesetsUsed(const TMXMap& map) const
+{
+    return getTilesetsUsed(map, 0, 0, _width, _height);
+}
+
+std::set<unsigned int> TMXLayer::getTilesetsUsed(const TMXMap& map, unsigned int x, unsigned int y, unsigned int width, unsigned int height) const
 {
     std::set<unsigned int> tilesets;
+    if (width == 0 || height == 0)
+    {
+        return tilesets;
+    }
 
-    unsigned int tileset_size = map.getTileSetCount();
-    size_t tile_size = _tiles.size();
-    for (unsigned int i = 0; i < tile_size; i++)
+    // Find the blocks overlapping the area. When the area covers more blocks than the layer
+    // holds, go through the blocks the layer holds rather than every block of the area.
+    unsigned long long right = static_cast<unsigned long long>(x) + width;
+    unsigned long long bottom = static_cast<unsigned long long>(y) + height;
+    unsigned int firstBlockX = x / TILE_BLOCK_SIZE;
+    unsigned int firstBlockY = y / TILE_BLOCK_SIZE;
+    unsigned int lastBlockX = static_cast<unsigned int>((right - 1) / TILE_BLOCK_SIZE);
+    unsigned int lastBlockY = static_cast<unsigned int>((bottom - 1) / TILE_BLOCK_SIZE);
+    unsigned long long blockCount = static_cast<unsigned long long>(lastBlockX - firstBlockX + 1) * (lastBlockY - firstBlockY + 1);
+
+    std::vector<std::pair<unsigned long long, const std::vector<layer_tile>*> > blocks;
+    if (blockCount <= _blocks.size())
     {
-        unsigned int gid = _tiles[i].gid;
-        if (gid == 0)
+        for (unsigned long long blockY = firstBlockY; blockY <= lastBlockY; blockY++)
         {
-            // Empty tile
-            continue;
+            for (unsigned long long blockX = firstBlockX; blockX <= lastBlockX; blockX++)
+            {
+                const std::vector<layer_tile>* block = getBlock(static_cast<unsigned int>(blockX), static_cast<unsigned int>(blockY));
+                if (block)
+                {
+                    blocks.push_back(std::make_pair(getBlockKey(static_cast<unsigned int>(blockX), static_cast<unsigned int>(blockY)), block));
+                }
+            }
         }
-        unsigned int tileset = map.findTileSet(gid);
-        if (tileset == tileset_size)
+    }
+    else
+    {
+        for (std::unordered_map<unsigned long long, std::vector<layer_tile> >::const_iterator it = _blocks.begin(); it != _blocks.end(); ++it)
         {
-            // Could not find tileset
-            continue;
+            unsigned int blockX = static_cast<unsigned int>(it->first & 0xFFFFFFFF);
+            unsigned int blockY = static_cast<unsigned int>(it->first >> 32);
+            if (blockX >= firstBlockX && blockX <= lastBlockX && blockY >= firstBlockY && blockY <= lastBlockY)
+            {
+                blocks.push_back(std::make_pair(it->first, &it->second));
+            }
         }
-        tilesets.insert(tileset);
-        if (tilesets.size() == tileset_size)
+    }
+
+    unsigned int tileset_size = map.getTileSetCount();
+    for (size_t i = 0, count = blocks.size(); i < count; i++)
+    {
+        // Clip the block to the area
+        const std::vector<layer_tile>& block = *blocks[i].second;
+        unsigned long long blockLeft = (blocks[i].first & 0xFFFFFFFF) * TILE_BLOCK_SIZE;
+        unsigned long long blockTop = (blocks[i].first >> 32) * TILE_BLOCK_SIZE;
+        unsigned int columnStart = static_cast<unsigned int>(std::max<unsigned long long>(x, blockLeft) - blockLeft);
+        unsigned int columnEnd = static_cast<unsigned int>(std::min<unsigned long long>(right, blockLeft + TILE_BLOCK_SIZE) - blockLeft);
+        unsigned int rowStart = static_cast<unsigned int>(std::max<unsigned long long>(y, blockTop) - blockTop);
+        unsigned int rowEnd = static_cast<unsigned int>(std::min<unsigned long long>(bottom, blockTop + TILE_BLOCK_SIZE) - blockTop);
+
+        for (unsigned int row = rowStart; row < rowEnd; row++)
         {
-            // Don't need to continue checking, we have every possible tileset
-            break;
+            for (unsigned int column = columnStart; column < columnEnd; column++)
+            {
+                unsigned int gid = block[row * TILE_BLOCK_SIZE + column].gid;
+                if (gid == 0)
+                {
+                    // Empty tile
+                    continue;
+                }
+                unsigned int tileset = map.findTileSet(gid);
+                if (tileset == tileset_size)
+                {
+                    // Could not find tileset
+                    continue;
+                }
+                tilesets.insert(tileset);
+                if (tilesets.size() == tileset_size)
+                {
+                    // Don't need to continue checking, we have every possible tileset
+                    return tilesets;
+                }
+            }
         }
     }
 
@@ -5,6 +5,7 @@
 #include <set>
 #include <map>
 #include <string>
+#include <unordered_map>
 
 #include "Vector2.h"
 
@@ -50,6 +51,10 @@ public:
     void setOffset(const Vector2& offset);
     const Vector2& getOffset() const;
 
+    // Position of the image within the texture it is drawn from, when packed into an atlas.
+    void setImageOrigin(const Vector2& origin);
+    const Vector2& getImageOrigin() const;
+
     static unsigned int calculateImageDimension(unsigned int tileCount, unsigned int tileSize, unsigned int spacing = 0, unsigned int margin = 0);
     static Vector2 calculateTileOrigin(const Vector2& pos, const Vector2& tileSize, unsigned int spacing = 0, unsigned int margin = 0);
 
@@ -67,6 +72,7 @@ private:
     Vector2 _offset;
     unsigned int _spacing;
     unsigned int _margin;
+    Vector2 _imageOrigin;
 };
 
 /**
@@ -122,6 +128,9 @@ private:
 class TMXMap;
 /**
  * Represents a single layer on a map.
+ *
+ * Tiles are stored in square blocks that are only allocated once they hold a tile, so
+ * the empty space of large or infinite maps doesn't take up memory.
  */
 class TMXLayer : public TMXBaseLayer
 {
@@ -141,14 +150,35 @@ public:
     void setHeight(unsigned int value);
     unsigned int getHeight() const;
 
+    // Position of the layer's first tile on the map, in tiles. Infinite maps can have layers
+    // that start anywhere, including at negative positions.
+    void setOrigin(int x, int y);
+    int getOriginX() const;
+    int getOriginY() const;
+
     void setupTiles();
     void setTile(unsigned int x, unsigned int y, unsigned int gid);
     unsigned int getTile(unsigned int x, unsigned int y) const;
+    // Global tile ID with the flip flags packed into its high bits, as Tiled stores it
+    unsigned int getTileWithFlags(unsigned int x, unsigned int y) const;
     bool isEmptyTile(unsigned int x, unsigned int y) const;
     Vector2 getTileStart(unsigned int x, unsigned int y, const TMXMap& map, unsigned int resultOnlyForTileset = TMX_INVALID_ID) const;
 
+    // A rectangle of the layer, in tiles
+    struct TileArea
+    {
+        unsigned int x;
+        unsigned int y;
+        unsigned int width;
+        unsigned int height;
+    };
+
     bool hasTiles() const;
+    // Areas of the layer that can hold tiles, row by row. Every tile outside of them is empty,
+    // so layers with tiles far apart can be visited area by area instead of tile by tile.
+    std::vector<TileArea> getTileAreas() const;
     std::set<unsigned int> getTilesetsUsed(const TMXMap& map) const;
+    std::set<unsigned int> getTilesetsUsed(const TMXMap& map, unsigned int x, unsigned int y, unsigned int width, unsigned int height) const;
 
 private:
     struct layer_tile
@@ -160,11 +190,16 @@ private:
     };
 
     const layer_tile& getTileStruct(unsigned int x, unsigned int y) const;
+    const std::vector<layer_tile>* getBlock(unsigned int blockX, unsigned int blockY) const;
 
     unsigned int _width;
     unsigned int _height;
+    int _originX;
+    int _originY;
 
-    std::vector<layer_tile> _tiles;
+    // Blocks of tiles keyed by their row (high 32 bits) and column. Blocks are only
+    // added once they hold a tile, so the layer's size doesn't matter, only its tile count.
+    std::unordered_map<unsigned long long, std::vector<layer_tile> > _blocks;
 };
 
 /**
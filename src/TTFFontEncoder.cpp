@@ -2,18 +2,41 @@
 #include "TTFFontEncoder.h"
 #include "GPBFile.h"
 #include "StringUtil.h"
+#include "TaskScheduler.h"
+#include "AtlasPacker.h"
+#include "MSDFGenerator.h"
+#include "OutputCache.h"
+#include <mutex>
+
+// Squared distance of pixels that have no feature pixel yet
+#define EDT_INFINITY 1e20f
+
+// Coverage above which a pixel is considered part of the glyph
+#define EDT_THRESHOLD 127
+
+// Rows or columns of the distance transform handled by each task
+#define EDT_TASK_LINES 16
 
 namespace gameplay
 {
 
-static void drawBitmap(unsigned char* dstBitmap, int x, int y, int dstWidth, unsigned char* srcBitmap, int srcWidth, int srcHeight)
+static void drawBitmap(unsigned char* dstBitmap, int x, int y, int dstWidth, int dstHeight, const unsigned char* srcBitmap, int srcWidth, int srcHeight)
 {
+    // Clip the source bitmap to the destination.
+    int left = max(0, -x);
+    int right = min(srcWidth, dstWidth - x);
+    int top = max(0, -y);
+    int bottom = min(srcHeight, dstHeight - y);
+    if (left >= right || top >= bottom)
+        return;
+
     // offset dst bitmap by x,y.
-    dstBitmap +=  (x + (y * dstWidth));
+    dstBitmap += (x + left) + ((y + top) * dstWidth);
+    srcBitmap += left + (top * srcWidth);
 
-    for (int i = 0; i < srcHeight; ++i)
+    for (int i = top; i < bottom; ++i)
     {
-        memcpy(dstBitmap, (const void*)srcBitmap, srcWidth);
+        memcpy(dstBitmap, (const void*)srcBitmap, right - left);
         srcBitmap += srcWidth;
         dstBitmap += dstWidth;
     }
@@ -107,11 +130,165 @@ unsigned char* createDistanceFields(unsigned char* img, unsigned int width, unsi
     return out;
 }
 
+/**
+ * Computes the one dimensional squared Euclidean distance transform of a sampled function
+ * in linear time, as the lower envelope of the parabolas rooted at each sample
+ * (Felzenszwalb and Huttenlocher, "Distance Transforms of Sampled Functions").
+ *
+ * @param f The sampled function, replaced with its distance transform.
+ * @param n Number of samples.
+ * @param v Scratch space for n parabola locations.
+ * @param z Scratch space for n + 1 parabola boundaries.
+ * @param d Scratch space for n distances.
+ */
+static void distanceTransform(float* f, int n, int* v, float* z, float* d)
+{
+    int k = 0;
+    v[0] = 0;
+    z[0] = -EDT_INFINITY;
+    z[1] = EDT_INFINITY;
+    for (int q = 1; q < n; ++q)
+    {
+        // Intersection of the parabola at q with the rightmost one in the envelope
+        float s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) / (2.0f * (q - v[k]));
+        while (s <= z[k] && k > 0)
+        {
+            --k;
+            s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) / (2.0f * (q - v[k]));
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = EDT_INFINITY;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; ++q)
+    {
+        while (z[k + 1] < q)
+            ++k;
+        float offset = (float)(q - v[k]);
+        d[q] = offset * offset + f[v[k]];
+    }
+    memcpy(f, d, n * sizeof(float));
+}
+
+/**
+ * Computes the two dimensional squared Euclidean distance transform of a grid in place,
+ * transforming the columns and then the rows in parallel.
+ */
+static void distanceTransform(float* grid, unsigned int width, unsigned int height)
+{
+    TaskScheduler* scheduler = TaskScheduler::getInstance();
+    int length = (int)max(width, height);
+
+    // Columns are gathered into a contiguous buffer, a few neighbouring columns per
+    // task so that each cache line of the grid is read once.
+    int columnTasks = (int)((width + EDT_TASK_LINES - 1) / EDT_TASK_LINES);
+    scheduler->parallelFor(0, columnTasks, [=](int task)
+    {
+        std::vector<float> f(length), d(length), z(length + 1);
+        std::vector<int> v(length);
+        unsigned int last = min(width, (unsigned int)(task + 1) * EDT_TASK_LINES);
+        for (unsigned int x = task * EDT_TASK_LINES; x < last; ++x)
+        {
+            for (unsigned int y = 0; y < height; ++y)
+                f[y] = grid[y * width + x];
+            distanceTransform(&f[0], height, &v[0], &z[0], &d[0]);
+            for (unsigned int y = 0; y < height; ++y)
+                grid[y * width + x] = f[y];
+        }
+    });
+
+    int rowTasks = (int)((height + EDT_TASK_LINES - 1) / EDT_TASK_LINES);
+    scheduler->parallelFor(0, rowTasks, [=](int task)
+    {
+        std::vector<float> d(length), z(length + 1);
+        std::vector<int> v(length);
+        unsigned int last = min(height, (unsigned int)(task + 1) * EDT_TASK_LINES);
+        for (unsigned int y = task * EDT_TASK_LINES; y < last; ++y)
+            distanceTransform(grid + y * width, width, &v[0], &z[0], &d[0]);
+    });
+}
+
+/**
+ * Creates a distance field with an exact Euclidean distance transform, which runs in
+ * linear time and uses 8 bytes per glyph image pixel.
+ *
+ * Pixels are classified as inside or outside the glyph by thresholding their coverage, so
+ * glyph images may be supersampled to recover the edge detail lost by thresholding. The
+ * distances are then averaged over each block of scale by scale pixels.
+ *
+ * @param img The glyph image, scale times the width and height of the distance field.
+ * @param width Width of the distance field.
+ * @param height Height of the distance field.
+ * @param scale Supersampling factor of the glyph image.
+ *
+ * @return The distance field, with the same mapping as createDistanceFields.
+ */
+static unsigned char* createLinearDistanceField(const unsigned char* img, unsigned int width, unsigned int height, unsigned int scale)
+{
+    unsigned int imgWidth = width * scale;
+    unsigned int imgHeight = height * scale;
+    TaskScheduler* scheduler = TaskScheduler::getInstance();
+
+    // Squared distances to the nearest glyph pixel and to the nearest background pixel
+    std::vector<float> outside((size_t)imgWidth * imgHeight);
+    std::vector<float> inside((size_t)imgWidth * imgHeight);
+    float* outsidePtr = &outside[0];
+    float* insidePtr = &inside[0];
+    scheduler->parallelFor(0, (int)imgHeight, [=](int y)
+    {
+        size_t first = (size_t)y * imgWidth;
+        for (size_t i = first, last = first + imgWidth; i < last; ++i)
+        {
+            bool glyph = img[i] > EDT_THRESHOLD;
+            outsidePtr[i] = glyph ? 0.0f : EDT_INFINITY;
+            insidePtr[i] = glyph ? EDT_INFINITY : 0.0f;
+        }
+    }, EDT_TASK_LINES);
+    distanceTransform(outsidePtr, imgWidth, imgHeight);
+    distanceTransform(insidePtr, imgWidth, imgHeight);
+
+    unsigned char* out = (unsigned char*)malloc(sizeof(unsigned char) * width * height);
+    float sampleScale = 1.0f / (float)(scale * scale * scale);
+    scheduler->parallelFor(0, (int)height, [=](int y)
+    {
+        for (unsigned int x = 0; x < width; ++x)
+        {
+            // Signed distance from the pixel edges, positive outside the glyph
+            float distance = 0;
+            for (unsigned int sy = 0; sy < scale; ++sy)
+            {
+                size_t i = (size_t)(y * scale + sy) * imgWidth + x * scale;
+                for (unsigned int sx = 0; sx < scale; ++sx, ++i)
+                {
+                    if (outsidePtr[i] > 0)
+                        distance += sqrtf(outsidePtr[i]) - 0.5f;
+                    else
+                        distance -= sqrtf(insidePtr[i]) - 0.5f;
+                }
+            }
+            // Average and convert to distance field pixels
+            distance *= sampleScale;
+
+            float value = 128 + distance * 16;
+            if (value < 0)
+                value = 0;
+            if (value > 255)
+                value = 255;
+            out[y * width + x] = 255 - (unsigned char)value;
+        }
+    }, EDT_TASK_LINES);
+
+    return out;
+}
+
 // Stores a single genreated font size to be written into the GPB
 struct FontData
 {
-    // Array of glyphs for a font
-    TTFGlyph glyphArray[END_INDEX - START_INDEX];
+    // Glyphs for a font, in character set order
+    std::vector<TTFGlyph> glyphs;
 
     // Stores final height of a row required to render all glyphs
     int fontSize;
@@ -119,12 +296,13 @@ struct FontData
     // Actual size of the underlying glyphs (may be different from fontSize)
     int glyphSize;
 
-    // Font texture
+    // Font texture, with the pages stacked vertically. The height is that of a single page.
     unsigned char* imageBuffer;
     unsigned int imageWidth;
     unsigned int imageHeight;
+    unsigned int pageCount;
 
-    FontData() : fontSize(0), glyphSize(0), imageBuffer(NULL), imageWidth(0), imageHeight(0)
+    FontData() : fontSize(0), glyphSize(0), imageBuffer(NULL), imageWidth(0), imageHeight(0), pageCount(1)
     {
     }
 
@@ -135,258 +313,688 @@ struct FontData
     }
 };
  
-int writeFont(const char* inFilePath, const char* outFilePath, std::vector<unsigned int>& fontSizes, const char* id, bool fontpreview = false, Font::FontFormat fontFormat = Font::BITMAP)
+// Vertical extent of the glyphs at one requested pixel size
+struct GlyphSizeMetrics
 {
-    // Initialize freetype library.
-    FT_Library library;
-    FT_Error error = FT_Init_FreeType(&library);
-    if (error)
+    // Height of a row that fits every glyph along with its descent
+    int rowSize;
+
+    // Height of the tallest glyph bitmap
+    int fontHeight;
+};
+
+/**
+ * Caches glyph metrics by requested pixel size. Shared by all font sizes being
+ * generated, since their size searches visit many of the same sizes.
+ */
+class GlyphMetricsCache
+{
+public:
+
+    bool find(unsigned int requestedSize, GlyphSizeMetrics* metrics)
     {
-        LOG(1, "FT_Init_FreeType error: %d \n", error);
-        return -1;
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::map<unsigned int, GlyphSizeMetrics>::const_iterator itr = _metrics.find(requestedSize);
+        if (itr == _metrics.end())
+            return false;
+        *metrics = itr->second;
+        return true;
     }
 
-    // Initialize font face.
-    FT_Face face;
-    error = FT_New_Face(library, inFilePath, 0, &face);
+    void insert(unsigned int requestedSize, const GlyphSizeMetrics& metrics)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _metrics[requestedSize] = metrics;
+    }
+
+private:
+
+    std::mutex _mutex;
+    std::map<unsigned int, GlyphSizeMetrics> _metrics;
+};
+
+/**
+ * Measures the glyphs at a requested pixel size. Only the hinted metrics are loaded,
+ * which match the dimensions of the rendered bitmaps without rendering them.
+ *
+ * @return True if successful, false if there was an error (which is logged).
+ */
+static bool measureGlyphs(FT_Face face, const std::vector<unsigned int>& characters, unsigned int requestedSize, GlyphMetricsCache* cache, GlyphSizeMetrics* metrics)
+{
+    if (cache->find(requestedSize, metrics))
+        return true;
+
+    // Set the pixel size.
+    FT_Error error = FT_Set_Char_Size( face, 0, requestedSize * 64, 0, 0 );
     if (error)
     {
-        LOG(1, "FT_New_Face error: %d \n", error);
-        return -1;
+        LOG(1, "FT_Set_Pixel_Sizes error: %d \n", error);
+        return false;
     }
 
-    std::vector<FontData*> fonts;
+    FT_GlyphSlot slot = face->glyph;
+    metrics->rowSize = 0;
+    metrics->fontHeight = 0;
+    for (size_t i = 0, count = characters.size(); i < count; ++i)
+    {
+        // Load glyph metrics into the slot (erase previous one)
+        error = FT_Load_Char(face, characters[i], FT_LOAD_FORCE_AUTOHINT);
+        if (error)
+        {
+            LOG(1, "FT_Load_Char error : %d \n", error);
+        }
 
-    for (size_t fontIndex = 0, count = fontSizes.size(); fontIndex < count; ++fontIndex)
+        // Hinted metrics are whole pixels
+        int rows = (int)(slot->metrics.height >> 6);
+        int top = (int)(slot->metrics.horiBearingY >> 6);
+
+        int bitmapRows = rows;
+        metrics->fontHeight = (metrics->fontHeight < bitmapRows) ? bitmapRows : metrics->fontHeight;
+
+        if (rows > top)
+        {
+            bitmapRows += (rows - top);
+        }
+        metrics->rowSize = (metrics->rowSize < bitmapRows) ? bitmapRows : metrics->rowSize;
+    }
+
+    cache->insert(requestedSize, *metrics);
+    return true;
+}
+
+// A glyph rendered at the final pixel size of a font
+struct RenderedGlyph
+{
+    std::vector<unsigned char> bitmap;
+    int width;
+    int rows;
+    int top;
+    int bearingX;
+    int advance;
+};
+
+/**
+ * Renders every glyph once at the face's current size.
+ */
+static void renderGlyphs(FT_Face face, const std::vector<unsigned int>& characters, std::vector<RenderedGlyph>* glyphs)
+{
+    FT_GlyphSlot slot = face->glyph;
+    glyphs->resize(characters.size());
+    for (size_t i = 0, count = characters.size(); i < count; ++i)
     {
-        unsigned int fontSize = fontSizes[fontIndex];
+        // Load glyph image into the slot (erase the previous one).
+        FT_Error error = FT_Load_Char(face, characters[i], FT_LOAD_RENDER | FT_LOAD_FORCE_AUTOHINT);
+        if (error)
+        {
+            LOG(1, "FT_Load_Char error : %d \n", error);
+        }
 
-        FontData* font = new FontData();
-        font->fontSize = fontSize;
+        // The bitmap pitch is used as the glyph width
+        RenderedGlyph& glyph = (*glyphs)[i];
+        glyph.width = slot->bitmap.pitch;
+        glyph.rows = slot->bitmap.rows;
+        glyph.top = slot->bitmap_top;
+        glyph.bearingX = slot->metrics.horiBearingX >> 6;
+        glyph.advance = slot->metrics.horiAdvance >> 6;
+        glyph.bitmap.assign(slot->bitmap.buffer, slot->bitmap.buffer + glyph.width * glyph.rows);
+    }
+}
 
-        TTFGlyph* glyphArray = font->glyphArray;
+/**
+ * Generates the multi-channel distance field of each glyph into its cell of the font
+ * texture, from the glyph outlines at the current size.
+ *
+ * @param baseline Distance from the top of a cell to the baseline.
+ * @param imageHeight Height of a single page of the texture.
+ */
+static void generateMultiChannelDistanceFields(FT_Face face, const std::vector<unsigned int>& characters, const std::vector<AtlasPacker::Rect>& rects, int baseline,
+                                               unsigned char* imageBuffer, unsigned int imageWidth, unsigned int imageHeight)
+{
+    // Faces can't be shared between threads, so read all the outlines first. The fields
+    // are then generated in parallel, each glyph only writing to its own cell.
+    std::vector<MSDFGenerator> generators(rects.size());
+    std::vector<int> left(rects.size(), 0);
+    for (size_t i = 0, count = characters.size(); i < count; ++i)
+    {
+        FT_Error error = FT_Load_Char(face, characters[i], FT_LOAD_NO_BITMAP | FT_LOAD_FORCE_AUTOHINT);
+        if (error)
+        {
+            LOG(1, "FT_Load_Char error : %d \n", error);
+            continue;
+        }
+
+        // The left edge of the bitmap that would have been rendered for the glyph
+        FT_BBox box;
+        FT_Outline_Get_CBox(&face->glyph->outline, &box);
+        left[i] = (int)(box.xMin >> 6);
+
+        if (!generators[i].load(&face->glyph->outline))
+        {
+            LOG(1, "FT_Outline_Decompose error for glyph: U+%04X\n", characters[i]);
+        }
+    }
 
-        int rowSize = 0;
-        int glyphSize = 0;
-        int actualfontHeight = 0;
+    TaskScheduler::getInstance()->parallelFor(0, (int)rects.size(), [&](int i)
+    {
+        const AtlasPacker::Rect& rect = rects[i];
+        int y = (int)(rect.page * imageHeight + rect.y);
+        generators[i].generate(imageBuffer, imageWidth, rect.x, y, rect.width, rect.height, (float)((int)rect.x + 1 - left[i]), (float)(y + baseline));
+    });
+}
 
-        FT_GlyphSlot slot = NULL;
-        FT_Int32 loadFlags = FT_LOAD_RENDER | FT_LOAD_FORCE_AUTOHINT;
+/**
+ * Finds the largest pixel size that fits the requested font size, then packs and
+ * draws all glyphs into the font texture.
+ *
+ * When scale is greater than 1 the glyphs are drawn at scale times their size, so the
+ * image buffer is scale times the image width and height in each dimension. Multi-channel
+ * distance field fonts get an RGB image buffer with the distance fields already generated.
+ *
+ * When pageSize is not 0 the glyphs are spread over as many pages of that size as they
+ * need, stacked one after another in the image buffer.
+ *
+ * @return True if successful, false if there was an error (which is logged).
+ */
+static bool generateGlyphs(FT_Face face, const std::vector<unsigned int>& characters, FontData* font, GlyphMetricsCache* cache, Font::FontFormat fontFormat,
+                           bool nonPowerOfTwo, unsigned int pageSize, unsigned int scale)
+{
+    unsigned int fontSize = font->fontSize;
+    FT_Error error;
+
+    std::vector<TTFGlyph>& glyphArray = font->glyphs;
+    glyphArray.resize(characters.size());
+
+    // We want to generate fonts that fit exactly the requested pixels size.
+    // Since free type (due to modern fonts) does not directly correlate requested
+    // size to glyph size, we binary search for the largest font size that will fit
+    // within the requested pixel size.
+    GlyphSizeMetrics metrics;
+    GlyphSizeMetrics fitMetrics;
+    unsigned int fitSize = 0;
+    unsigned int low = 1;
+    unsigned int high = fontSize;
+    while (low <= high)
+    {
+        unsigned int requestedSize = low + (high - low) / 2;
+        if (!measureGlyphs(face, characters, requestedSize, cache, &metrics))
+            return false;
 
-        // We want to generate fonts that fit exactly the requested pixels size.
-        // Since free type (due to modern fonts) does not directly correlate requested
-        // size to glyph size, we'll brute-force attempt to set the largest font size
-        // possible that will fit within the requested pixel size.
-        for (unsigned int requestedSize = fontSize; requestedSize > 0; --requestedSize)
+        if (metrics.rowSize <= (int)fontSize)
         {
-            // Set the pixel size.
-            error = FT_Set_Char_Size( face, 0, requestedSize * 64, 0, 0 );
-            if (error)
-            {
-                LOG(1, "FT_Set_Pixel_Sizes error: %d \n", error);
-                return -1;
-            }
+            fitSize = requestedSize;
+            fitMetrics = metrics;
+            low = requestedSize + 1;
+        }
+        else
+        {
+            high = requestedSize - 1;
+        }
+    }
 
-            // Save glyph information (slot contains the actual glyph bitmap).
-            slot = face->glyph;
+    if (fitSize == 0 || fitMetrics.rowSize == 0)
+    {
+        LOG(1, "Cannot generate a font of the requested size: %d\n", fontSize);
+        return false;
+    }
 
-            rowSize = 0;
-            glyphSize = 0;
-            actualfontHeight = 0;
+    // Set the pixel size to render at.
+    error = FT_Set_Char_Size( face, 0, fitSize * 64, 0, 0 );
+    if (error)
+    {
+        LOG(1, "FT_Set_Pixel_Sizes error: %d \n", error);
+        return false;
+    }
 
-            // Find the width of the image.
-            for (unsigned char ascii = START_INDEX; ascii < END_INDEX; ++ascii)
-            {
-                // Load glyph image into the slot (erase previous one)
-                error = FT_Load_Char(face, ascii, loadFlags);
-                if (error)
-                {
-                    LOG(1, "FT_Load_Char error : %d \n", error);
-                }
+    int glyphSize = fitMetrics.rowSize;
+    int rowSize = fontSize;
+    int actualfontHeight = fitMetrics.fontHeight;
 
-                int bitmapRows = slot->bitmap.rows;
-                actualfontHeight = (actualfontHeight < bitmapRows) ? bitmapRows : actualfontHeight;
+    // Render every glyph once; layout and drawing below read from the cache.
+    std::vector<RenderedGlyph> glyphs;
+    renderGlyphs(face, characters, &glyphs);
 
-                if (slot->bitmap.rows > slot->bitmap_top)
-                {
-                    bitmapRows += (slot->bitmap.rows - slot->bitmap_top);
-                }
-                rowSize = (rowSize < bitmapRows) ? bitmapRows : rowSize;
-            }
+    // Include padding in the rowSize.
+    rowSize += GLYPH_PADDING;
 
-            // Have we found a pixel size that fits?
-            if (rowSize <= (int)fontSize)
-            {
-                glyphSize = rowSize;
-                rowSize = fontSize;
-                break;
-            }
+    // Every glyph gets a cell of its padded width by the padded row height.
+    std::vector<AtlasPacker::Rect> rects(characters.size());
+    std::vector<int> bearingX(rects.size());
+    std::vector<int> advance(rects.size());
+    for (size_t i = 0, count = rects.size(); i < count; ++i)
+    {
+        rects[i].width = glyphs[i].width + GLYPH_PADDING;
+        rects[i].height = rowSize;
+        bearingX[i] = glyphs[i].bearingX;
+        advance[i] = glyphs[i].advance;
+    }
+
+    unsigned int imageWidth = pageSize;
+    unsigned int imageHeight = pageSize;
+    unsigned int pageCount = 1;
+    if (pageSize > 0)
+    {
+        if (!AtlasPacker::packPages(rects, pageSize, &pageCount))
+        {
+            LOG(1, "Glyphs of font size %d do not fit in a page of size %u\n", fontSize, pageSize);
+            return false;
         }
+    }
+    else if (!AtlasPacker::pack(rects, !nonPowerOfTwo, &imageWidth, &imageHeight))
+    {
+        LOG(1, "Image size exceeded!");
+        return false;
+    }
 
-        if (slot == NULL || glyphSize == 0)
+    // When supersampling, render the glyphs again at the larger size and draw them
+    // into the same layout scaled up.
+    if (scale > 1)
+    {
+        error = FT_Set_Char_Size(face, 0, fitSize * scale * 64, 0, 0);
+        if (error)
         {
-            LOG(1, "Cannot generate a font of the requested size: %d\n", fontSize);
-            return -1;
+            LOG(1, "FT_Set_Pixel_Sizes error: %d \n", error);
+            return false;
         }
+        renderGlyphs(face, characters, &glyphs);
+    }
+
+    // Allocate temporary image buffer to draw the glyphs into.
+    bool multiChannel = fontFormat == Font::MULTI_CHANNEL_DISTANCE_FIELD;
+    unsigned int bufferWidth = imageWidth * scale;
+    unsigned int bufferHeight = imageHeight * pageCount * scale;
+    unsigned int bufferSize = bufferWidth * bufferHeight * (multiChannel ? 3 : 1);
+    unsigned char* imageBuffer = (unsigned char*)malloc(bufferSize);
+    memset(imageBuffer, 0, bufferSize);
+    for (size_t i = 0, count = characters.size(); i < count; ++i)
+    {
+        // Glyph image.
+        const RenderedGlyph& glyph = glyphs[i];
+        const unsigned char* glyphBuffer = glyph.bitmap.empty() ? NULL : &glyph.bitmap[0];
+
+        // Keep a one pixel gutter to the left of the glyph.
+        int penX = rects[i].x + 1;
+        int penY = rects[i].y;
+
+        // Draw the glyph to the bitmap, offset down to its baseline on its page.
+        int bufferY = (rects[i].page * imageHeight + penY + actualfontHeight) * scale - glyph.top;
+        if (!multiChannel)
+            drawBitmap(imageBuffer, penX * scale, bufferY, bufferWidth, bufferHeight, glyphBuffer, glyph.width, glyph.rows);
+
+        // Glyph metrics are those of the unscaled glyph.
+        int glyphWidth = rects[i].width - GLYPH_PADDING;
+        glyphArray[i].index = characters[i];
+        glyphArray[i].width = glyphWidth;
+        glyphArray[i].bearingX = bearingX[i];
+        glyphArray[i].advance = advance[i];
+
+        // Generate UV coords.
+        glyphArray[i].uvCoords[0] = (float)penX / (float)imageWidth;
+        glyphArray[i].uvCoords[1] = (float)penY / (float)imageHeight;
+        glyphArray[i].uvCoords[2] = (float)(penX + glyphWidth) / (float)imageWidth;
+        glyphArray[i].uvCoords[3] = (float)(penY + rowSize - GLYPH_PADDING) / (float)imageHeight;
+        glyphArray[i].page = rects[i].page;
+    }
 
-        // Include padding in the rowSize.
-        rowSize += GLYPH_PADDING;
+    if (multiChannel)
+        generateMultiChannelDistanceFields(face, characters, rects, actualfontHeight, imageBuffer, imageWidth, imageHeight);
 
-        // Initialize with padding.
-        int penX = 0;
-        int penY = 0;
-        int row = 0;
+    font->glyphSize = glyphSize;
+    font->imageBuffer = imageBuffer;
+    font->imageWidth = imageWidth;
+    font->imageHeight = imageHeight;
+    font->pageCount = pageCount;
 
-        double powerOf2 = 2;
-        unsigned int imageWidth = 0;
-        unsigned int imageHeight = 0;
-        bool textureSizeFound = false;
+    return true;
+}
 
-        int advance;
-        int i;
+// Released FreeType libraries are kept for reuse, so a long running encoder doesn't set
+// up a library for every size of every font it encodes. Each library is only used by one
+// thread at a time.
+static std::mutex __freeTypeMutex;
+static std::vector<FT_Library> __freeTypeLibraries;
 
-        while (textureSizeFound == false)
+static FT_Error acquireFreeTypeLibrary(FT_Library* library)
+{
+    {
+        std::lock_guard<std::mutex> lock(__freeTypeMutex);
+        if (!__freeTypeLibraries.empty())
         {
-            imageWidth =  (unsigned int)pow(2.0, powerOf2);
-            imageHeight = (unsigned int)pow(2.0, powerOf2);
-            penX = 0;
-            penY = 0;
-            row = 0;
+            *library = __freeTypeLibraries.back();
+            __freeTypeLibraries.pop_back();
+            return 0;
+        }
+    }
+    return FT_Init_FreeType(library);
+}
 
-            // Find out the squared texture size that would fit all the require font glyphs.
-            i = 0;
-            for (unsigned char ascii = START_INDEX; ascii < END_INDEX; ++ascii)
-            {
-                // Load glyph image into the slot (erase the previous one).
-                error = FT_Load_Char(face, ascii, loadFlags);
-                if (error)
-                {
-                    LOG(1, "FT_Load_Char error : %d \n", error);
-                }
-                // Glyph image.
-                int glyphWidth = slot->bitmap.pitch;
-                int glyphHeight = slot->bitmap.rows;
+static void releaseFreeTypeLibrary(FT_Library library)
+{
+    std::lock_guard<std::mutex> lock(__freeTypeMutex);
+    __freeTypeLibraries.push_back(library);
+}
 
-                advance = glyphWidth + GLYPH_PADDING; 
+/**
+ * Generates the glyphs and texture for a single font size.
+ *
+ * Each size uses its own FreeType library and face, so that sizes can be generated
+ * concurrently.
+ *
+ * @return The generated font data, or NULL if there was an error (which is logged).
+ */
+static FontData* generateFontData(const char* inFilePath, const std::vector<unsigned int>& characters, unsigned int fontSize, Font::FontFormat fontFormat,
+                                  GlyphMetricsCache* cache, bool nonPowerOfTwo, unsigned int pageSize, bool linearDistanceField, unsigned int supersample)
+{
+    FT_Library library;
+    FT_Error error = acquireFreeTypeLibrary(&library);
+    if (error)
+    {
+        LOG(1, "FT_Init_FreeType error: %d \n", error);
+        return NULL;
+    }
 
-                // If we reach the end of the image wrap aroud to the next row.
-                if ((penX + advance) > (int)imageWidth)
-                {
-                    penX = 0;
-                    row += 1;
-                    penY = row * rowSize;
-                    if (penY + rowSize > (int)imageHeight)
-                    {
-                        powerOf2++;
-                        break;
-                    }
-                }
+    FT_Face face;
+    error = FT_New_Face(library, inFilePath, 0, &face);
+    if (error)
+    {
+        LOG(1, "FT_New_Face error: %d \n", error);
+        releaseFreeTypeLibrary(library);
+        return NULL;
+    }
 
-                // penY should include the glyph offsets.
-                penY += (actualfontHeight - glyphHeight) + (glyphHeight - slot->bitmap_top);
+    // Only the linear distance transform supports supersampled glyphs.
+    bool linear = fontFormat == Font::DISTANCE_FIELD && linearDistanceField;
+    unsigned int scale = linear ? max(supersample, 1u) : 1;
 
-                // Set the pen position for the next glyph
-                penX += advance; // Move X to next glyph position
-                // Move Y back to the top of the row.
-                penY = row * rowSize;
+    FontData* font = new FontData();
+    font->fontSize = fontSize;
+    if (!generateGlyphs(face, characters, font, cache, fontFormat, nonPowerOfTwo, pageSize, scale))
+        SAFE_DELETE(font);
 
-                if (ascii == (END_INDEX - 1))
-                {
-                    textureSizeFound = true;
-                }
-                i++;
-            }
-        }
+    FT_Done_Face(face);
+    releaseFreeTypeLibrary(library);
 
-        // Try further to find a tighter texture size.
-        powerOf2 = 1;
-        for (;;)
+    if (font && fontFormat == Font::DISTANCE_FIELD)
+    {
+        // Each page gets its own distance field so that glyphs near the edge of one page
+        // don't bleed into the next.
+        unsigned int pageBytes = font->imageWidth * font->imageHeight;
+        unsigned char* distanceFieldBuffer = (unsigned char*)malloc(pageBytes * font->pageCount);
+        for (unsigned int page = 0; page < font->pageCount; ++page)
         {
-            if ((penY + rowSize) >= pow(2.0, powerOf2))
+            unsigned char* pageField;
+            if (linear)
             {
-                powerOf2++;
+                pageField = createLinearDistanceField(font->imageBuffer + page * pageBytes * scale * scale, font->imageWidth, font->imageHeight, scale);
             }
             else
             {
-                imageHeight = (int)pow(2.0, powerOf2);
-                break;
+                // Flip height and width since the distance field map generator is column-wise.
+                pageField = createDistanceFields(font->imageBuffer + page * pageBytes, font->imageHeight, font->imageWidth);
             }
+            memcpy(distanceFieldBuffer + page * pageBytes, pageField, pageBytes);
+            free(pageField);
         }
+        free(font->imageBuffer);
+        font->imageBuffer = distanceFieldBuffer;
+    }
+
+    return font;
+}
 
-        // Allocate temporary image buffer to draw the glyphs into.
-        unsigned char* imageBuffer = (unsigned char*)malloc(imageWidth * imageHeight);
-        memset(imageBuffer, 0, imageWidth * imageHeight);
-        penX = 1;
-        penY = 0;
-        row = 0;
-        i = 0;
-        for (unsigned char ascii = START_INDEX; ascii < END_INDEX; ++ascii)
+/**
+ * Reads a code point, or the end of a range, from a character set list.
+ */
+static bool parseCodePoint(const char** str, unsigned int* codePoint)
+{
+    const char* start = *str;
+    while (isspace((unsigned char)*start))
+        ++start;
+
+    int base = 10;
+    if ((start[0] == 'U' || start[0] == 'u') && start[1] == '+')
+    {
+        start += 2;
+        base = 16;
+    }
+    else if (start[0] == '0' && (start[1] == 'x' || start[1] == 'X'))
+    {
+        start += 2;
+        base = 16;
+    }
+    if (!isxdigit((unsigned char)*start))
+        return false;
+
+    char* end;
+    unsigned long value = strtoul(start, &end, base);
+    if (end == start || value > 0x10FFFF)
+        return false;
+    while (isspace((unsigned char)*end))
+        ++end;
+
+    *codePoint = (unsigned int)value;
+    *str = end;
+    return true;
+}
+
+bool parseCharset(const char* charset, std::vector<unsigned int>* characters)
+{
+    const char* str = charset;
+    while (*str)
+    {
+        unsigned int first;
+        unsigned int last;
+        if (!parseCodePoint(&str, &first))
         {
-            // Load glyph image into the slot (erase the previous one).
-            error = FT_Load_Char(face, ascii, loadFlags);
-            if (error)
+            LOG(1, "Error: Invalid character set: %s\n", charset);
+            return false;
+        }
+        last = first;
+        if (*str == '-')
+        {
+            ++str;
+            if (!parseCodePoint(&str, &last) || last < first)
             {
-                LOG(1, "FT_Load_Char error : %d \n", error);
+                LOG(1, "Error: Invalid character range in character set: %s\n", charset);
+                return false;
             }
+        }
+        for (unsigned int c = first; c <= last; ++c)
+            characters->push_back(c);
 
-            // Glyph image.
-            unsigned char* glyphBuffer =  slot->bitmap.buffer;
-            int glyphWidth = slot->bitmap.pitch;
-            int glyphHeight = slot->bitmap.rows;
+        if (*str == ',')
+            ++str;
+        else if (*str)
+        {
+            LOG(1, "Error: Invalid character set: %s\n", charset);
+            return false;
+        }
+    }
+    return true;
+}
 
-            advance = glyphWidth + GLYPH_PADDING;
+bool readCharsetFile(const char* path, std::vector<unsigned int>* characters)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        LOG(1, "Error: Failed to open character set file: %s\n", path);
+        return false;
+    }
+
+    std::string text;
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        text.append(buffer, read);
+    fclose(fp);
+
+    // Decode UTF-8, skipping malformed sequences
+    const unsigned char* str = (const unsigned char*)text.c_str();
+    const unsigned char* end = str + text.size();
+    while (str < end)
+    {
+        unsigned int c = *str++;
+        int continuation = 0;
+        if (c >= 0xF0 && c < 0xF8)
+        {
+            c &= 0x07;
+            continuation = 3;
+        }
+        else if (c >= 0xE0)
+        {
+            c &= 0x0F;
+            continuation = 2;
+        }
+        else if (c >= 0xC0)
+        {
+            c &= 0x1F;
+            continuation = 1;
+        }
+        else if (c >= 0x80)
+        {
+            continue;
+        }
 
-            // If we reach the end of the image wrap aroud to the next row.
-            if ((penX + advance) > (int)imageWidth)
+        bool valid = true;
+        for (int i = 0; i < continuation; ++i)
+        {
+            if (str == end || (*str & 0xC0) != 0x80)
             {
-                penX = 1;
-                row += 1;
-                penY = row * rowSize;
-                if (penY + rowSize > (int)imageHeight)
-                {
-                    free(imageBuffer);
-                    LOG(1, "Image size exceeded!");
-                    return -1;
-                }
+                valid = false;
+                break;
             }
+            c = (c << 6) | (*str++ & 0x3F);
+        }
 
-            // penY should include the glyph offsets.
-            penY += (actualfontHeight - glyphHeight) + (glyphHeight - slot->bitmap_top);
+        // Skip control characters and the byte order mark
+        if (valid && c >= 32 && c != 127 && c != 0xFEFF && c <= 0x10FFFF)
+            characters->push_back(c);
+    }
+    return true;
+}
 
-            // Draw the glyph to the bitmap with a one pixel padding.
-            drawBitmap(imageBuffer, penX, penY, imageWidth, glyphBuffer, glyphWidth, glyphHeight);
+/**
+ * Encodes code points as a UTF-8 string.
+ */
+static std::string encodeUtf8(const std::vector<unsigned int>& characters)
+{
+    std::string text;
+    for (size_t i = 0, count = characters.size(); i < count; ++i)
+    {
+        unsigned int c = characters[i];
+        if (c < 0x80)
+        {
+            text += (char)c;
+        }
+        else if (c < 0x800)
+        {
+            text += (char)(0xC0 | (c >> 6));
+            text += (char)(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            text += (char)(0xE0 | (c >> 12));
+            text += (char)(0x80 | ((c >> 6) & 0x3F));
+            text += (char)(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            text += (char)(0xF0 | (c >> 18));
+            text += (char)(0x80 | ((c >> 12) & 0x3F));
+            text += (char)(0x80 | ((c >> 6) & 0x3F));
+            text += (char)(0x80 | (c & 0x3F));
+        }
+    }
+    return text;
+}
 
-            // Move Y back to the top of the row.
-            penY = row * rowSize;
+int writeFont(const char* inFilePath, const char* outFilePath, std::vector<unsigned int>& fontSizes, const char* id, bool fontpreview = false, Font::FontFormat fontFormat = Font::BITMAP, bool nonPowerOfTwo = false,
+              bool linearDistanceField = false, unsigned int supersample = 1, const std::vector<unsigned int>& characters = std::vector<unsigned int>(), unsigned int pageSize = 0)
+{
+    // Initialize freetype library.
+    FT_Library library;
+    FT_Error error = acquireFreeTypeLibrary(&library);
+    if (error)
+    {
+        LOG(1, "FT_Init_FreeType error: %d \n", error);
+        return -1;
+    }
 
-            glyphArray[i].index = ascii;
-            glyphArray[i].width = advance - GLYPH_PADDING;
-            glyphArray[i].bearingX = slot->metrics.horiBearingX >> 6;
-            glyphArray[i].advance = slot->metrics.horiAdvance >> 6;
+    // Initialize font face.
+    FT_Face face;
+    error = FT_New_Face(library, inFilePath, 0, &face);
+    if (error)
+    {
+        LOG(1, "FT_New_Face error: %d \n", error);
+        releaseFreeTypeLibrary(library);
+        return -1;
+    }
 
-            // Generate UV coords.
-            glyphArray[i].uvCoords[0] = (float)penX / (float)imageWidth;
-            glyphArray[i].uvCoords[1] = (float)penY / (float)imageHeight;
-            glyphArray[i].uvCoords[2] = (float)(penX + advance - GLYPH_PADDING) / (float)imageWidth;
-            glyphArray[i].uvCoords[3] = (float)(penY + rowSize - GLYPH_PADDING) / (float)imageHeight;
+    // The printable ASCII characters are kept whole when no character set is given, since
+    // the runtime indexes them from the first one.
+    std::vector<unsigned int> charset;
+    if (characters.empty())
+    {
+        for (unsigned int c = START_INDEX; c < END_INDEX; ++c)
+            charset.push_back(c);
+    }
+    else
+    {
+        charset = characters;
+        std::sort(charset.begin(), charset.end());
+        charset.erase(std::unique(charset.begin(), charset.end()), charset.end());
 
-            // Set the pen position for the next glyph
-            penX += advance;
-            i++;
+        size_t count = charset.size();
+        charset.erase(std::remove_if(charset.begin(), charset.end(), [face](unsigned int c) { return FT_Get_Char_Index(face, c) == 0; }), charset.end());
+        if (charset.size() < count)
+        {
+            LOG(1, "Skipping %u characters that are not in the font.\n", (unsigned int)(count - charset.size()));
         }
+        if (charset.empty())
+        {
+            LOG(1, "Error: None of the characters in the character set are in the font.\n");
+            FT_Done_Face(face);
+            releaseFreeTypeLibrary(library);
+            return -1;
+        }
+    }
 
-        font->glyphSize = glyphSize;
-        font->imageBuffer = imageBuffer;
-        font->imageWidth = imageWidth;
-        font->imageHeight = imageHeight;
-        fonts.push_back(font);
+    // Sizes are independent of each other, so generate them all in parallel and write
+    // them out in order once they are done.
+    std::vector<FontData*> fonts(fontSizes.size(), (FontData*)NULL);
+    GlyphMetricsCache cache;
+    TaskScheduler::TaskGroup group;
+    for (size_t fontIndex = 0, count = fontSizes.size(); fontIndex < count; ++fontIndex)
+    {
+        group.run([&fonts, &fontSizes, &cache, &charset, inFilePath, fontFormat, nonPowerOfTwo, pageSize, linearDistanceField, supersample, fontIndex]()
+        {
+            fonts[fontIndex] = generateFontData(inFilePath, charset, fontSizes[fontIndex], fontFormat, &cache, nonPowerOfTwo, pageSize, linearDistanceField, supersample);
+        });
+    }
+    group.wait();
+
+    for (size_t i = 0, count = fonts.size(); i < count; ++i)
+    {
+        if (fonts[i] == NULL)
+        {
+            for (size_t j = 0; j < count; ++j)
+                SAFE_DELETE(fonts[j]);
+            FT_Done_Face(face);
+            releaseFreeTypeLibrary(library);
+            return -1;
+        }
     }
 
-    // File header and version.
+    // File header and version. Fonts are only written in the paged layout when they need
+    // it, so that single texture ASCII fonts can still be read by older runtimes. Those look
+    // glyphs up by their offset from the first printable ASCII character, which only works
+    // for the default character set, whereas the paged layout looks them up by code point.
+    bool paged = pageSize > 0 || !characters.empty();
     FILE *gpbFp = fopen(outFilePath, "wb");    
+    OutputCache::recordOutput(outFilePath);
     char fileHeader[9]     = {'\xAB', 'G', 'P', 'B', '\xBB', '\r', '\n', '\x1A', '\n'};
     fwrite(fileHeader, sizeof(char), 9, gpbFp);
-    fwrite(gameplay::GPB_VERSION, sizeof(char), 2, gpbFp);
+    fwrite(paged ? gameplay::GPB_FONT_PAGES_VERSION : gameplay::GPB_VERSION, sizeof(char), 2, gpbFp);
 
     // Write Ref table (for a single font)
     writeUint(gpbFp, 1);                // Ref[] count
@@ -404,6 +1012,8 @@ int writeFont(const char* inFilePath, const char* outFilePath, std::vector<unsig
     // Number of included font sizes (GPB version 1.3+)
     writeUint(gpbFp, (unsigned int)fonts.size());
 
+    std::string charsetText = encodeUtf8(charset);
+
     for (size_t i = 0, count = fonts.size(); i < count; ++i)
     {
         FontData* font = fonts[i];
@@ -411,72 +1021,63 @@ int writeFont(const char* inFilePath, const char* outFilePath, std::vector<unsig
         // Font size (pixels).
         writeUint(gpbFp, font->fontSize);
 
-        // Character set. TODO: Empty for now
-        writeString(gpbFp, "");
+        // Character set, as UTF-8
+        writeString(gpbFp, charsetText.c_str());
 
         // Glyphs.
-        unsigned int glyphSetSize = END_INDEX - START_INDEX;
+        unsigned int glyphSetSize = (unsigned int)font->glyphs.size();
         writeUint(gpbFp, glyphSetSize);
         for (unsigned int j = 0; j < glyphSetSize; j++)
         {
-            writeUint(gpbFp, font->glyphArray[j].index);
-            writeUint(gpbFp, font->glyphArray[j].width);
-            fwrite(&font->glyphArray[j].bearingX, sizeof(int), 1, gpbFp);
-            writeUint(gpbFp, font->glyphArray[j].advance);
-            fwrite(&font->glyphArray[j].uvCoords, sizeof(float), 4, gpbFp);
+            const TTFGlyph& glyph = font->glyphs[j];
+            writeUint(gpbFp, glyph.index);
+            writeUint(gpbFp, glyph.width);
+            fwrite(&glyph.bearingX, sizeof(int), 1, gpbFp);
+            writeUint(gpbFp, glyph.advance);
+            fwrite(&glyph.uvCoords, sizeof(float), 4, gpbFp);
+            if (paged)
+                writeUint(gpbFp, glyph.page);
         }
 
-        // Image dimensions
-        unsigned int imageSize = font->imageWidth * font->imageHeight;
-        writeUint(gpbFp, font->imageWidth);
-        writeUint(gpbFp, font->imageHeight);
-        writeUint(gpbFp, imageSize);
-
-        FILE* previewFp = NULL;
-        std::string pgmFilePath;
-        if (fontpreview)
-        {
-            // Save out a pgm monochome image file for preview
-            std::ostringstream pgmFilePathStream;
-            pgmFilePathStream << getFilenameNoExt(outFilePath) << "-" << font->fontSize << ".pgm";
-            pgmFilePath = pgmFilePathStream.str();
-            previewFp = fopen(pgmFilePath.c_str(), "wb");
-            fprintf(previewFp, "P5 %u %u 255\n", font->imageWidth, font->imageHeight);
-        }
+        // Pages (GPB version 1.6+)
+        if (paged)
+            writeUint(gpbFp, font->pageCount);
 
-        if (fontFormat == Font::DISTANCE_FIELD)
+        bool color = fontFormat == Font::MULTI_CHANNEL_DISTANCE_FIELD;
+        unsigned int imageSize = font->imageWidth * font->imageHeight * (color ? 3 : 1);
+        for (unsigned int page = 0; page < font->pageCount; ++page)
         {
-            // Flip height and width since the distance field map generator is column-wise.
-            unsigned char* distanceFieldBuffer = createDistanceFields(font->imageBuffer, font->imageHeight, font->imageWidth);
-
-            fwrite(distanceFieldBuffer, sizeof(unsigned char), imageSize, gpbFp);
-            writeUint(gpbFp, Font::DISTANCE_FIELD);
-
-            if (previewFp)
-            {
-                fwrite((const char*)distanceFieldBuffer, sizeof(unsigned char), imageSize, previewFp);
-                fclose(previewFp);
-            }
+            // Image dimensions
+            writeUint(gpbFp, font->imageWidth);
+            writeUint(gpbFp, font->imageHeight);
+            writeUint(gpbFp, imageSize);
 
-            free(distanceFieldBuffer);
-        }
-        else
-        {
-            fwrite(font->imageBuffer, sizeof(unsigned char), imageSize, gpbFp);
-            writeUint(gpbFp, Font::BITMAP);
+            // The image buffer already holds the distance field for distance field fonts
+            const unsigned char* pageBuffer = font->imageBuffer + page * imageSize;
+            fwrite(pageBuffer, sizeof(unsigned char), imageSize, gpbFp);
 
-            if (previewFp)
+            if (fontpreview)
             {
-                fwrite((const char*)font->imageBuffer, sizeof(unsigned char), font->imageWidth * font->imageHeight, previewFp);
-                fclose(previewFp);
+                // Save out a pgm monochome image file for preview (or a ppm color image for
+                // multi-channel distance fields), one per page
+                std::ostringstream pgmFilePathStream;
+                pgmFilePathStream << getFilenameNoExt(outFilePath) << "-" << font->fontSize;
+                if (paged)
+                    pgmFilePathStream << "-" << page;
+                pgmFilePathStream << (color ? ".ppm" : ".pgm");
+                std::string pgmFilePath = pgmFilePathStream.str();
+                FILE* previewFp = fopen(pgmFilePath.c_str(), "wb");
+                if (previewFp)
+                {
+                    OutputCache::recordOutput(pgmFilePath);
+                    fprintf(previewFp, "%s %u %u 255\n", color ? "P6" : "P5", font->imageWidth, font->imageHeight);
+                    fwrite((const char*)pageBuffer, sizeof(unsigned char), imageSize, previewFp);
+                    fclose(previewFp);
+                    LOG(1, "%s.%s preview image created successfully. \n", getBaseName(pgmFilePath).c_str(), color ? "ppm" : "pgm");
+                }
             }
         }
-
-        if (previewFp)
-        {
-            fclose(previewFp);
-            LOG(1, "%s.pgm preview image created successfully. \n", getBaseName(pgmFilePath).c_str());
-        }
+        writeUint(gpbFp, fontFormat);
     }
 
     // Close file.
@@ -490,7 +1091,7 @@ int writeFont(const char* inFilePath, const char* outFilePath, std::vector<unsig
     }
 
     FT_Done_Face(face);
-    FT_Done_FreeType(library);
+    releaseFreeTypeLibrary(library);
     return 0;
 }
 
@@ -18,8 +18,33 @@ public:
     int bearingX;
     unsigned int advance;
     float uvCoords[4];
+    unsigned int page;
 };
 
+/**
+ * Parses a list of Unicode code points and code point ranges, such as "32-126,0x4E00-0x9FFF".
+ *
+ * Code points may be decimal, hexadecimal with a 0x prefix or in U+ notation.
+ *
+ * @param charset The comma separated list.
+ * @param characters Receives the code points, in the order they are listed.
+ *
+ * @return True if successful, false if the list is malformed (which is logged).
+ */
+bool parseCharset(const char* charset, std::vector<unsigned int>* characters);
+
+/**
+ * Reads the characters used by a UTF-8 text file, such as the strings of a game.
+ *
+ * Control characters are skipped.
+ *
+ * @param path Path to the text file.
+ * @param characters Receives the code points found in the file.
+ *
+ * @return True if successful, false if the file could not be read (which is logged).
+ */
+bool readCharsetFile(const char* path, std::vector<unsigned int>* characters);
+
 /**
  * Writes the font gpb file.
  * 
@@ -28,9 +53,21 @@ public:
  * @param fontSizes List of sizes to generate for the font.
  * @param id ID string of the font in the ref table.
  * @param fontpreview True if the pgm font preview file should be written. (For debugging)
+ * @param fontFormat Format of the font texture.
+ * @param nonPowerOfTwo True to allow a font texture whose sides are not powers of two.
+ * @param linearDistanceField True to generate distance fields with the linear-time exact
+ *        Euclidean distance transform instead of the anti-aliased one (edtaa3).
+ * @param supersample Factor to render glyphs larger by before computing the distance field,
+ *        when linearDistanceField is true.
+ * @param characters Code points to include, or empty for the printable ASCII characters.
+ *        Fonts with a character set of their own are always written in the paged (GPB 1.6)
+ *        layout, whose glyphs are looked up by code point.
+ * @param pageSize Width and height of each font texture page, or 0 to put every glyph
+ *        of a font size in a single texture.
  * 
  * @return 0 if successful, -1 if error.
  */
-int writeFont(const char* inFilePath, const char* outFilePath, std::vector<unsigned int>& fontSize, const char* id, bool fontpreview, Font::FontFormat fontFormat);
+int writeFont(const char* inFilePath, const char* outFilePath, std::vector<unsigned int>& fontSize, const char* id, bool fontpreview, Font::FontFormat fontFormat, bool nonPowerOfTwo,
+              bool linearDistanceField, unsigned int supersample, const std::vector<unsigned int>& characters, unsigned int pageSize);
 
 }
@@ -0,0 +1,252 @@
+#include "Base.h"
+#include "TaskScheduler.h"
+#include "EncoderArguments.h"
+#include "JobContext.h"
+
+namespace gameplay
+{
+
+// Scheduler and queue owned by the current thread, if it is a worker thread
+static thread_local TaskScheduler* __workerScheduler = NULL;
+static thread_local unsigned int __workerQueue = 0;
+
+TaskScheduler::TaskGroup::TaskGroup(TaskScheduler* scheduler) :
+    _scheduler(scheduler ? scheduler : TaskScheduler::getInstance()), _pending(0)
+{
+}
+
+TaskScheduler::TaskGroup::~TaskGroup()
+{
+    try
+    {
+        wait();
+    }
+    catch (...)
+    {
+    }
+}
+
+void TaskScheduler::TaskGroup::run(const Task& task)
+{
+    ++_pending;
+
+    Entry entry;
+    entry.task = task;
+    entry.group = this;
+    entry.context = JobContext::getCurrent();
+    _scheduler->push(entry);
+}
+
+void TaskScheduler::TaskGroup::wait()
+{
+    while (_pending.load() > 0)
+    {
+        // Help out rather than block, the tasks we are waiting on may still be queued
+        if (_scheduler->runOne())
+            continue;
+
+        // Otherwise they are running on other threads. Sleep until they finish or
+        // something new is queued.
+        std::unique_lock<std::mutex> lock(_scheduler->_sleepMutex);
+        _scheduler->_sleepCondition.wait(lock, [this]() { return _pending.load() == 0 || _scheduler->_queued.load() > 0; });
+    }
+
+    std::exception_ptr exception;
+    {
+        std::lock_guard<std::mutex> lock(_exceptionMutex);
+        exception = _exception;
+        _exception = std::exception_ptr();
+    }
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+TaskScheduler::TaskScheduler(unsigned int threadCount) :
+    _queued(0), _shutdown(false), _nextQueue(0), _tasksExecuted(0), _tasksStolen(0)
+{
+    if (threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+
+    // Queue 0 takes tasks submitted from outside the scheduler (and is serviced by the
+    // waiting thread), the rest belong to one worker thread each.
+    for (unsigned int i = 0; i < threadCount; ++i)
+        _queues.push_back(new Queue());
+    for (unsigned int i = 1; i < threadCount; ++i)
+        _threads.push_back(std::thread(&TaskScheduler::workerMain, this, i));
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _shutdown = true;
+    }
+    _sleepCondition.notify_all();
+
+    for (size_t i = 0, count = _threads.size(); i < count; ++i)
+        _threads[i].join();
+    for (size_t i = 0, count = _queues.size(); i < count; ++i)
+        delete _queues[i];
+}
+
+TaskScheduler* TaskScheduler::getInstance()
+{
+    // Created on first use so the thread count can come from the command line. The
+    // instance is intentionally never destroyed, since exit() may be called while tasks
+    // are still running.
+    static TaskScheduler* instance = new TaskScheduler(EncoderArguments::getInstance() ? EncoderArguments::getInstance()->getThreadCount() : 0);
+    return instance;
+}
+
+unsigned int TaskScheduler::getThreadCount() const
+{
+    return (unsigned int)_queues.size();
+}
+
+TaskScheduler::Statistics TaskScheduler::getStatistics() const
+{
+    Statistics statistics;
+    statistics.tasksExecuted = _tasksExecuted.load();
+    statistics.tasksStolen = _tasksStolen.load();
+    return statistics;
+}
+
+void TaskScheduler::parallelFor(int begin, int end, const std::function<void(int)>& body, int grainSize)
+{
+    if (grainSize < 1)
+        grainSize = 1;
+
+    if (_queues.size() == 1 || end - begin <= grainSize)
+    {
+        for (int i = begin; i < end; ++i)
+            body(i);
+        return;
+    }
+
+    TaskGroup group(this);
+    for (int first = begin; first < end; first += grainSize)
+    {
+        int last = min(first + grainSize, end);
+        group.run([&body, first, last]()
+        {
+            for (int i = first; i < last; ++i)
+                body(i);
+        });
+    }
+    group.wait();
+}
+
+void TaskScheduler::push(const Entry& entry)
+{
+    // Workers push to their own queue, other threads spread tasks over all queues
+    unsigned int index = __workerScheduler == this ? __workerQueue : _nextQueue++ % _queues.size();
+
+    Queue* queue = _queues[index];
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->entries.push_back(entry);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        ++_queued;
+    }
+    _sleepCondition.notify_one();
+}
+
+bool TaskScheduler::runOne()
+{
+    if (_queued.load() == 0)
+        return false;
+
+    unsigned int own = __workerScheduler == this ? __workerQueue : 0;
+    unsigned int count = (unsigned int)_queues.size();
+
+    Entry entry;
+    bool found = false;
+
+    // Newest task from our own queue first, it is the most likely to be cache warm
+    {
+        Queue* queue = _queues[own];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (!queue->entries.empty())
+        {
+            entry = queue->entries.back();
+            queue->entries.pop_back();
+            found = true;
+        }
+    }
+
+    // Otherwise steal the oldest task from another queue
+    for (unsigned int i = 1; !found && i < count; ++i)
+    {
+        Queue* queue = _queues[(own + i) % count];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (!queue->entries.empty())
+        {
+            entry = queue->entries.front();
+            queue->entries.pop_front();
+            found = true;
+            ++_tasksStolen;
+        }
+    }
+
+    if (!found)
+        return false;
+
+    --_queued;
+    std::exception_ptr exception;
+    {
+        JobContext::Scope scope(entry.context);
+        try
+        {
+            entry.task();
+        }
+        catch (...)
+        {
+            exception = std::current_exception();
+        }
+    }
+    ++_tasksExecuted;
+    finish(entry.group, exception);
+    return true;
+}
+
+void TaskScheduler::finish(TaskGroup* group, std::exception_ptr exception)
+{
+    if (exception)
+    {
+        std::lock_guard<std::mutex> lock(group->_exceptionMutex);
+        if (!group->_exception)
+            group->_exception = exception;
+    }
+
+    // The group may be destroyed as soon as its last task is done, so it must not be
+    // touched after that. Threads waiting on it check the count under the sleep mutex.
+    bool done;
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        done = --group->_pending == 0;
+    }
+    if (done)
+        _sleepCondition.notify_all();
+}
+
+void TaskScheduler::workerMain(unsigned int queueIndex)
+{
+    __workerScheduler = this;
+    __workerQueue = queueIndex;
+
+    while (!_shutdown)
+    {
+        if (runOne())
+            continue;
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _sleepCondition.wait(lock, [this]() { return _shutdown || _queued.load() > 0; });
+    }
+}
+
+}
@@ -0,0 +1,167 @@
+#ifndef TASKSCHEDULER_H_
+#define TASKSCHEDULER_H_
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+namespace gameplay
+{
+
+class JobContext;
+
+/**
+ * Work-stealing task scheduler shared by the encoder's parallel stages.
+ *
+ * Each worker thread owns a task queue. Workers pop their own most recently queued
+ * task first and, when their queue runs dry, steal the oldest task from another
+ * queue, so uneven workloads keep every core busy. Threads waiting on a task group
+ * execute queued tasks while there are any, which makes nested parallelism safe, and
+ * sleep once there are none left to run.
+ *
+ * Tasks run in the job context (see JobContext) of the thread that queued them.
+ */
+class TaskScheduler
+{
+public:
+
+    /**
+     * A unit of work.
+     */
+    typedef std::function<void()> Task;
+
+    /**
+     * Tracks a set of tasks that can be waited on together.
+     */
+    class TaskGroup
+    {
+        friend class TaskScheduler;
+
+    public:
+
+        /**
+         * Constructor.
+         *
+         * @param scheduler The scheduler to run tasks on, or NULL for the shared instance.
+         */
+        TaskGroup(TaskScheduler* scheduler = NULL);
+
+        /**
+         * Destructor. Waits for any outstanding tasks, discarding their exceptions.
+         */
+        ~TaskGroup();
+
+        /**
+         * Queues a task to run as part of this group.
+         */
+        void run(const Task& task);
+
+        /**
+         * Waits for all tasks queued in this group to complete, running queued
+         * tasks on the calling thread in the meantime.
+         *
+         * If a task in the group threw an exception, the first one thrown is
+         * rethrown here once all of the tasks have completed.
+         */
+        void wait();
+
+    private:
+
+        TaskGroup(const TaskGroup&);
+        TaskGroup& operator=(const TaskGroup&);
+
+        TaskScheduler* _scheduler;
+        std::atomic<int> _pending;
+        std::mutex _exceptionMutex;
+        std::exception_ptr _exception;
+    };
+
+    /**
+     * Scheduler statistics, accumulated since the scheduler was created.
+     */
+    struct Statistics
+    {
+        unsigned int tasksExecuted;
+        unsigned int tasksStolen;
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param threadCount Total number of threads to execute tasks on, including the
+     *        thread that waits on them. Zero uses the hardware concurrency.
+     */
+    TaskScheduler(unsigned int threadCount = 0);
+
+    /**
+     * Destructor. Stops and joins all worker threads.
+     */
+    ~TaskScheduler();
+
+    /**
+     * Returns the shared scheduler instance, sized from the encoder arguments.
+     */
+    static TaskScheduler* getInstance();
+
+    /**
+     * Returns the total number of threads that execute tasks.
+     */
+    unsigned int getThreadCount() const;
+
+    /**
+     * Returns the scheduler statistics.
+     */
+    Statistics getStatistics() const;
+
+    /**
+     * Calls body(i) for each i in [begin, end) and waits for all calls to complete.
+     *
+     * @param begin First index.
+     * @param end One past the last index.
+     * @param body Function to call for each index.
+     * @param grainSize Number of consecutive indices processed by a single task.
+     */
+    void parallelFor(int begin, int end, const std::function<void(int)>& body, int grainSize = 1);
+
+private:
+
+    struct Entry
+    {
+        Task task;
+        TaskGroup* group;
+        JobContext* context;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Entry> entries;
+    };
+
+    TaskScheduler(const TaskScheduler&);
+    TaskScheduler& operator=(const TaskScheduler&);
+
+    void push(const Entry& entry);
+    bool runOne();
+    void finish(TaskGroup* group, std::exception_ptr exception);
+    void workerMain(unsigned int queueIndex);
+
+    std::vector<Queue*> _queues;
+    std::vector<std::thread> _threads;
+    std::mutex _sleepMutex;
+    std::condition_variable _sleepCondition;
+    std::atomic<int> _queued;
+    std::atomic<bool> _shutdown;
+    std::atomic<unsigned int> _nextQueue;
+    std::atomic<unsigned int> _tasksExecuted;
+    std::atomic<unsigned int> _tasksStolen;
+};
+
+}
+
+#endif
@@ -7,6 +7,11 @@
 #include "EncoderArguments.h"
 #include "NormalMapGenerator.h"
 #include "Font.h"
+#include "Heightmap.h"
+#include "BatchEncoder.h"
+#include "EncoderServer.h"
+#include "JobContext.h"
+#include "OutputCache.h"
 
 using namespace gameplay;
 
@@ -68,27 +73,14 @@ static std::vector<unsigned int> promptUserFontSize()
 
 
 /**
- * Main application entry point.
- *
- * @param argc The number of command line arguments
- * @param argv The array of command line arguments.
+ * Encodes the input file of the arguments.
  *
- * usage:   gameplay-encoder[options] <file_list>
- * example: gameplay-encoder C:/assets/duck.fbx
- * example: gameplay-encoder -i boy duck.fbx
+ * @param arguments The arguments of the encode.
  *
- * @stod: Improve argument parsing.
+ * @return The exit code, 0 if successful.
  */
-int main(int argc, const char** argv)
+static int encode(const EncoderArguments& arguments)
 {
-    EncoderArguments arguments(argc, argv);
-
-    if (arguments.parseErrorOccured())
-    {
-        arguments.printUsage();
-        return 0;
-    }
-
     // Check if the file exists.
     if (!arguments.fileExists())
     {
@@ -138,6 +130,12 @@ int main(int argc, const char** argv)
             {
                 if (fontSizes.size() == 0)
                 {
+                    // Batch jobs can't ask for the sizes
+                    if (JobContext::getCurrent())
+                    {
+                        LOG(1, "Error: Bitmap fonts need font sizes (-s) in batch mode.\n");
+                        return -1;
+                    }
                     fontSizes = promptUserFontSize();
                 }
             }
@@ -149,8 +147,19 @@ int main(int argc, const char** argv)
                     fontSizes.push_back(FONT_SIZE_DISTANCEFIELD);
                 }
             }
+            // Characters to include, the printable ASCII characters if none are given
+            std::vector<unsigned int> characters;
+            if (!arguments.getFontCharset().empty() && !parseCharset(arguments.getFontCharset().c_str(), &characters))
+            {
+                return -1;
+            }
+            if (!arguments.getFontCharsetFile().empty() && !readCharsetFile(arguments.getFontCharsetFile().c_str(), &characters))
+            {
+                return -1;
+            }
             std::string id = getBaseName(arguments.getFilePath());
-            writeFont(arguments.getFilePath().c_str(), arguments.getOutputFilePath().c_str(), fontSizes, id.c_str(), arguments.fontPreviewEnabled(), fontFormat);
+            writeFont(arguments.getFilePath().c_str(), arguments.getOutputFilePath().c_str(), fontSizes, id.c_str(), arguments.fontPreviewEnabled(), fontFormat, arguments.fontNonPowerOfTwoEnabled(),
+                      arguments.fontLinearDistanceFieldEnabled(), arguments.getFontSupersample(), characters, arguments.getFontPageSize());
             break;
         }
     case EncoderArguments::FILEFORMAT_GPB:
@@ -167,7 +176,7 @@ int main(int argc, const char** argv)
             {
                 int x, y;
                 arguments.getHeightmapResolution(&x, &y);
-                NormalMapGenerator generator(arguments.getFilePath().c_str(), arguments.getOutputFilePath().c_str(), x, y, arguments.getHeightmapWorldSize());
+                NormalMapGenerator generator(arguments.getFilePath().c_str(), arguments.getOutputFilePath().c_str(), x, y, arguments.getHeightmapWorldSize(), arguments.normalMapStreamingEnabled());
                 generator.generate();
             }
             else
@@ -186,3 +195,140 @@ int main(int argc, const char** argv)
 
     return 0;
 }
+
+/**
+ * Encodes a file, copying its outputs from the output cache instead when it has been
+ * encoded before with the same inputs and options.
+ *
+ * @param arguments The arguments of the encode.
+ *
+ * @return The exit code, 0 if successful.
+ */
+static int encodeCached(const EncoderArguments& arguments)
+{
+    std::string key;
+    OutputCache cache(arguments.getCacheDirectory());
+    if (arguments.getCacheDirectory().empty() || !arguments.fileExists() || !cache.computeKey(arguments, &key))
+    {
+        return encode(arguments);
+    }
+
+    OutputCache::clearRecordedOutputs();
+    if (cache.restore(key))
+    {
+        LOG(1, "Restored %u files from the cache for %s\n", (unsigned int)OutputCache::getRecordedOutputs().size(), arguments.getFilePathPointer());
+        return 0;
+    }
+
+    // The outputs are only stored if the main output was written by this encode and recorded
+    OutputCache::clearRecordedOutputs();
+    time_t startTime = time(NULL);
+    int result = encode(arguments);
+    std::vector<std::string> outputs = OutputCache::getRecordedOutputs();
+    if (result == 0 && arguments.outputWrittenSince(startTime) &&
+        std::find(outputs.begin(), outputs.end(), arguments.getOutputFilePath()) != outputs.end())
+    {
+        cache.store(key, outputs);
+    }
+    return result;
+}
+
+/**
+ * Gets the options every job of a batch or server is given: those on the command line,
+ * other than the batch and server options themselves.
+ */
+static void getJobOptions(int argc, const char** argv, std::vector<std::string>* options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option(argv[i]);
+        if (option == "-batch" || option == "-bt" || option == "-batchReport" || option == "-br" ||
+            option == "-server" || option == "-sv")
+        {
+            ++i;
+            continue;
+        }
+        options->push_back(option);
+    }
+}
+
+/**
+ * Encodes the files of a batch manifest.
+ *
+ * @return The exit code, 0 if every file was encoded.
+ */
+static int encodeBatch(const EncoderArguments& arguments, int argc, const char** argv)
+{
+    std::vector<std::string> options;
+    getJobOptions(argc, argv, &options);
+
+    BatchEncoder batch;
+    if (!batch.readManifest(arguments.getBatchManifest(), options))
+    {
+        return -1;
+    }
+
+    LOG(1, "Encoding %u files from: %s\n", batch.getJobCount(), arguments.getBatchManifest().c_str());
+    batch.run(encodeCached);
+    batch.writeReport(arguments.getBatchReportPath());
+    LOG(1, "Encoded %u of %u files. Report: %s\n", batch.getJobCount() - batch.getFailedCount(), batch.getJobCount(), arguments.getBatchReportPath().c_str());
+
+    return batch.getFailedCount() == 0 ? 0 : -1;
+}
+
+/**
+ * Encodes the files requested over a local socket until the server is shut down.
+ *
+ * @return The exit code.
+ */
+static int encodeServer(const EncoderArguments& arguments, int argc, const char** argv)
+{
+    std::vector<std::string> options;
+    getJobOptions(argc, argv, &options);
+
+    EncoderServer server(arguments.getServerSocketPath(), options);
+    return server.run(encodeCached);
+}
+
+/**
+ * Main application entry point.
+ *
+ * @param argc The number of command line arguments
+ * @param argv The array of command line arguments.
+ *
+ * usage:   gameplay-encoder[options] <file_list>
+ * example: gameplay-encoder C:/assets/duck.fbx
+ * example: gameplay-encoder -i boy duck.fbx
+ * example: gameplay-encoder -batch assets.txt
+ * example: gameplay-encoder -server /tmp/gameplay-encoder.sock
+ *
+ * @stod: Improve argument parsing.
+ */
+int main(int argc, const char** argv)
+{
+    EncoderArguments arguments(argc, argv);
+
+    if (arguments.parseErrorOccured())
+    {
+        arguments.printUsage();
+        return 0;
+    }
+
+    if (arguments.heightmapBenchmarkEnabled())
+    {
+        Heightmap::benchmarkKernels();
+        return 0;
+    }
+
+    if (!arguments.getBatchManifest().empty())
+    {
+        return encodeBatch(arguments, argc, argv);
+    }
+
+    if (!arguments.getServerSocketPath().empty())
+    {
+        return encodeServer(arguments, argc, argv);
+    }
+
+    return encodeCached(arguments);
+}